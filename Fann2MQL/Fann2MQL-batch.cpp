@@ -0,0 +1,358 @@
+/* Fann2MQL-batch.cpp
+ *
+ * Copyright (C) 2008-2009 Mariusz Woloszyn
+ *
+ *  This file is part of Fann2MQL package
+ *
+ *  Fann2MQL is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Fann2MQL is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Fann2MQL; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include "stdafx.h"
+#include "Fann2MQL.h"
+#include "doublefann.h"
+#include "fann_internal.h"
+#include "windows.h"
+#include <math.h>
+
+#include "tbb/blocked_range.h"
+#include "tbb/parallel_for.h"
+
+using namespace tbb;
+
+/* Returns the number of doubles of scratch memory needed by f2M_run_batch() */
+int f2M_batch_scratch_size(struct fann *ann)
+{
+	return ann->total_neurons*F2M_BATCH;
+}
+
+/* Computes the outputs of a network for a block of samples at once.
+ * The network is only read, so many threads can run it at the same time.
+ * Neuron values are kept sample-minor (values[neuron*F2M_BATCH+sample]) and
+ * every connection is applied to the whole block, which turns fann_run()'s
+ * per sample dot products into vectorizable loops. Sums are accumulated in
+ * the same order as fann_run() does, so the results are bit-identical.
+ * Scaled networks take raw inputs and return descaled outputs.
+ *  ann - fann structure
+ *  *weights - weights to be used instead of ann->weights, or NULL
+ *  n - number of samples, 1..F2M_BATCH
+ *  *inputs - n rows of num_input inputs
+ *  *outputs - n rows of num_output outputs, may be NULL
+ *  *values - f2M_batch_scratch_size() doubles receiving all neuron values
+ *  *sums - f2M_batch_scratch_size() doubles receiving neuron sums, or NULL
+ */
+void f2M_run_batch(struct fann *ann, double *weights, int n, double *inputs, double *outputs, double *values, double *sums)
+{
+	struct fann_neuron *first=ann->first_layer->first_neuron;
+	struct fann_neuron *neuron_it, *last_neuron;
+	struct fann_layer *layer_it;
+	struct fann_neuron **conns;
+	const fastTables *ft=(const fastTables*) ann->user_data;
+	unsigned int num_input=ann->num_input, num_output=ann->num_output;
+	unsigned int i, c, num_connections, activation_function;
+	double *v, *s0, *s1, *s2, *s3, *w;
+	double steepness, max_sum, neuron_sum;
+	int b;
+
+	if (weights==NULL) weights=ann->weights;
+
+	/* input layer, scaled while loaded, and its bias */
+	if (f2M_scaled(ann)) {
+		for (i=0; i<num_input; i++)
+			for (b=0; b<n; b++)
+				values[i*F2M_BATCH+b]=f2M_scale_input(ann, i, inputs[b*num_input+i]);
+	} else {
+		for (i=0; i<num_input; i++)
+			for (b=0; b<n; b++)
+				values[i*F2M_BATCH+b]=inputs[b*num_input+i];
+	}
+	v=values+(ann->first_layer->last_neuron-1-first)*F2M_BATCH;
+	for (b=0; b<n; b++) v[b]=1;
+
+	for (layer_it=ann->first_layer+1; layer_it!=ann->last_layer; layer_it++) {
+		last_neuron=layer_it->last_neuron;
+		for (neuron_it=layer_it->first_neuron; neuron_it!=last_neuron; neuron_it++) {
+			v=values+(neuron_it-first)*F2M_BATCH;
+
+			/* bias neuron */
+			if (neuron_it->first_con==neuron_it->last_con) {
+				for (b=0; b<n; b++) v[b]=1;
+				continue;
+			}
+
+			activation_function=neuron_it->activation_function;
+			steepness=neuron_it->activation_steepness;
+			num_connections=neuron_it->last_con-neuron_it->first_con;
+			w=weights+neuron_it->first_con;
+			conns=ann->connections+neuron_it->first_con;
+
+			for (b=0; b<n; b++) v[b]=0;
+
+			/* the remainder first and then groups of four, like fann_run() */
+			c=num_connections&3;
+			switch (c) {
+			case 3:
+				s2=values+(conns[2]-first)*F2M_BATCH;
+				for (b=0; b<n; b++) v[b]+=w[2]*s2[b];
+			case 2:
+				s1=values+(conns[1]-first)*F2M_BATCH;
+				for (b=0; b<n; b++) v[b]+=w[1]*s1[b];
+			case 1:
+				s0=values+(conns[0]-first)*F2M_BATCH;
+				for (b=0; b<n; b++) v[b]+=w[0]*s0[b];
+			case 0:
+				break;
+			}
+			for (; c!=num_connections; c+=4) {
+				s0=values+(conns[c]-first)*F2M_BATCH;
+				s1=values+(conns[c+1]-first)*F2M_BATCH;
+				s2=values+(conns[c+2]-first)*F2M_BATCH;
+				s3=values+(conns[c+3]-first)*F2M_BATCH;
+				for (b=0; b<n; b++)
+					v[b]+=w[c]*s0[b]+w[c+1]*s1[b]+w[c+2]*s2[b]+w[c+3]*s3[b];
+			}
+
+			max_sum=150/steepness;
+			for (b=0; b<n; b++) {
+				neuron_sum=steepness*v[b];
+				if (neuron_sum>max_sum)
+					neuron_sum=max_sum;
+				else if (neuron_sum<-max_sum)
+					neuron_sum=-max_sum;
+				if (sums!=NULL) sums[(neuron_it-first)*F2M_BATCH+b]=neuron_sum;
+				if (ft!=NULL)
+					v[b]=f2M_fast_activation(ft, activation_function, neuron_sum);
+				else
+					fann_activation_switch(activation_function, neuron_sum, v[b]);
+			}
+		}
+	}
+
+	if (outputs==NULL) return;
+
+	/* output layer, descaled while read */
+	v=values+((ann->last_layer-1)->first_neuron-first)*F2M_BATCH;
+	if (f2M_scaled(ann)) {
+		for (i=0; i<num_output; i++)
+			for (b=0; b<n; b++)
+				outputs[b*num_output+i]=f2M_descale_output(ann, i, v[i*F2M_BATCH+b]);
+	} else {
+		for (i=0; i<num_output; i++)
+			for (b=0; b<n; b++)
+				outputs[b*num_output+i]=v[i*F2M_BATCH+b];
+	}
+}
+
+/* Returns 0.5 if the MSE of an output neuron is computed on halved differences
+ * (symmetric activation functions, see fann_update_MSE()), 1 otherwise.
+ */
+double f2M_mse_factor(struct fann_neuron *neuron)
+{
+	switch (neuron->activation_function) {
+	case FANN_LINEAR_PIECE_SYMMETRIC:
+	case FANN_THRESHOLD_SYMMETRIC:
+	case FANN_SIGMOID_SYMMETRIC:
+	case FANN_SIGMOID_SYMMETRIC_STEPWISE:
+	case FANN_ELLIOT_SYMMETRIC:
+	case FANN_GAUSSIAN_SYMMETRIC:
+	case FANN_SIN_SYMMETRIC:
+	case FANN_COS_SYMMETRIC:
+		return 0.5;
+	}
+	return 1.0;
+}
+
+/* number of samples of a chunk whose errors are summed by a single thread */
+#define F2M_TEST_CHUNK	(16*F2M_BATCH)
+
+/* Intel TBB paralelized class used by f2M_test_dataset().
+ * Every chunk of samples has its own partial sums, added up in chunk order
+ * afterwards, so the result does not depend on how the chunks were scheduled.
+ */
+class Apply_test {
+	struct fann *ann;
+	int num_data;
+	double *inputs;
+	double *targets;
+	double *residuals;
+	double *factors;
+	double *mse;
+	int *bit_fail;
+	volatile LONG *failed;
+public:
+	void operator()( const blocked_range<size_t>& r ) const {
+		unsigned int num_input=ann->num_input, num_output=ann->num_output, o;
+		double *values, *out, diff;
+		size_t chunk, i, end;
+		int b, n;
+
+		values=(double*) f2M_malloc((f2M_batch_scratch_size(ann)+F2M_BATCH*num_output)*sizeof(double));
+		if (values==NULL) {
+			InterlockedExchange(failed, 1);
+			return;
+		}
+		out=values+f2M_batch_scratch_size(ann);
+
+		for (chunk=r.begin(); chunk!=r.end(); chunk++) {
+			end=(chunk+1)*F2M_TEST_CHUNK<(size_t) num_data ? (chunk+1)*F2M_TEST_CHUNK : num_data;
+			for (i=chunk*F2M_TEST_CHUNK; i<end; i+=n) {
+				n=(int) (end-i<F2M_BATCH ? end-i : F2M_BATCH);
+				f2M_run_batch(ann, NULL, n, inputs+i*num_input, out, values, NULL);
+				for (b=0; b<n; b++) {
+					for (o=0; o<num_output; o++) {
+						diff=targets[(i+b)*num_output+o]-out[b*num_output+o];
+						if (residuals!=NULL) residuals[(i+b)*num_output+o]=diff;
+						/* the error of scaled networks is measured on scaled outputs, like f2M_test() */
+						if (f2M_scaled(ann)) diff*=ann->scale_factor_out[o]/ann->scale_deviation_out[o];
+						diff*=factors[o];
+						mse[chunk]+=diff*diff;
+						if ((diff<0 ? -diff : diff)>=ann->bit_fail_limit) bit_fail[chunk]++;
+					}
+				}
+			}
+		}
+
+		f2M_free(values);
+	}
+	Apply_test(struct fann *a, int nd, double *iv, double *tv, double *rv, double *f, double *m, int *bf, volatile LONG *fl) :
+		ann(a), num_data(nd), inputs(iv), targets(tv), residuals(rv), factors(f), mse(m), bit_fail(bf), failed(fl)
+	{}
+};
+
+/**
+ * Tests a network on a whole dataset in parallel using Intel TBB
+ *  ann - network handler returned by f2M_create*
+ *  num_data - number of samples
+ *  *inputs - num_data*num_input array of inputs, sample after sample
+ *  *targets - num_data*num_output array of desired outputs
+ *  *mse - receives the mean square error, computed like f2M_get_MSE() does
+ *  *bit_fail - receives the number of fail bits, like f2M_get_bit_fail()
+ *  *residuals - num_data*num_output array receiving desired minus actual outputs, or NULL
+ * Returns:
+ *  0 on success, -1 if f2M_parallel_init() was not called, -5 if the parallel
+ *  execution failed, -12 if the network is not allocated, -30 on invalid
+ *  arguments, -31 if out of memory
+ * Note:
+ *  Unlike f2M_test() this function does not change the MSE of the network.
+ */
+FANN2MQL_API int __stdcall f2M_test_dataset(int ann, int num_data, double *inputs, double *targets, double *mse, int *bit_fail, double *residuals)
+{
+	double *factors, *partial_mse;
+	int *partial_bit_fail;
+	struct fann *f;
+	unsigned int o, num_output;
+	int phase, chunks, c;
+	volatile LONG failed=0;
+	AnnPin pin;
+
+	if (!_TBB_Initialized) return f2M_error(-1, ann, __FUNCTION__, "f2M_parallel_init() was not called");
+
+	/* this network is not allocated */
+	if (!pin.acquire(ann)) return f2M_error_handle(-12, ann, __FUNCTION__);
+
+	/* the input or output vector is empty */
+	if (inputs==NULL || targets==NULL || mse==NULL || bit_fail==NULL || num_data<1)
+		return f2M_error(-30, ann, __FUNCTION__, "invalid arguments");
+
+	chunks=(num_data+F2M_TEST_CHUNK-1)/F2M_TEST_CHUNK;
+	f=f2M_read_lock(ann, &phase);
+	num_output=f->num_output;
+	factors=(double*) f2M_malloc(f->num_output*sizeof(double));
+	partial_mse=(double*) f2M_malloc(chunks*sizeof(double));
+	partial_bit_fail=(int*) f2M_malloc(chunks*sizeof(int));
+	if (factors==NULL || partial_mse==NULL || partial_bit_fail==NULL) {
+		f2M_read_unlock(ann, phase);
+		f2M_free(factors);
+		f2M_free(partial_mse);
+		f2M_free(partial_bit_fail);
+		return f2M_error(-31, ann, __FUNCTION__, "out of memory");
+	}
+	for (o=0; o<f->num_output; o++)
+		factors[o]=f2M_mse_factor((f->last_layer-1)->first_neuron+o);
+	memset(partial_mse, 0, chunks*sizeof(double));
+	memset(partial_bit_fail, 0, chunks*sizeof(int));
+
+	f2M_inference_enter();
+	try {
+		parallel_for(blocked_range<size_t>(0, chunks),
+		             Apply_test(f, num_data, inputs, targets, residuals, factors, partial_mse, partial_bit_fail, &failed), auto_partitioner());
+	} catch (...) {
+		failed=2;
+	}
+	f2M_inference_leave();
+	f2M_read_unlock(ann, phase);
+
+	/* a chunk without scratch memory was not tested */
+	if (failed) {
+		f2M_free(factors);
+		f2M_free(partial_mse);
+		f2M_free(partial_bit_fail);
+		if (failed==2) return f2M_error(-5, ann, __FUNCTION__, "parallel execution failed");
+		return f2M_error(-31, ann, __FUNCTION__, "out of memory");
+	}
+
+	*mse=0;
+	*bit_fail=0;
+	for (c=0; c<chunks; c++) {
+		*mse+=partial_mse[c];
+		*bit_fail+=partial_bit_fail[c];
+	}
+	*mse/=(double) num_data*num_output;
+
+	f2M_free(factors);
+	f2M_free(partial_mse);
+	f2M_free(partial_bit_fail);
+
+	return 0;
+}
+
+/**
+ * Tests a network on a dataset handle in parallel using Intel TBB, see f2M_test_dataset()
+ *  ann - network handler returned by f2M_create*
+ *  data - dataset handler returned by f2M_data_*
+ *  *mse - receives the mean square error
+ *  *bit_fail - receives the number of fail bits
+ * Returns:
+ *  0 on success, <0 on error
+ */
+FANN2MQL_API int __stdcall f2M_test_data(int ann, int data, double *mse, int *bit_fail)
+{
+	struct fann_train_data *d;
+	double *inputs, *targets;
+	int ret;
+	AnnPin pin;
+	DataPin data_pin;
+
+	/* this network is not allocated */
+	if (!pin.acquire(ann)) return f2M_error_handle(-12, ann, __FUNCTION__);
+
+	d=data_pin.acquire(data);
+	if (d==NULL || d->num_data<1) return f2M_error(-30, ann, __FUNCTION__, "invalid or empty dataset");
+	if (d->num_input!=_fanns[ann]->num_input || d->num_output!=_fanns[ann]->num_output)
+		return f2M_error(-32, ann, __FUNCTION__, "dataset does not fit the network");
+
+	/* the batched kernel reads samples from contiguous rows */
+	inputs=(double*) f2M_malloc((size_t) d->num_data*d->num_input*sizeof(double));
+	targets=(double*) f2M_malloc((size_t) d->num_data*d->num_output*sizeof(double));
+	if (inputs==NULL || targets==NULL || f2M_data_gather(d, inputs, targets)!=0) {
+		f2M_free(inputs);
+		f2M_free(targets);
+		return f2M_error(-31, ann, __FUNCTION__, "out of memory");
+	}
+
+	ret=f2M_test_dataset(ann, (int) d->num_data, inputs, targets, mse, bit_fail, NULL);
+	f2M_free(inputs);
+	f2M_free(targets);
+	return ret;
+}
@@ -0,0 +1,273 @@
+/* Fann2MQL-cache.cpp
+ *
+ * Copyright (C) 2008-2009 Mariusz Woloszyn
+ *
+ *  This file is part of Fann2MQL package
+ *
+ *  Fann2MQL is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Fann2MQL is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Fann2MQL; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include "stdafx.h"
+#include "Fann2MQL.h"
+#include "doublefann.h"
+#include "fann_internal.h"
+#include "windows.h"
+
+/* Results of recent inputs.
+ * Charts and indicators often run a network on the same inputs several times
+ * within a bar. A cache remembers the outputs of recent input vectors in a
+ * small set-associative table: the hash of the inputs selects a set, the
+ * inputs kept with every entry are compared exactly, and the least recently
+ * used entry of the set is replaced. Every entry remembers the generation of
+ * the weights it was computed with (f2M_generation()), so training, new
+ * weights, activation or fast math changes invalidate it without touching
+ * the table.
+ */
+
+/* number of entries of a set */
+#define F2M_CACHE_WAYS	4
+
+typedef struct cE {
+	unsigned __int64 hash;
+	LONG generation;
+	unsigned int used;	/* tick of the last use, 0 if empty */
+} cacheEntry;
+
+typedef struct rC {
+	int sets;			/* number of sets, a power of two */
+	int row_size;		/* num_input+num_output */
+	int num_input;
+	cacheEntry *entries;	/* sets*F2M_CACHE_WAYS entries, NULL if disabled */
+	double *rows;		/* inputs and outputs of every entry */
+	unsigned int tick;
+	LONG hits;
+	LONG misses;
+	CRITICAL_SECTION cs;
+} resultCache;
+
+/* result caches of networks, kept until the handler is released */
+resultCache* _caches[ANNMAX];
+
+/* Hashes an input vector, FNV-1a over its 64 bit words */
+unsigned __int64 f2M_input_hash(double *input, int n)
+{
+	unsigned __int64 h=14695981039346656037ULL, w;
+	int i;
+
+	for (i=0; i<n; i++) {
+		memcpy(&w, input+i, sizeof(w));
+		h=(h^w)*1099511628211ULL;
+	}
+	return h^(h>>29);
+}
+
+/* Looks up the outputs of a network for an input vector
+ *  ann - network handler
+ *  generation - current generation of the weights, f2M_generation()
+ *  *input_vector - arrary of inputs
+ *  *outputs - receives num_output outputs on a hit
+ * Returns:
+ *  1 on a hit, 0 otherwise
+ */
+int f2M_cache_lookup(int ann, LONG generation, double *input_vector, double *outputs)
+{
+	resultCache *c=_caches[ann];
+	cacheEntry *e;
+	unsigned __int64 h;
+	int i, hit=0;
+
+	if (c==NULL || c->entries==NULL) return 0;
+
+	EnterCriticalSection(&c->cs);
+	if (c->entries!=NULL) {
+		h=f2M_input_hash(input_vector, c->num_input);
+		e=c->entries+(int) (h&(c->sets-1))*F2M_CACHE_WAYS;
+		for (i=0; i<F2M_CACHE_WAYS; i++, e++) {
+			if (e->used==0 || e->hash!=h || e->generation!=generation) continue;
+			if (memcmp(c->rows+(e-c->entries)*c->row_size, input_vector, c->num_input*sizeof(double))!=0) continue;
+
+			memcpy(outputs, c->rows+(e-c->entries)*c->row_size+c->num_input, (c->row_size-c->num_input)*sizeof(double));
+			e->used=++c->tick;
+			hit=1;
+			break;
+		}
+		if (hit) c->hits++; else c->misses++;
+	}
+	LeaveCriticalSection(&c->cs);
+
+	return hit;
+}
+
+/* Stores the outputs of a network for an input vector
+ *  ann - network handler
+ *  generation - generation of the weights the outputs were computed with,
+ *    read before running the network
+ *  *input_vector - arrary of inputs
+ *  *outputs - num_output outputs
+ */
+void f2M_cache_store(int ann, LONG generation, double *input_vector, double *outputs)
+{
+	resultCache *c=_caches[ann];
+	cacheEntry *e, *set, *victim;
+	unsigned __int64 h;
+	int i;
+
+	if (c==NULL || c->entries==NULL) return;
+
+	EnterCriticalSection(&c->cs);
+	if (c->entries!=NULL) {
+		h=f2M_input_hash(input_vector, c->num_input);
+		set=c->entries+(int) (h&(c->sets-1))*F2M_CACHE_WAYS;
+
+		/* an entry of the same inputs, an empty one or the least recently used */
+		victim=set;
+		for (i=0, e=set; i<F2M_CACHE_WAYS; i++, e++) {
+			if (e->used!=0 && e->hash==h &&
+				memcmp(c->rows+(e-c->entries)*c->row_size, input_vector, c->num_input*sizeof(double))==0) {
+				victim=e;
+				break;
+			}
+			if (e->used<victim->used) victim=e;
+		}
+
+		victim->hash=h;
+		victim->generation=generation;
+		victim->used=++c->tick;
+		memcpy(c->rows+(victim-c->entries)*c->row_size, input_vector, c->num_input*sizeof(double));
+		memcpy(c->rows+(victim-c->entries)*c->row_size+c->num_input, outputs, (c->row_size-c->num_input)*sizeof(double));
+	}
+	LeaveCriticalSection(&c->cs);
+}
+
+/* Frees the table of a cache, the caller holds its lock */
+static void f2M_cache_clear(resultCache *c)
+{
+	f2M_free(c->entries);
+	f2M_free(c->rows);
+	c->entries=NULL;
+	c->rows=NULL;
+	c->sets=0;
+}
+
+/* Frees the cache of a handler being destroyed */
+void f2M_cache_release(int ann)
+{
+	resultCache *c=_caches[ann];
+
+	if (c==NULL) return;
+	_caches[ann]=NULL;
+	f2M_cache_clear(c);
+	DeleteCriticalSection(&c->cs);
+	f2M_free(c);
+}
+
+/* Returns the number of bytes used by the cache of a network, 0 if none */
+double f2M_cache_memory(int ann)
+{
+	resultCache *c=_caches[ann];
+
+	if (c==NULL) return 0;
+	return sizeof(resultCache)+(double) c->sets*F2M_CACHE_WAYS*(sizeof(cacheEntry)+c->row_size*sizeof(double));
+}
+
+/**
+ * Enables, resizes or disables the result cache of a network
+ *  ann - network handler returned by f2M_create*
+ *  entries - number of input vectors remembered, rounded up to a power of
+ *    two; 0 disables the cache
+ * Returns:
+ *  0 on success, <0 on error
+ * Note:
+ *  f2M_run() and the parallel functions return remembered outputs for
+ *  inputs equal to recent ones, bit for bit, if the weights did not change
+ *  since. Resizing forgets the remembered outputs and resets the counters.
+ */
+FANN2MQL_API int __stdcall f2M_set_cache(int ann, int entries)
+{
+	resultCache *c;
+	int sets;
+	AnnPin pin;
+
+	/* this network is not allocated */
+	if (!pin.acquire(ann)) return f2M_error_handle(-1, ann, __FUNCTION__);
+
+	/* not accepting bogus arguments */
+	if (entries<0 || entries>(1<<20)) return f2M_error(-2, ann, __FUNCTION__, "invalid number of entries");
+
+	c=_caches[ann];
+	if (c==NULL) {
+		if (entries==0) return 0;
+		c=(resultCache*) f2M_calloc(sizeof(resultCache));
+		if (c==NULL) return f2M_error(-3, ann, __FUNCTION__, "out of memory");
+		InitializeCriticalSection(&c->cs);
+		_caches[ann]=c;
+	}
+
+	EnterCriticalSection(&c->cs);
+	f2M_cache_clear(c);
+	c->hits=0;
+	c->misses=0;
+	c->tick=0;
+	if (entries>0) {
+		for (sets=1; sets*F2M_CACHE_WAYS<entries; sets<<=1);
+		c->num_input=(int) _fanns[ann]->num_input;
+		c->row_size=c->num_input+(int) _fanns[ann]->num_output;
+		c->entries=(cacheEntry*) f2M_calloc(sets*F2M_CACHE_WAYS*sizeof(cacheEntry));
+		c->rows=(double*) f2M_malloc(sets*F2M_CACHE_WAYS*c->row_size*sizeof(double));
+		if (c->entries==NULL || c->rows==NULL) {
+			f2M_cache_clear(c);
+			LeaveCriticalSection(&c->cs);
+			return f2M_error(-3, ann, __FUNCTION__, "out of memory");
+		}
+		c->sets=sets;
+	}
+	LeaveCriticalSection(&c->cs);
+
+	return 0;
+}
+
+/**
+ * Reports the efficiency of the result cache of a network
+ *  ann - network handler returned by f2M_create*
+ *  *stats - array of F2M_CACHE_STATS doubles receiving:
+ *    [0] number of runs answered from the cache
+ *    [1] number of runs computed
+ *    [2] number of entries, 0 if the cache is disabled
+ * Returns:
+ *  0 on success, <0 on error
+ */
+FANN2MQL_API int __stdcall f2M_get_cache_stats(int ann, double *stats)
+{
+	resultCache *c;
+
+	/* this network is not allocated */
+	if (ann<0 || ann>_ann) return f2M_error_handle(-1, ann, __FUNCTION__);
+
+	if (stats==NULL) return f2M_error(-2, ann, __FUNCTION__, "stats is NULL");
+
+	c=_caches[ann];
+	stats[0]=0;
+	stats[1]=0;
+	stats[2]=0;
+	if (c!=NULL) {
+		EnterCriticalSection(&c->cs);
+		stats[0]=c->hits;
+		stats[1]=c->misses;
+		stats[2]=c->sets*F2M_CACHE_WAYS;
+		LeaveCriticalSection(&c->cs);
+	}
+
+	return 0;
+}
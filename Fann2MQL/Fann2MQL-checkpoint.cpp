@@ -0,0 +1,446 @@
+/* Fann2MQL-checkpoint.cpp
+ *
+ * Copyright (C) 2008-2009 Mariusz Woloszyn
+ *
+ *  This file is part of Fann2MQL package
+ *
+ *  Fann2MQL is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Fann2MQL is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Fann2MQL; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include "stdafx.h"
+#include "Fann2MQL.h"
+#include "doublefann.h"
+#include "fann_internal.h"
+#include "windows.h"
+#include <stdio.h>
+#include <string.h>
+
+/* Training checkpoints.
+ * fann_save() keeps the weights and parameters only, while RPROP and
+ * Quickprop learn a step size and remember the previous slope of every
+ * connection; a restarted run would start them over. A checkpoint is the
+ * .net file of fann_save() plus a binary .state file next to it holding the
+ * exact weights, the training arrays and the number of epochs trained.
+ * Every few epochs the trainer takes a copy of the network and a thread of
+ * its own writes it to temporary files renamed over the previous
+ * checkpoint, so training goes on while the files are written and an
+ * interrupted write leaves the previous checkpoint intact. If the previous
+ * checkpoint is still being written when the next one is due, the next one
+ * is skipped rather than waited for.
+ */
+
+/* number of training arrays kept in a checkpoint */
+#define F2M_CHECKPOINT_ARRAYS	4
+#define F2M_CHECKPOINT_VERSION	1
+
+typedef struct cH {
+	char magic[8];			/* "F2MCKPT" */
+	int version;
+	unsigned int epoch;		/* epochs trained */
+	int algorithm;			/* FANN_TRAIN_* the arrays belong to */
+	unsigned int total_connections;
+	unsigned int arrays;	/* bit i set if training array i follows the weights */
+} checkpointHeader;
+
+typedef struct cP {
+	char path[MAX_PATH];	/* .net file, empty if checkpointing is disabled */
+	int every;				/* epochs between checkpoints */
+	unsigned int epoch;		/* epochs trained */
+	unsigned int written;	/* epoch of the last checkpoint written */
+	LONG failures;			/* checkpoints that could not be written */
+	struct fann *snapshot;	/* copy being written */
+	unsigned int snapshot_epoch;
+	char snapshot_path[MAX_PATH];	/* path may be changed while it is written */
+	HANDLE writer;			/* thread writing the last snapshot, or NULL */
+	volatile LONG busy;
+	CRITICAL_SECTION cs;
+} checkpointData;
+
+/* checkpoints of networks, kept until the handler is released */
+checkpointData* _checkpoints[ANNMAX];
+
+/* Returns the training array i of a network */
+static fann_type** f2M_checkpoint_array(struct fann *ann, int i)
+{
+	switch (i) {
+	case 0: return &ann->train_slopes;
+	case 1: return &ann->prev_steps;
+	case 2: return &ann->prev_train_slopes;
+	default: return &ann->prev_weights_deltas;
+	}
+}
+
+/* Writes the .state file of a network
+ *  ann - fann structure
+ *  epoch - epochs trained
+ *  *path - file name
+ * Returns:
+ *  0 on success, -1 on error
+ */
+static int f2M_checkpoint_write_state(struct fann *ann, unsigned int epoch, char *path)
+{
+	checkpointHeader h;
+	fann_type *a;
+	FILE *fp;
+	int i, ret=0;
+
+	memset(&h, 0, sizeof(h));
+	strcpy_s(h.magic, sizeof(h.magic), "F2MCKPT");
+	h.version=F2M_CHECKPOINT_VERSION;
+	h.epoch=epoch;
+	h.algorithm=(int) ann->training_algorithm;
+	h.total_connections=ann->total_connections;
+	for (i=0; i<F2M_CHECKPOINT_ARRAYS; i++)
+		if (*f2M_checkpoint_array(ann, i)!=NULL) h.arrays|=1<<i;
+
+	if (fopen_s(&fp, path, "wb")!=0) return -1;
+	if (fwrite(&h, sizeof(h), 1, fp)!=1 ||
+		fwrite(ann->weights, sizeof(fann_type), h.total_connections, fp)!=h.total_connections)
+		ret=-1;
+	for (i=0; i<F2M_CHECKPOINT_ARRAYS && ret==0; i++) {
+		a=*f2M_checkpoint_array(ann, i);
+		if (a!=NULL && fwrite(a, sizeof(fann_type), h.total_connections, fp)!=h.total_connections) ret=-1;
+	}
+	if (fclose(fp)!=0) ret=-1;
+
+	return ret;
+}
+
+/* Reads the .state file of a network and restores it
+ *  ann - fann structure loaded from the .net file of the checkpoint
+ *  *path - file name
+ *  *epoch - receives the epochs trained
+ * Returns:
+ *  0 on success, -1 if the file can not be read, -2 if it does not belong to the network
+ */
+static int f2M_checkpoint_read_state(struct fann *ann, char *path, unsigned int *epoch)
+{
+	checkpointHeader h;
+	fann_type *arrays[F2M_CHECKPOINT_ARRAYS], **a;
+	size_t bytes;
+	FILE *fp;
+	int i, ret=0;
+
+	if (fopen_s(&fp, path, "rb")!=0) return -1;
+	if (fread(&h, sizeof(h), 1, fp)!=1) {
+		fclose(fp);
+		return -1;
+	}
+	if (memcmp(h.magic, "F2MCKPT", 8)!=0 || h.version!=F2M_CHECKPOINT_VERSION ||
+		h.total_connections!=ann->total_connections) {
+		fclose(fp);
+		return -2;
+	}
+
+	/* read everything before touching the network, FANN frees the arrays with free() */
+	bytes=h.total_connections*sizeof(fann_type);
+	memset(arrays, 0, sizeof(arrays));
+	for (i=0; i<F2M_CHECKPOINT_ARRAYS && ret==0; i++) {
+		if (!(h.arrays&(1<<i))) continue;
+		arrays[i]=(fann_type*) malloc(bytes);
+		if (arrays[i]==NULL) ret=-1;
+	}
+	if (ret==0 && fread(ann->weights, sizeof(fann_type), h.total_connections, fp)!=h.total_connections) ret=-1;
+	for (i=0; i<F2M_CHECKPOINT_ARRAYS && ret==0; i++)
+		if (arrays[i]!=NULL && fread(arrays[i], sizeof(fann_type), h.total_connections, fp)!=h.total_connections) ret=-1;
+	fclose(fp);
+
+	if (ret!=0) {
+		for (i=0; i<F2M_CHECKPOINT_ARRAYS; i++) free(arrays[i]);
+		return ret;
+	}
+
+	ann->training_algorithm=(enum fann_train_enum) h.algorithm;
+	for (i=0; i<F2M_CHECKPOINT_ARRAYS; i++) {
+		a=f2M_checkpoint_array(ann, i);
+		if (*a!=NULL) free(*a);
+		*a=arrays[i];
+	}
+	*epoch=h.epoch;
+
+	return 0;
+}
+
+/* Writes the .net and the .state files of a checkpoint, replacing the previous ones
+ * Returns:
+ *  0 on success, -1 on error
+ */
+static int f2M_checkpoint_write(struct fann *ann, unsigned int epoch, char *path)
+{
+	char net[MAX_PATH], state[MAX_PATH], net_tmp[MAX_PATH], state_tmp[MAX_PATH];
+
+	_snprintf_s(net, MAX_PATH, _TRUNCATE, "%s", path);
+	_snprintf_s(state, MAX_PATH, _TRUNCATE, "%s.state", path);
+	_snprintf_s(net_tmp, MAX_PATH, _TRUNCATE, "%s.tmp", net);
+	_snprintf_s(state_tmp, MAX_PATH, _TRUNCATE, "%s.tmp", state);
+
+	if (fann_save(ann, net_tmp)!=0) return -1;
+	if (f2M_checkpoint_write_state(ann, epoch, state_tmp)!=0) return -1;
+
+	/* the .state file is replaced last, its weights are the ones restored */
+	if (!MoveFileExA(net_tmp, net, MOVEFILE_REPLACE_EXISTING)) return -1;
+	if (!MoveFileExA(state_tmp, state, MOVEFILE_REPLACE_EXISTING)) return -1;
+
+	return 0;
+}
+
+/* Writer thread of a checkpoint */
+DWORD WINAPI f2M_checkpoint_writer(LPVOID lpParam)
+{
+	checkpointData *c=(checkpointData*) lpParam;
+	int ret;
+
+	SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_BELOW_NORMAL);
+	ret=f2M_checkpoint_write(c->snapshot, c->snapshot_epoch, c->snapshot_path);
+
+	EnterCriticalSection(&c->cs);
+	if (ret==0) c->written=c->snapshot_epoch; else c->failures++;
+	fann_destroy(c->snapshot);
+	c->snapshot=NULL;
+	LeaveCriticalSection(&c->cs);
+
+	InterlockedExchange(&c->busy, 0);
+	return 0;
+}
+
+/* Waits for the writer of a checkpoint, the caller does not hold its lock
+ * and checkpointing is disabled, so that no other writer is started */
+static void f2M_checkpoint_wait(checkpointData *c)
+{
+	if (c->writer==NULL) return;
+	WaitForSingleObject(c->writer, INFINITE);
+	CloseHandle(c->writer);
+	c->writer=NULL;
+}
+
+/* Counts an epoch trained and takes a checkpoint when it is due
+ *  ann - network handler
+ *  f - fann structure trained, the network or its training copy
+ * Note:
+ *  Called by the trainers after every epoch, from the thread training.
+ */
+void f2M_checkpoint_epoch(int ann, struct fann *f)
+{
+	checkpointData *c;
+
+	if (ann<0 || ann>=ANNMAX || (c=_checkpoints[ann])==NULL) return;
+
+	EnterCriticalSection(&c->cs);
+	c->epoch++;
+	if (c->path[0]!='\0' && c->epoch-c->written>=(unsigned int) c->every && !c->busy) {
+		/* the previous writer has finished, its handle is closed here */
+		if (c->writer!=NULL) {
+			CloseHandle(c->writer);
+			c->writer=NULL;
+		}
+
+		/* fann_copy() copies the training arrays too */
+		c->snapshot=fann_copy(f);
+		if (c->snapshot==NULL) {
+			c->failures++;
+		} else {
+			c->snapshot_epoch=c->epoch;
+			strcpy_s(c->snapshot_path, MAX_PATH, c->path);
+			c->busy=1;
+			c->writer=CreateThread(NULL, 0, f2M_checkpoint_writer, c, 0, NULL);
+			if (c->writer==NULL) {
+				fann_destroy(c->snapshot);
+				c->snapshot=NULL;
+				c->busy=0;
+				c->failures++;
+			}
+		}
+	}
+	LeaveCriticalSection(&c->cs);
+}
+
+/* Frees the checkpoint data of a handler being destroyed, waiting for its writer */
+void f2M_checkpoint_release(int ann)
+{
+	checkpointData *c=_checkpoints[ann];
+
+	if (c==NULL) return;
+	_checkpoints[ann]=NULL;
+	f2M_checkpoint_wait(c);
+	DeleteCriticalSection(&c->cs);
+	f2M_free(c);
+}
+
+/* Enables checkpoints of a network, allocating its data if needed
+ *  epoch - epochs already trained
+ * Returns:
+ *  0 on success, -1 if out of memory
+ */
+static int f2M_checkpoint_start(int ann, char *path, int every, unsigned int epoch)
+{
+	checkpointData *c=_checkpoints[ann];
+
+	if (c==NULL) {
+		c=(checkpointData*) f2M_calloc(sizeof(checkpointData));
+		if (c==NULL) return -1;
+		InitializeCriticalSection(&c->cs);
+		_checkpoints[ann]=c;
+	}
+
+	/* no new writer is started, the path is not changed under the last one */
+	EnterCriticalSection(&c->cs);
+	c->path[0]='\0';
+	LeaveCriticalSection(&c->cs);
+	f2M_checkpoint_wait(c);
+
+	EnterCriticalSection(&c->cs);
+	strcpy_s(c->path, MAX_PATH, path);
+	c->every=every;
+	c->epoch=epoch;
+	c->written=epoch;
+	c->failures=0;
+	LeaveCriticalSection(&c->cs);
+
+	return 0;
+}
+
+/**
+ * Enables training checkpoints of a network
+ *  ann - network handler returned by f2M_create*
+ *  *path - .net file of the checkpoint, the training state is kept in path.state
+ *  every_epochs - number of epochs between checkpoints
+ * Returns:
+ *  0 on success, <0 on error
+ * Note:
+ *  f2M_train_on_file(), f2M_train_on_data() and f2M_train_async() take the
+ *  checkpoints while training, in the background. The epochs are counted from
+ *  now on; f2M_checkpoint_resume() restores the network and the count.
+ */
+FANN2MQL_API int __stdcall f2M_checkpoint_enable(int ann, char *path, int every_epochs)
+{
+	AnnPin pin;
+
+	/* this network is not allocated */
+	if (!pin.acquire(ann)) return f2M_error_handle(-1, ann, __FUNCTION__);
+
+	/* not accepting bogus arguments, room for ".state.tmp" */
+	if (path==NULL || path[0]=='\0' || strlen(path)+11>MAX_PATH || every_epochs<1)
+		return f2M_error(-2, ann, __FUNCTION__, "invalid arguments");
+
+	if (f2M_checkpoint_start(ann, path, every_epochs, 0)!=0) return f2M_error(-3, ann, __FUNCTION__, "out of memory");
+
+	return 0;
+}
+
+/**
+ * Disables training checkpoints of a network
+ *  ann - network handler returned by f2M_create*
+ * Returns:
+ *  0 on success, <0 on error
+ * Note:
+ *  Waits until a checkpoint being written is complete.
+ */
+FANN2MQL_API int __stdcall f2M_checkpoint_disable(int ann)
+{
+	checkpointData *c;
+
+	/* this network is not allocated */
+	if (ann<0 || ann>_ann) return f2M_error_handle(-1, ann, __FUNCTION__);
+
+	c=_checkpoints[ann];
+	if (c==NULL) return 0;
+
+	EnterCriticalSection(&c->cs);
+	c->path[0]='\0';
+	LeaveCriticalSection(&c->cs);
+	f2M_checkpoint_wait(c);
+
+	return 0;
+}
+
+/**
+ * Loads a network from a checkpoint together with its training state
+ *  *path - .net file of the checkpoint, as given to f2M_checkpoint_enable()
+ *  every_epochs - number of epochs between further checkpoints to the same
+ *    files, 0 to take none
+ * Returns:
+ *  handler to ann, <0 on error
+ * Note:
+ *  The weights, the RPROP step sizes, the previous slopes and steps and the
+ *  number of epochs trained are those of the checkpoint, so training goes on
+ *  as if it had not been interrupted. The network is loaded in this process
+ *  even if connected to a model server.
+ */
+FANN2MQL_API int __stdcall f2M_checkpoint_resume(char *path, int every_epochs)
+{
+	char state[MAX_PATH];
+	struct fann *f;
+	unsigned int epoch;
+	int ann, ret;
+
+	/* not accepting bogus arguments */
+	if (path==NULL || path[0]=='\0' || strlen(path)+11>MAX_PATH || every_epochs<0)
+		return f2M_error(-2, -1, __FUNCTION__, "invalid arguments");
+
+	f=fann_create_from_file(path);
+	if (f==NULL) return f2M_error_fann(-1, -1, NULL, __FUNCTION__);
+
+	_snprintf_s(state, MAX_PATH, _TRUNCATE, "%s.state", path);
+	ret=f2M_checkpoint_read_state(f, state, &epoch);
+	if (ret!=0) {
+		fann_destroy(f);
+		return f2M_error(-3, -1, __FUNCTION__, ret==-1 ? "training state can not be read" : "training state does not belong to the network");
+	}
+
+	ann=f2M_new_handle(f);
+	if (ann<0) return ann;
+
+	if (f2M_checkpoint_start(ann, every_epochs>0 ? path : (char*) "", every_epochs, epoch)!=0) {
+		f2M_destroy(ann);
+		return f2M_error(-4, -1, __FUNCTION__, "out of memory");
+	}
+
+	return ann;
+}
+
+/**
+ * Reports the training checkpoints of a network
+ *  ann - network handler returned by f2M_create*
+ *  *info - array of F2M_CHECKPOINT_INFO doubles receiving:
+ *    [0] number of epochs trained, counted since f2M_checkpoint_enable() or
+ *        restored by f2M_checkpoint_resume()
+ *    [1] epoch of the last checkpoint written
+ *    [2] number of checkpoints that could not be taken or written
+ * Returns:
+ *  0 on success, <0 on error
+ */
+FANN2MQL_API int __stdcall f2M_checkpoint_info(int ann, double *info)
+{
+	checkpointData *c;
+
+	/* this network is not allocated */
+	if (ann<0 || ann>_ann) return f2M_error_handle(-1, ann, __FUNCTION__);
+
+	if (info==NULL) return f2M_error(-2, ann, __FUNCTION__, "info is NULL");
+
+	c=_checkpoints[ann];
+	info[0]=0;
+	info[1]=0;
+	info[2]=0;
+	if (c!=NULL) {
+		EnterCriticalSection(&c->cs);
+		info[0]=c->epoch;
+		info[1]=c->written;
+		info[2]=c->failures;
+		LeaveCriticalSection(&c->cs);
+	}
+
+	return 0;
+}
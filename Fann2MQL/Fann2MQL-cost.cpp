@@ -0,0 +1,287 @@
+/* Fann2MQL-cost.cpp
+ *
+ * Copyright (C) 2008-2009 Mariusz Woloszyn
+ *
+ *  This file is part of Fann2MQL package
+ *
+ *  Fann2MQL is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Fann2MQL is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Fann2MQL; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include "stdafx.h"
+#include "Fann2MQL.h"
+#include "doublefann.h"
+#include "fann_internal.h"
+#include "windows.h"
+#include <stdlib.h>
+
+/* Work partitioning by cost.
+ * Splitting anns[] by count leaves one thread with the big networks of a mixed
+ * ensemble. Every network has a running estimate of the time it takes to run
+ * and to train: the number of connections until it is measured, then an
+ * exponentially weighted average of the measured times. The parallel
+ * functions split anns[] into one bin per thread with the longest processing
+ * time first rule: networks are taken from the most expensive and each goes to
+ * the least loaded bin. Within a bin networks keep their order in anns[], so
+ * neighbouring handlers stay together. Plans are cached by anns[] and rebuilt
+ * every F2M_PLAN_REUSE calls to follow the measurements.
+ */
+
+/* weight of a new measurement in the running average */
+#define F2M_COST_ALPHA	0.2
+/* assumed time per connection of networks not measured yet, in seconds */
+#define F2M_COST_CONNECTION	1e-9
+/* training a sample takes about this many runs */
+#define F2M_COST_TRAIN_FACTOR	3
+/* number of cached plans */
+#define F2M_PLANS	16
+/* number of calls a plan is reused for */
+#define F2M_PLAN_REUSE	64
+
+/* split of anns[] into bins */
+typedef struct cP {
+	int kind;
+	int bins;
+	int count;
+	unsigned int hash;
+	int uses;
+	int *anns;		/* the key */
+	int *order;		/* anns[] grouped by bins */
+	int first[F2M_MAX_THREADS+1];	/* bin b is order[first[b]..first[b+1]) */
+} costPlan;
+
+/* network with its cost, sorted by f2M_cost_pack() */
+typedef struct cI {
+	double cost;
+	int i;
+} costItem;
+
+/* measured times of networks in seconds, 0 if not measured */
+double _cost[F2M_COST_KINDS][ANNMAX];
+
+costPlan* _plans[F2M_PLANS];
+/* next plan replaced */
+int _plan_next=0;
+
+/* Critical section guarding the plan cache and the timer resolution */
+class CostLock {
+public:
+	CRITICAL_SECTION cs;
+	double tick;	/* seconds per tick */
+	CostLock() {
+		LARGE_INTEGER f;
+		InitializeCriticalSection(&cs);
+		QueryPerformanceFrequency(&f);
+		tick=1.0/(double) f.QuadPart;
+	}
+	~CostLock() {
+		int i;
+		for (i=0; i<F2M_PLANS; i++) {
+			if (_plans[i]==NULL) continue;
+			free(_plans[i]->anns);
+			free(_plans[i]);
+		}
+		DeleteCriticalSection(&cs);
+	}
+};
+
+CostLock _cost_lock;
+
+/* Returns the current time in ticks, for f2M_cost_update() */
+__int64 f2M_ticks()
+{
+	LARGE_INTEGER t;
+
+	QueryPerformanceCounter(&t);
+	return t.QuadPart;
+}
+
+/* Adds a measurement to the cost of a network
+ *  kind - F2M_COST_RUN or F2M_COST_TRAIN
+ *  ticks - time taken, difference of two f2M_ticks()
+ */
+void f2M_cost_update(int kind, int ann, __int64 ticks)
+{
+	double t=(double) ticks*_cost_lock.tick;
+	double c=_cost[kind][ann];
+
+	_cost[kind][ann]=(c>0 ? c+F2M_COST_ALPHA*(t-c) : t);
+}
+
+/* Forgets the costs of a handler being destroyed */
+void f2M_cost_release(int ann)
+{
+	int kind;
+
+	for (kind=0; kind<F2M_COST_KINDS; kind++)
+		_cost[kind][ann]=0;
+}
+
+/* Returns the estimated time of a network in seconds */
+static double f2M_cost(int kind, int ann)
+{
+	struct fann *f;
+	double c;
+	int phase;
+
+	if (_cost[kind][ann]>0) return _cost[kind][ann];
+
+	/* not measured yet, estimated from the connections */
+	f=f2M_read_lock(ann, &phase);
+	c=F2M_COST_CONNECTION*(f!=NULL ? f->total_connections : 1);
+	f2M_read_unlock(ann, phase);
+
+	return (kind==F2M_COST_TRAIN ? F2M_COST_TRAIN_FACTOR*c : c);
+}
+
+/* Compares costs for qsort(), most expensive first */
+static int f2M_cost_cmp(const void *a, const void *b)
+{
+	const costItem *x=(const costItem*) a, *y=(const costItem*) b;
+
+	if (x->cost!=y->cost) return (x->cost>y->cost ? -1 : 1);
+	return x->i-y->i;
+}
+
+/* Hashes the handlers of anns[] */
+static unsigned int f2M_cost_hash(int count, int *anns)
+{
+	unsigned int h=2166136261U;
+	int i;
+
+	for (i=0; i<count; i++)
+		h=(h^(unsigned int) anns[i])*16777619U;
+	return h;
+}
+
+/* Splits anns[] into bins, longest processing time first
+ * Returns:
+ *  0 on success, -1 on error
+ */
+static int f2M_cost_pack(int kind, int count, int *anns, int bins, int *order, int *first)
+{
+	costItem *items;
+	int *bin;
+	double load[F2M_MAX_THREADS];
+	int next[F2M_MAX_THREADS];
+	int b, best, i;
+
+	items=(costItem*) f2M_malloc(count*sizeof(costItem));
+	bin=(int*) f2M_malloc(count*sizeof(int));
+	if (items==NULL || bin==NULL) {
+		f2M_free(items);
+		f2M_free(bin);
+		return -1;
+	}
+
+	for (i=0; i<count; i++) {
+		items[i].cost=f2M_cost(kind, anns[i]);
+		items[i].i=i;
+	}
+	qsort(items, count, sizeof(costItem), f2M_cost_cmp);
+
+	/* each network to the least loaded bin */
+	for (b=0; b<bins; b++) load[b]=0;
+	for (i=0; i<count; i++) {
+		for (best=0, b=1; b<bins; b++)
+			if (load[b]<load[best]) best=b;
+		load[best]+=items[i].cost;
+		bin[items[i].i]=best;
+	}
+
+	/* group by bins, keeping the order of anns[] within a bin */
+	for (b=0; b<=bins; b++) first[b]=0;
+	for (i=0; i<count; i++) first[bin[i]+1]++;
+	for (b=0; b<bins; b++) first[b+1]+=first[b];
+	memcpy(next, first, bins*sizeof(int));
+	for (i=0; i<count; i++)
+		order[next[bin[i]]++]=anns[i];
+
+	f2M_free(items);
+	f2M_free(bin);
+	return 0;
+}
+
+/* Splits anns[] into bins of about equal cost, reusing a cached plan
+ *  kind - F2M_COST_RUN or F2M_COST_TRAIN
+ *  bins - maximum number of bins, 1..F2M_MAX_THREADS
+ *  *order - count handlers, anns[] grouped by bins
+ *  *first - bins+1 offsets, bin b is order[first[b]..first[b+1])
+ * Returns:
+ *  number of bins, not more than count, -1 on error
+ */
+int f2M_cost_plan(int kind, int count, int *anns, int bins, int *order, int *first)
+{
+	unsigned int hash=f2M_cost_hash(count, anns);
+	costPlan *p, *old=NULL;
+	int i, slot=-1;
+
+	if (bins<1) bins=1;
+	if (bins>F2M_MAX_THREADS) bins=F2M_MAX_THREADS;
+	if (bins>count) bins=(count>0 ? count : 1);
+
+	EnterCriticalSection(&_cost_lock.cs);
+	for (i=0; i<F2M_PLANS; i++) {
+		p=_plans[i];
+		if (p==NULL || p->kind!=kind || p->bins!=bins || p->count!=count || p->hash!=hash) continue;
+		if (memcmp(p->anns, anns, count*sizeof(int))!=0) continue;
+		if (p->uses>=F2M_PLAN_REUSE) {
+			/* stale, rebuilt below in the same slot */
+			slot=i;
+			break;
+		}
+		p->uses++;
+		memcpy(order, p->order, count*sizeof(int));
+		memcpy(first, p->first, (bins+1)*sizeof(int));
+		LeaveCriticalSection(&_cost_lock.cs);
+		return bins;
+	}
+	LeaveCriticalSection(&_cost_lock.cs);
+
+	if (f2M_cost_pack(kind, count, anns, bins, order, first)!=0) return -1;
+
+	/* keep the plan, both arrays in a single block */
+	p=(costPlan*) malloc(sizeof(costPlan));
+	if (p==NULL) return bins;
+	p->anns=(int*) malloc(2*count*sizeof(int));
+	if (p->anns==NULL) {
+		free(p);
+		return bins;
+	}
+	p->order=p->anns+count;
+	p->kind=kind;
+	p->bins=bins;
+	p->count=count;
+	p->hash=hash;
+	p->uses=1;
+	memcpy(p->anns, anns, count*sizeof(int));
+	memcpy(p->order, order, count*sizeof(int));
+	memcpy(p->first, first, (bins+1)*sizeof(int));
+
+	EnterCriticalSection(&_cost_lock.cs);
+	if (slot<0) {
+		slot=_plan_next;
+		_plan_next=(_plan_next+1)%F2M_PLANS;
+	}
+	old=_plans[slot];
+	_plans[slot]=p;
+	LeaveCriticalSection(&_cost_lock.cs);
+
+	if (old!=NULL) {
+		free(old->anns);
+		free(old);
+	}
+
+	return bins;
+}
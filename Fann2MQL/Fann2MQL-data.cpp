@@ -0,0 +1,726 @@
+/* Fann2MQL-data.cpp
+ *
+ * Copyright (C) 2008-2009 Mariusz Woloszyn
+ *
+ *  This file is part of Fann2MQL package
+ *
+ *  Fann2MQL is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Fann2MQL is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Fann2MQL; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include "stdafx.h"
+#include "Fann2MQL.h"
+#include "doublefann.h"
+#include "fann_internal.h"
+#include "windows.h"
+
+#include "tbb/blocked_range.h"
+#include "tbb/parallel_for.h"
+
+using namespace tbb;
+
+/* In memory datasets.
+ * A dataset is a fann_train_data structure whose row pointers point into
+ * blocks of inputs and outputs owned by the dataset, so FANN trains on it
+ * directly. Rows are never moved: shuffling permutes the row pointers, and
+ * slices (splits, walk-forward folds) are views sharing the row pointers of
+ * the dataset they view. Views are read-only, and a dataset having views can
+ * not be changed or destroyed until they are. Neither can a dataset used by
+ * a call in another thread, such as a training, see f2M_data_acquire().
+ */
+
+/* maximum number of datasets */
+#define F2M_DATASETS	1024
+/* number of rows processed by a single task */
+#define F2M_DATA_CHUNK	4096
+/* maximum number of buckets of the shuffle */
+#define F2M_SHUFFLE_BUCKETS	256
+
+typedef struct dS {
+	struct fann_train_data *data;	/* the rows as FANN sees them */
+	double *inputs;		/* capacity*num_input inputs, NULL for views */
+	double *outputs;	/* capacity*num_output outputs, NULL for views */
+	int capacity;		/* number of rows allocated */
+	int parent;			/* dataset viewed, -1 if the rows are owned */
+	int views;			/* number of views of this dataset */
+	int users;			/* number of calls reading the rows, -1 while they are changed */
+} dataSet;
+
+/* Critical section guarding _datasets[], the view and the user counts */
+class DataLock {
+public:
+	CRITICAL_SECTION cs;
+	DataLock() { InitializeCriticalSection(&cs); }
+	~DataLock() { DeleteCriticalSection(&cs); }
+};
+
+dataSet* _datasets[F2M_DATASETS];
+
+DataLock _data_lock;
+
+/* Returns a dataset, NULL if the handler is invalid. Must be called with the
+ * lock held or the dataset acquired, a dataset may be destroyed meanwhile.
+ */
+static dataSet* f2M_data_get(int data)
+{
+	if (data<0 || data>=F2M_DATASETS) return NULL;
+	return _datasets[data];
+}
+
+/* Returns the fann_train_data structure of a dataset and keeps its rows from
+ * being changed or freed until f2M_data_release()
+ * Returns:
+ *  NULL if the handler is invalid or the rows are being changed
+ */
+struct fann_train_data* f2M_data_acquire(int data)
+{
+	dataSet *ds;
+
+	EnterCriticalSection(&_data_lock.cs);
+	ds=f2M_data_get(data);
+	if (ds!=NULL && ds->users>=0) {
+		ds->users++;
+	} else {
+		ds=NULL;
+	}
+	LeaveCriticalSection(&_data_lock.cs);
+
+	return (ds!=NULL ? ds->data : NULL);
+}
+
+/* Releases a dataset acquired by f2M_data_acquire() */
+void f2M_data_release(int data)
+{
+	EnterCriticalSection(&_data_lock.cs);
+	_datasets[data]->users--;
+	LeaveCriticalSection(&_data_lock.cs);
+}
+
+/* Takes the rows of a dataset for a change, see f2M_data_acquire()
+ *  **ds - receives the dataset
+ * Returns:
+ *  0 on success, -1 if the handler is invalid, -3 if the dataset is used,
+ *  is a view or has views
+ */
+static int f2M_data_lock_rows(int data, dataSet **ds)
+{
+	int ret=-3;
+
+	EnterCriticalSection(&_data_lock.cs);
+	*ds=f2M_data_get(data);
+	if (*ds==NULL) {
+		ret=-1;
+	} else if ((*ds)->users==0 && (*ds)->parent<0 && (*ds)->views==0) {
+		(*ds)->users=-1;
+		ret=0;
+	}
+	LeaveCriticalSection(&_data_lock.cs);
+
+	return ret;
+}
+
+/* Ends a change started by f2M_data_lock_rows() */
+static void f2M_data_unlock_rows(dataSet *ds)
+{
+	EnterCriticalSection(&_data_lock.cs);
+	ds->users=0;
+	LeaveCriticalSection(&_data_lock.cs);
+}
+
+/* Frees a dataset, views do not free the rows */
+static void f2M_data_free(dataSet *ds)
+{
+	if (ds->data!=NULL) {
+		if (ds->parent<0) {
+			f2M_free(ds->data->input);
+			f2M_free(ds->data->output);
+		}
+		/* set by fann_error() */
+		free(ds->data->errstr);
+		f2M_free(ds->data);
+	}
+	f2M_free(ds->inputs);
+	f2M_free(ds->outputs);
+	f2M_free(ds);
+}
+
+/* Gives a dataset a handler
+ * Returns:
+ *  handler, <0 on error
+ */
+static int f2M_data_register(dataSet *ds, const char *function)
+{
+	int data;
+
+	EnterCriticalSection(&_data_lock.cs);
+	for (data=0; data<F2M_DATASETS && _datasets[data]!=NULL; data++);
+	/* no views of rows being changed */
+	if (ds->parent>=0 && _datasets[ds->parent]->users<0) data=F2M_DATASETS;
+	if (data<F2M_DATASETS) {
+		_datasets[data]=ds;
+		if (ds->parent>=0) _datasets[ds->parent]->views++;
+	}
+	LeaveCriticalSection(&_data_lock.cs);
+
+	if (data==F2M_DATASETS) {
+		f2M_data_free(ds);
+		return f2M_error(-1, -1, function, "too many datasets or the rows are being changed");
+	}
+	return data;
+}
+
+/* Allocates an empty dataset owning its rows
+ *  capacity - number of rows allocated
+ */
+static dataSet* f2M_data_alloc(int num_input, int num_output, int capacity)
+{
+	dataSet *ds=(dataSet*) f2M_calloc(sizeof(dataSet));
+
+	if (ds==NULL) return NULL;
+	ds->parent=-1;
+	ds->capacity=capacity;
+	ds->data=(struct fann_train_data*) f2M_calloc(sizeof(struct fann_train_data));
+	ds->inputs=(double*) f2M_malloc((size_t) capacity*num_input*sizeof(double));
+	ds->outputs=(double*) f2M_malloc((size_t) capacity*num_output*sizeof(double));
+	if (ds->data!=NULL) {
+		ds->data->num_input=num_input;
+		ds->data->num_output=num_output;
+		ds->data->input=(fann_type**) f2M_malloc(capacity*sizeof(fann_type*));
+		ds->data->output=(fann_type**) f2M_malloc(capacity*sizeof(fann_type*));
+	}
+	if (ds->data==NULL || ds->inputs==NULL || ds->outputs==NULL || ds->data->input==NULL || ds->data->output==NULL) {
+		f2M_data_free(ds);
+		return NULL;
+	}
+	return ds;
+}
+
+/* Creates a view of rows of a dataset acquired by the caller, see f2M_data_register() */
+static int f2M_data_view(int data, int first, int count, const char *function)
+{
+	dataSet *ds=f2M_data_get(data), *v;
+
+	v=(dataSet*) f2M_calloc(sizeof(dataSet));
+	if (v!=NULL) v->data=(struct fann_train_data*) f2M_calloc(sizeof(struct fann_train_data));
+	if (v==NULL || v->data==NULL) {
+		if (v!=NULL) f2M_free(v);
+		return f2M_error(-4, -1, function, "out of memory");
+	}
+	v->parent=data;
+	v->capacity=count;
+	v->data->num_data=count;
+	v->data->num_input=ds->data->num_input;
+	v->data->num_output=ds->data->num_output;
+	v->data->input=ds->data->input+first;
+	v->data->output=ds->data->output+first;
+
+	return f2M_data_register(v, function);
+}
+
+/* Copies rows into a dataset owning its rows, which has room for them */
+static void f2M_data_put(dataSet *ds, int num_data, double *inputs, double *outputs)
+{
+	struct fann_train_data *d=ds->data;
+	unsigned int i, num_input=d->num_input, num_output=d->num_output;
+
+	/* rows are never freed, so the slots in use are the first num_data ones */
+	memcpy(ds->inputs+(size_t) d->num_data*num_input, inputs, (size_t) num_data*num_input*sizeof(double));
+	memcpy(ds->outputs+(size_t) d->num_data*num_output, outputs, (size_t) num_data*num_output*sizeof(double));
+	for (i=d->num_data; i<d->num_data+num_data; i++) {
+		d->input[i]=ds->inputs+(size_t) i*num_input;
+		d->output[i]=ds->outputs+(size_t) i*num_output;
+	}
+	d->num_data+=num_data;
+}
+
+/* Intel TBB paralelized class used by f2M_data_gather() */
+class Apply_data_gather {
+	struct fann_train_data *data;
+	double *inputs;
+	double *outputs;
+public:
+	void operator()( const blocked_range<size_t>& r ) const {
+		unsigned int num_input=data->num_input, num_output=data->num_output;
+
+		for (size_t i=r.begin(); i!=r.end(); i++) {
+			if (inputs!=NULL) memcpy(inputs+i*num_input, data->input[i], num_input*sizeof(double));
+			if (outputs!=NULL) memcpy(outputs+i*num_output, data->output[i], num_output*sizeof(double));
+		}
+	}
+	Apply_data_gather(struct fann_train_data *d, double *in, double *out) :
+		data(d), inputs(in), outputs(out)
+	{}
+};
+
+/* Copies the rows of a dataset, in their order, into contiguous arrays
+ *  *data - dataset rows
+ *  *inputs - num_data*num_input array, or NULL
+ *  *outputs - num_data*num_output array, or NULL
+ * Returns:
+ *  0 on success, <0 on error
+ */
+int f2M_data_gather(struct fann_train_data *data, double *inputs, double *outputs)
+{
+	try {
+		parallel_for(blocked_range<size_t>(0, data->num_data, F2M_DATA_CHUNK),
+		             Apply_data_gather(data, inputs, outputs), auto_partitioner());
+	} catch (...) {
+		return -1;
+	}
+	return 0;
+}
+
+/* Copies rows into a new fann_train_data structure allocated by FANN
+ * Returns:
+ *  the copy, NULL on error
+ */
+struct fann_train_data* f2M_data_copy(struct fann_train_data *data)
+{
+	struct fann_train_data *copy=fann_create_train(data->num_data, data->num_input, data->num_output);
+
+	if (copy==NULL) return NULL;
+	if (f2M_data_gather(data, copy->input[0], copy->output[0])!=0) {
+		fann_destroy_train(copy);
+		return NULL;
+	}
+	return copy;
+}
+
+/**
+ * Creates a dataset from arrays
+ *  num_data - number of rows, may be 0
+ *  num_input, num_output - numbers of inputs and outputs of a row
+ *  *inputs - num_data*num_input array, row after row
+ *  *outputs - num_data*num_output array, row after row
+ * Returns:
+ *  handler to the dataset, <0 on error
+ */
+FANN2MQL_API int __stdcall f2M_data_create(int num_data, int num_input, int num_output, double *inputs, double *outputs)
+{
+	dataSet *ds;
+
+	/* not accepting bogus arguments */
+	if (num_data<0 || num_input<1 || num_output<1 || (num_data>0 && (inputs==NULL || outputs==NULL)))
+		return f2M_error(-2, -1, __FUNCTION__, "invalid arguments");
+
+	ds=f2M_data_alloc(num_input, num_output, num_data>0 ? num_data : 16);
+	if (ds==NULL) return f2M_error(-4, -1, __FUNCTION__, "out of memory");
+	f2M_data_put(ds, num_data, inputs, outputs);
+
+	return f2M_data_register(ds, __FUNCTION__);
+}
+
+/**
+ * Appends rows to a dataset
+ *  data - handler returned by f2M_data_create() or f2M_data_merge()
+ *  num_data - number of rows
+ *  *inputs - num_data*num_input array, row after row
+ *  *outputs - num_data*num_output array, row after row
+ * Returns:
+ *  number of rows of the dataset, <0 on error
+ * Note:
+ *  Not available for views, datasets having views and datasets in use.
+ */
+FANN2MQL_API int __stdcall f2M_data_append(int data, int num_data, double *inputs, double *outputs)
+{
+	dataSet *ds;
+	struct fann_train_data *d;
+	double *in, *out;
+	fann_type **in_rows, **out_rows;
+	unsigned int i;
+	int capacity, ret;
+
+	/* not accepting bogus arguments */
+	if (num_data<0 || (num_data>0 && (inputs==NULL || outputs==NULL))) return f2M_error(-2, -1, __FUNCTION__, "invalid arguments");
+
+	if ((ret=f2M_data_lock_rows(data, &ds))==-1) return f2M_error(-1, -1, __FUNCTION__, "invalid dataset handler");
+	if (ret!=0) return f2M_error(-3, -1, __FUNCTION__, "dataset is a view, has views or is in use");
+
+	/* grow geometrically, rebasing the row pointers */
+	d=ds->data;
+	if ((int) d->num_data+num_data>ds->capacity) {
+		capacity=2*ds->capacity>(int) d->num_data+num_data ? 2*ds->capacity : d->num_data+num_data;
+		in=(double*) f2M_malloc((size_t) capacity*d->num_input*sizeof(double));
+		out=(double*) f2M_malloc((size_t) capacity*d->num_output*sizeof(double));
+		in_rows=(fann_type**) f2M_malloc(capacity*sizeof(fann_type*));
+		out_rows=(fann_type**) f2M_malloc(capacity*sizeof(fann_type*));
+		if (in==NULL || out==NULL || in_rows==NULL || out_rows==NULL) {
+			f2M_free(in);
+			f2M_free(out);
+			f2M_free(in_rows);
+			f2M_free(out_rows);
+			f2M_data_unlock_rows(ds);
+			return f2M_error(-4, -1, __FUNCTION__, "out of memory");
+		}
+		memcpy(in, ds->inputs, (size_t) d->num_data*d->num_input*sizeof(double));
+		memcpy(out, ds->outputs, (size_t) d->num_data*d->num_output*sizeof(double));
+		for (i=0; i<d->num_data; i++) {
+			in_rows[i]=in+(d->input[i]-ds->inputs);
+			out_rows[i]=out+(d->output[i]-ds->outputs);
+		}
+		f2M_free(ds->inputs);
+		f2M_free(ds->outputs);
+		f2M_free(d->input);
+		f2M_free(d->output);
+		ds->inputs=in;
+		ds->outputs=out;
+		d->input=in_rows;
+		d->output=out_rows;
+		ds->capacity=capacity;
+	}
+	f2M_data_put(ds, num_data, inputs, outputs);
+	f2M_data_unlock_rows(ds);
+
+	return (int) d->num_data;
+}
+
+/**
+ * Returns the number of rows of a dataset
+ *  data - dataset handler
+ * Returns:
+ *  number of rows, <0 on error
+ */
+FANN2MQL_API int __stdcall f2M_data_length(int data)
+{
+	dataSet *ds;
+	int n=-1;
+
+	EnterCriticalSection(&_data_lock.cs);
+	ds=f2M_data_get(data);
+	if (ds!=NULL) n=(int) ds->data->num_data;
+	LeaveCriticalSection(&_data_lock.cs);
+
+	if (n<0) return f2M_error(-1, -1, __FUNCTION__, "invalid dataset handler");
+	return n;
+}
+
+/* Intel TBB paralelized classes used by f2M_data_shuffle().
+ * Every row goes to a random bucket, the buckets are laid out one after the
+ * other keeping the order of rows in a bucket, and each bucket is shuffled
+ * by Fisher-Yates. A uniform random permutation (Rao-Sandelius), and every
+ * random number comes from a counter-based stream, so the result depends only
+ * on the seed and not on the number of threads.
+ */
+class Apply_shuffle_count {
+	unsigned __int64 seed;
+	int num_data;
+	int buckets;
+	int *bucket_of;
+	int *counts;
+public:
+	void operator()( const blocked_range<size_t>& r ) const {
+		size_t chunk, i, end;
+		int b;
+
+		for (chunk=r.begin(); chunk!=r.end(); chunk++) {
+			end=(chunk+1)*F2M_DATA_CHUNK<(size_t) num_data ? (chunk+1)*F2M_DATA_CHUNK : num_data;
+			for (i=chunk*F2M_DATA_CHUNK; i<end; i++) {
+				b=(int) (f2M_random(seed, 0, i)*buckets);
+				bucket_of[i]=b;
+				counts[chunk*buckets+b]++;
+			}
+		}
+	}
+	Apply_shuffle_count(unsigned __int64 s, int nd, int nb, int *bo, int *c) :
+		seed(s), num_data(nd), buckets(nb), bucket_of(bo), counts(c)
+	{}
+};
+
+class Apply_shuffle_scatter {
+	struct fann_train_data *data;
+	int buckets;
+	int *bucket_of;
+	int *offsets;
+	fann_type **in_rows;
+	fann_type **out_rows;
+public:
+	void operator()( const blocked_range<size_t>& r ) const {
+		size_t chunk, i, end;
+		int pos;
+
+		for (chunk=r.begin(); chunk!=r.end(); chunk++) {
+			end=(chunk+1)*F2M_DATA_CHUNK<data->num_data ? (chunk+1)*F2M_DATA_CHUNK : data->num_data;
+			for (i=chunk*F2M_DATA_CHUNK; i<end; i++) {
+				pos=offsets[chunk*buckets+bucket_of[i]]++;
+				in_rows[pos]=data->input[i];
+				out_rows[pos]=data->output[i];
+			}
+		}
+	}
+	Apply_shuffle_scatter(struct fann_train_data *d, int nb, int *bo, int *o, fann_type **ir, fann_type **orw) :
+		data(d), buckets(nb), bucket_of(bo), offsets(o), in_rows(ir), out_rows(orw)
+	{}
+};
+
+class Apply_shuffle_buckets {
+	unsigned __int64 seed;
+	int *first;
+	fann_type **in_rows;
+	fann_type **out_rows;
+public:
+	void operator()( const blocked_range<size_t>& r ) const {
+		fann_type *tmp;
+		int i, j, n;
+
+		for (size_t b=r.begin(); b!=r.end(); b++) {
+			n=first[b+1]-first[b];
+			for (i=n-1; i>0; i--) {
+				j=first[b]+(int) (f2M_random(seed, b+1, i)*(i+1));
+				tmp=in_rows[first[b]+i]; in_rows[first[b]+i]=in_rows[j]; in_rows[j]=tmp;
+				tmp=out_rows[first[b]+i]; out_rows[first[b]+i]=out_rows[j]; out_rows[j]=tmp;
+			}
+		}
+	}
+	Apply_shuffle_buckets(unsigned __int64 s, int *f, fann_type **ir, fann_type **orw) :
+		seed(s), first(f), in_rows(ir), out_rows(orw)
+	{}
+};
+
+/**
+ * Shuffles the rows of a dataset in parallel using Intel TBB
+ *  data - handler returned by f2M_data_create() or f2M_data_merge()
+ *  seed - the same seed gives the same order
+ * Returns:
+ *  0 on success, <0 on error
+ * Note:
+ *  Not available for views, datasets having views and datasets in use.
+ */
+FANN2MQL_API int __stdcall f2M_data_shuffle(int data, int seed)
+{
+	dataSet *ds;
+	struct fann_train_data *d;
+	fann_type **in_rows, **out_rows;
+	int *bucket_of, *counts, *first;
+	int chunks, buckets, b, c, pos, ret=0;
+	unsigned __int64 s=(unsigned __int64) (unsigned int) seed;
+
+	if ((ret=f2M_data_lock_rows(data, &ds))==-1) return f2M_error(-1, -1, __FUNCTION__, "invalid dataset handler");
+	if (ret!=0) return f2M_error(-3, -1, __FUNCTION__, "dataset is a view, has views or is in use");
+
+	d=ds->data;
+	if (d->num_data<2) {
+		f2M_data_unlock_rows(ds);
+		return 0;
+	}
+
+	chunks=(d->num_data+F2M_DATA_CHUNK-1)/F2M_DATA_CHUNK;
+	buckets=chunks<F2M_SHUFFLE_BUCKETS ? chunks : F2M_SHUFFLE_BUCKETS;
+	bucket_of=(int*) f2M_malloc(d->num_data*sizeof(int));
+	counts=(int*) f2M_calloc(chunks*buckets*sizeof(int));
+	first=(int*) f2M_malloc((buckets+1)*sizeof(int));
+	in_rows=(fann_type**) f2M_malloc(ds->capacity*sizeof(fann_type*));
+	out_rows=(fann_type**) f2M_malloc(ds->capacity*sizeof(fann_type*));
+	if (bucket_of==NULL || counts==NULL || first==NULL || in_rows==NULL || out_rows==NULL) {
+		ret=f2M_error(-4, -1, __FUNCTION__, "out of memory");
+		goto cleanup;
+	}
+
+	try {
+		parallel_for(blocked_range<size_t>(0, chunks),
+		             Apply_shuffle_count(s, d->num_data, buckets, bucket_of, counts), auto_partitioner());
+
+		/* bucket after bucket, chunk after chunk within a bucket */
+		pos=0;
+		for (b=0; b<buckets; b++) {
+			first[b]=pos;
+			for (c=0; c<chunks; c++) {
+				pos+=counts[c*buckets+b];
+				counts[c*buckets+b]=pos-counts[c*buckets+b];
+			}
+		}
+		first[buckets]=pos;
+
+		parallel_for(blocked_range<size_t>(0, chunks),
+		             Apply_shuffle_scatter(d, buckets, bucket_of, counts, in_rows, out_rows), auto_partitioner());
+		parallel_for(blocked_range<size_t>(0, buckets, 1),
+		             Apply_shuffle_buckets(s, first, in_rows, out_rows), auto_partitioner());
+	} catch (...) {
+		ret=f2M_error(-5, -1, __FUNCTION__, "parallel execution failed");
+		goto cleanup;
+	}
+
+	/* the new order replaces the old one */
+	f2M_free(d->input);
+	f2M_free(d->output);
+	d->input=in_rows;
+	d->output=out_rows;
+	in_rows=NULL;
+	out_rows=NULL;
+
+cleanup:
+	f2M_free(bucket_of);
+	f2M_free(counts);
+	f2M_free(first);
+	f2M_free(in_rows);
+	f2M_free(out_rows);
+	f2M_data_unlock_rows(ds);
+
+	return ret;
+}
+
+/**
+ * Creates a view of consecutive rows of a dataset, without copying them
+ *  data - dataset handler
+ *  first - first row
+ *  count - number of rows
+ * Returns:
+ *  handler to the view, <0 on error
+ */
+FANN2MQL_API int __stdcall f2M_data_slice(int data, int first, int count)
+{
+	DataPin pin;
+	struct fann_train_data *d=pin.acquire(data);
+
+	if (d==NULL) return f2M_error(-1, -1, __FUNCTION__, "invalid dataset handler or the rows are being changed");
+	if (first<0 || count<1 || first+count>(int) d->num_data)
+		return f2M_error(-2, -1, __FUNCTION__, "rows out of range");
+
+	return f2M_data_view(data, first, count, __FUNCTION__);
+}
+
+/**
+ * Splits a dataset into training and validation views, without copying rows
+ *  data - dataset handler, usually shuffled before
+ *  train_fraction - part of the rows, from the start, in the training view
+ *  *train - receives the handler of the training view
+ *  *validation - receives the handler of the validation view
+ * Returns:
+ *  0 on success, <0 on error
+ */
+FANN2MQL_API int __stdcall f2M_data_split(int data, double train_fraction, int *train, int *validation)
+{
+	DataPin pin;
+	struct fann_train_data *d=pin.acquire(data);
+	int n, t;
+
+	if (d==NULL) return f2M_error(-1, -1, __FUNCTION__, "invalid dataset handler or the rows are being changed");
+	if (train==NULL || validation==NULL) return f2M_error(-2, -1, __FUNCTION__, "invalid arguments");
+
+	n=(int) d->num_data;
+	t=(int) (n*train_fraction+0.5);
+	if (t<1 || t>=n) return f2M_error(-2, -1, __FUNCTION__, "both parts must have rows");
+
+	*train=f2M_data_view(data, 0, t, __FUNCTION__);
+	if (*train<0) return *train;
+	*validation=f2M_data_view(data, t, n-t, __FUNCTION__);
+	if (*validation<0) {
+		f2M_data_destroy(*train);
+		return *validation;
+	}
+	return 0;
+}
+
+/**
+ * Creates the views of a walk-forward fold of a time-ordered dataset, without copying rows
+ *  data - dataset handler, rows oldest first
+ *  fold - number of the fold, 0 is the first
+ *  train_rows - number of rows trained on
+ *  test_rows - number of rows following them tested on
+ *  step - number of rows every fold moves forward by
+ *  *train - receives the handler of the rows [fold*step, fold*step+train_rows)
+ *  *test - receives the handler of the test_rows rows after them
+ * Returns:
+ *  0 on success, -6 if the fold is past the end of the data, other <0 on error
+ */
+FANN2MQL_API int __stdcall f2M_data_walk_forward(int data, int fold, int train_rows, int test_rows, int step,
+												 int *train, int *test)
+{
+	DataPin pin;
+	struct fann_train_data *d=pin.acquire(data);
+	__int64 first;
+
+	if (d==NULL) return f2M_error(-1, -1, __FUNCTION__, "invalid dataset handler or the rows are being changed");
+	if (train==NULL || test==NULL || fold<0 || train_rows<1 || test_rows<1 || step<1)
+		return f2M_error(-2, -1, __FUNCTION__, "invalid arguments");
+
+	first=(__int64) fold*step;
+	if (first+train_rows+test_rows>d->num_data)
+		return f2M_error(-6, -1, __FUNCTION__, "fold is past the end of the data");
+
+	*train=f2M_data_view(data, (int) first, train_rows, __FUNCTION__);
+	if (*train<0) return *train;
+	*test=f2M_data_view(data, (int) first+train_rows, test_rows, __FUNCTION__);
+	if (*test<0) {
+		f2M_data_destroy(*train);
+		return *test;
+	}
+	return 0;
+}
+
+/**
+ * Creates a dataset of the rows of two datasets
+ *  a, b - dataset handlers, with the same numbers of inputs and outputs
+ * Returns:
+ *  handler to a new dataset with the rows of a followed by the rows of b, <0 on error
+ */
+FANN2MQL_API int __stdcall f2M_data_merge(int a, int b)
+{
+	DataPin pin_a, pin_b;
+	struct fann_train_data *da=pin_a.acquire(a), *db=pin_b.acquire(b), *d;
+	dataSet *ds;
+	unsigned int num_input, num_output, i;
+
+	if (da==NULL || db==NULL) return f2M_error(-1, -1, __FUNCTION__, "invalid dataset handler");
+	num_input=da->num_input;
+	num_output=da->num_output;
+	if (db->num_input!=num_input || db->num_output!=num_output)
+		return f2M_error(-2, -1, __FUNCTION__, "datasets differ in the number of inputs or outputs");
+
+	ds=f2M_data_alloc(num_input, num_output, da->num_data+db->num_data);
+	if (ds==NULL) return f2M_error(-4, -1, __FUNCTION__, "out of memory");
+	d=ds->data;
+
+	if (f2M_data_gather(da, ds->inputs, ds->outputs)!=0 ||
+		f2M_data_gather(db, ds->inputs+(size_t) da->num_data*num_input,
+						ds->outputs+(size_t) da->num_data*num_output)!=0) {
+		f2M_data_free(ds);
+		return f2M_error(-5, -1, __FUNCTION__, "parallel execution failed");
+	}
+	d->num_data=da->num_data+db->num_data;
+	for (i=0; i<d->num_data; i++) {
+		d->input[i]=ds->inputs+(size_t) i*num_input;
+		d->output[i]=ds->outputs+(size_t) i*num_output;
+	}
+
+	return f2M_data_register(ds, __FUNCTION__);
+}
+
+/**
+ * Destroys a dataset or a view
+ *  data - dataset handler
+ * Returns:
+ *  0 on success, <0 on error
+ * Note:
+ *  A dataset having views can not be destroyed before its views, nor can a
+ *  dataset used by a call in another thread: -3 is returned, try again
+ *  after the views are destroyed or the call returned.
+ */
+FANN2MQL_API int __stdcall f2M_data_destroy(int data)
+{
+	dataSet *ds;
+
+	EnterCriticalSection(&_data_lock.cs);
+	ds=f2M_data_get(data);
+	if (ds==NULL || ds->views>0 || ds->users!=0) {
+		LeaveCriticalSection(&_data_lock.cs);
+		if (ds==NULL) return f2M_error(-1, -1, __FUNCTION__, "invalid dataset handler");
+		return f2M_error(-3, -1, __FUNCTION__, "dataset has views or is in use");
+	}
+	_datasets[data]=NULL;
+	if (ds->parent>=0) _datasets[ds->parent]->views--;
+	LeaveCriticalSection(&_data_lock.cs);
+
+	f2M_data_free(ds);
+	return 0;
+}
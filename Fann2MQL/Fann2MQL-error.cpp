@@ -0,0 +1,263 @@
+/* Fann2MQL-error.cpp
+ *
+ * Copyright (C) 2008-2009 Mariusz Woloszyn
+ *
+ *  This file is part of Fann2MQL package
+ *
+ *  Fann2MQL is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Fann2MQL is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Fann2MQL; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include "stdafx.h"
+#include "Fann2MQL.h"
+#include "doublefann.h"
+#include "fann_internal.h"
+#include "windows.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+/* Last error of each thread.
+ * Functions still return their negative codes, and record in addition what
+ * went wrong: the code returned, the function, the network handler, a message
+ * and the FANN error number if FANN failed. Every expert advisor runs in its
+ * own thread of the terminal, so it sees its own last error. The record is
+ * kept until the next error of the thread or f2M_clear_last_error().
+ * The records live in thread local storage allocated with TlsAlloc(), since
+ * __declspec(thread) does not work in a DLL loaded by LoadLibrary() on XP.
+ */
+
+/* length of the function name kept */
+#define F2M_ERROR_FUNCTION	64
+/* length of the message kept */
+#define F2M_ERROR_MESSAGE	256
+
+typedef struct eR {
+	int code;			/* value returned by the function */
+	int ann;			/* network handler, -1 if none */
+	int fann_errno;		/* FANN error number, 0 if FANN did not fail */
+	DWORD system_error;	/* GetLastError(), 0 if Windows did not fail */
+	char function[F2M_ERROR_FUNCTION];
+	char message[F2M_ERROR_MESSAGE];
+} errorRecord;
+
+/* Thread local storage slot of the records */
+class ErrorSlot {
+public:
+	DWORD tls;
+	ErrorSlot() { tls=TlsAlloc(); }
+	~ErrorSlot() { if (tls!=TLS_OUT_OF_INDEXES) TlsFree(tls); }
+};
+
+ErrorSlot _error_slot;
+
+/* Returns the record of the calling thread, NULL if it has none
+ *  create - allocate the record if missing
+ */
+static errorRecord* f2M_error_record(int create)
+{
+	errorRecord *e;
+
+	if (_error_slot.tls==TLS_OUT_OF_INDEXES) return NULL;
+
+	e=(errorRecord*) TlsGetValue(_error_slot.tls);
+	if (e==NULL && create) {
+		/* not from the pool, freed by a thread detaching from the DLL */
+		e=(errorRecord*) calloc(1, sizeof(errorRecord));
+		if (e!=NULL) TlsSetValue(_error_slot.tls, e);
+	}
+	return e;
+}
+
+/* Records an error of the calling thread
+ *  code - value returned by the failing function
+ *  ann - network handler, -1 if none
+ *  function - name of the failing function
+ *  message - what went wrong
+ * Returns:
+ *  code
+ */
+int f2M_error(int code, int ann, const char *function, const char *message)
+{
+	errorRecord *e=f2M_error_record(1);
+
+	/* nothing more can be done, the code is returned anyway */
+	if (e==NULL) return code;
+
+	e->code=code;
+	e->ann=ann;
+	e->fann_errno=0;
+	e->system_error=0;
+	strncpy_s(e->function, F2M_ERROR_FUNCTION, function, _TRUNCATE);
+	strncpy_s(e->message, F2M_ERROR_MESSAGE, message, _TRUNCATE);
+
+	return code;
+}
+
+/* Records an invalid network handler, see f2M_error() */
+int f2M_error_handle(int code, int ann, const char *function)
+{
+	char message[F2M_ERROR_MESSAGE];
+
+	if (ann<0 || ann>_ann)
+		_snprintf_s(message, F2M_ERROR_MESSAGE, _TRUNCATE, "invalid network handler %d", ann);
+	else if (f2M_registered(ann) && _fanns[ann]==NULL)
+		_snprintf_s(message, F2M_ERROR_MESSAGE, _TRUNCATE, "network %d could not be loaded from its file", ann);
+	else
+		_snprintf_s(message, F2M_ERROR_MESSAGE, _TRUNCATE, "network %d is not allocated", ann);
+
+	return f2M_error(code, ann, function, message);
+}
+
+/* Records an error reported by FANN and resets it, see f2M_error()
+ *  errdat - fann or fann_train_data structure that failed, NULL if FANN
+ *           could not even allocate it
+ */
+int f2M_error_fann(int code, int ann, struct fann_error *errdat, const char *function)
+{
+	errorRecord *e;
+
+	if (errdat==NULL || errdat->errno_f==FANN_E_NO_ERROR)
+		return f2M_error(code, ann, function, "FANN failed, see its error log");
+
+	/* fann_get_errstr() frees the string it returns, so it is read directly */
+	f2M_error(code, ann, function, errdat->errstr!=NULL ? errdat->errstr : "FANN failed");
+	e=f2M_error_record(0);
+	if (e!=NULL) e->fann_errno=(int) errdat->errno_f;
+
+	fann_reset_errno(errdat);
+	fann_reset_errstr(errdat);
+
+	return code;
+}
+
+/* Records a failed Windows call with GetLastError(), see f2M_error()
+ *  what - the call that failed
+ */
+int f2M_error_system(int code, const char *function, const char *what)
+{
+	DWORD dw=GetLastError();
+	char message[F2M_ERROR_MESSAGE];
+	char system[F2M_ERROR_MESSAGE];
+	errorRecord *e;
+
+	if (FormatMessageA(FORMAT_MESSAGE_FROM_SYSTEM | FORMAT_MESSAGE_IGNORE_INSERTS,
+			NULL, dw, MAKELANGID(LANG_NEUTRAL, SUBLANG_DEFAULT), system, F2M_ERROR_MESSAGE, NULL)==0)
+		system[0]=0;
+	_snprintf_s(message, F2M_ERROR_MESSAGE, _TRUNCATE, "%s failed with error %lu: %s", what, dw, system);
+
+	f2M_error(code, -1, function, message);
+	e=f2M_error_record(0);
+	if (e!=NULL) e->system_error=dw;
+
+	return code;
+}
+
+/* Frees the record of a thread detaching from the DLL, called by DllMain() */
+void f2M_error_thread_detach()
+{
+	errorRecord *e=f2M_error_record(0);
+
+	if (e==NULL) return;
+	TlsSetValue(_error_slot.tls, NULL);
+	free(e);
+}
+
+/* Copies a string into a caller's buffer
+ * Returns:
+ *  length of the string, -1 on error
+ */
+static int f2M_error_copy(const char *s, char *buf, int size)
+{
+	if (buf==NULL || size<1) return (-1);
+
+	strncpy_s(buf, size, s, _TRUNCATE);
+	return (int) strlen(s);
+}
+
+/**
+ * Returns the code of the last error of the calling thread
+ * Returns:
+ *  the negative value returned by the failing function, 0 if none
+ */
+FANN2MQL_API int __stdcall f2M_get_last_error()
+{
+	errorRecord *e=f2M_error_record(0);
+
+	return (e!=NULL ? e->code : 0);
+}
+
+/**
+ * Returns the network handler of the last error of the calling thread
+ * Returns:
+ *  network handler, -1 if none
+ */
+FANN2MQL_API int __stdcall f2M_get_last_error_ann()
+{
+	errorRecord *e=f2M_error_record(0);
+
+	return (e!=NULL && e->code!=0 ? e->ann : -1);
+}
+
+/**
+ * Returns the FANN error number of the last error of the calling thread
+ * Returns:
+ *  FANN error number (FANN_E_*), 0 if the error did not come from FANN
+ */
+FANN2MQL_API int __stdcall f2M_get_last_error_fann()
+{
+	errorRecord *e=f2M_error_record(0);
+
+	return (e!=NULL ? e->fann_errno : 0);
+}
+
+/**
+ * Returns the message of the last error of the calling thread
+ *  *buf - buffer for the message
+ *  size - size of the buffer, longer messages are truncated
+ * Returns:
+ *  length of the message, 0 if none, -1 on error
+ */
+FANN2MQL_API int __stdcall f2M_get_last_error_message(char *buf, int size)
+{
+	errorRecord *e=f2M_error_record(0);
+
+	return f2M_error_copy(e!=NULL ? e->message : "", buf, size);
+}
+
+/**
+ * Returns the name of the function of the last error of the calling thread
+ *  *buf - buffer for the name
+ *  size - size of the buffer, longer names are truncated
+ * Returns:
+ *  length of the name, 0 if none, -1 on error
+ */
+FANN2MQL_API int __stdcall f2M_get_last_error_function(char *buf, int size)
+{
+	errorRecord *e=f2M_error_record(0);
+
+	return f2M_error_copy(e!=NULL ? e->function : "", buf, size);
+}
+
+/**
+ * Clears the last error of the calling thread
+ * Returns:
+ *  0
+ */
+FANN2MQL_API int __stdcall f2M_clear_last_error()
+{
+	errorRecord *e=f2M_error_record(0);
+
+	if (e!=NULL) memset(e, 0, sizeof(errorRecord));
+	return 0;
+}
@@ -0,0 +1,353 @@
+/* Fann2MQL-fastmath.cpp
+ *
+ * Copyright (C) 2008-2009 Mariusz Woloszyn
+ *
+ *  This file is part of Fann2MQL package
+ *
+ *  Fann2MQL is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Fann2MQL is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Fann2MQL; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include "stdafx.h"
+#include "Fann2MQL.h"
+#include "doublefann.h"
+#include "fann_internal.h"
+#include "windows.h"
+#include <math.h>
+
+/* Fast math mode.
+ * exp(), sin() and cos() of the sigmoid, gaussian and sine activation functions
+ * (and cos() of the sine derivatives) are replaced by linearly interpolated
+ * lookup tables. The table step is chosen from the maximum error requested:
+ * the interpolation error is at most step^2*max|f''|/8. Tables are shared by
+ * all networks using the same maximum error and are attached to the fann
+ * structures through user_data, so fann_copy() carries them along.
+ * Only the forward passes of Fann2MQL use them: epochs trained by FANN itself
+ * (fann_train_epoch(), cascade training) keep the exact activations.
+ */
+
+/* number of distinct table sets kept */
+#define F2M_FAST_TABLES	16
+/* limits of the maximum error */
+#define F2M_FAST_MIN_ERROR	1e-9
+#define F2M_FAST_MAX_ERROR	0.1
+
+#define F2M_PI	3.14159265358979323846
+
+/* interpolated table of a function on [0, (size-1)*step] */
+typedef struct fLT {
+	double inv_step;
+	int size;
+	double *t;
+} fastTable;
+
+struct fT {
+	double max_error;
+	fastTable sig;	/* 1/(1+exp(-2x)) */
+	fastTable gau;	/* exp(-x*x) */
+	fastTable sin;	/* sin(x) on [0, 2*pi] */
+};
+
+fastTables* _fast_cache[F2M_FAST_TABLES];
+/* fast math tables of networks, kept for networks loaded again by the registry */
+fastTables* _fast[ANNMAX];
+
+/* Critical section guarding the table cache */
+class FastLock {
+public:
+	CRITICAL_SECTION cs;
+	FastLock() { InitializeCriticalSection(&cs); }
+	~FastLock() { DeleteCriticalSection(&cs); }
+};
+
+FastLock _fast_lock;
+
+/* Fills a table of a function
+ *  max_f2 - maximum of the absolute second derivative of the function
+ *  range - the table covers [0, range]
+ */
+static int f2M_fast_fill(fastTable *t, double (*fn)(double), double max_error, double max_f2, double range)
+{
+	double step=sqrt(8*max_error/max_f2);
+	int i;
+
+	t->size=(int) ceil(range/step)+2;
+	t->inv_step=1/step;
+	t->t=(double*) f2M_malloc(t->size*sizeof(double));
+	if (t->t==NULL) return -1;
+
+	for (i=0; i<t->size; i++) t->t[i]=fn(i*step);
+	return 0;
+}
+
+static double f2M_fast_sigmoid_fn(double x) { return 1.0/(1.0+exp(-2.0*x)); }
+static double f2M_fast_gaussian_fn(double x) { return exp(-x*x); }
+static double f2M_fast_sin_fn(double x) { return sin(x); }
+
+/* Returns the table set for a maximum error, creating it if needed */
+static fastTables* f2M_fast_tables(double max_error)
+{
+	fastTables *ft=NULL;
+	int i;
+
+	EnterCriticalSection(&_fast_lock.cs);
+	for (i=0; i<F2M_FAST_TABLES && _fast_cache[i]!=NULL; i++)
+		if (_fast_cache[i]->max_error==max_error) break;
+
+	if (i<F2M_FAST_TABLES && _fast_cache[i]!=NULL) {
+		ft=_fast_cache[i];
+	} else if (i<F2M_FAST_TABLES) {
+		ft=(fastTables*) f2M_calloc(sizeof(fastTables));
+		if (ft!=NULL) {
+			ft->max_error=max_error;
+			/* the symmetric variants double both the error and the second derivative;
+			   the tails beyond the ranges are below the maximum error */
+			if (f2M_fast_fill(&ft->sig, f2M_fast_sigmoid_fn, max_error, 0.77, 0.5*log(2/max_error))!=0 ||
+				f2M_fast_fill(&ft->gau, f2M_fast_gaussian_fn, max_error, 4.0, sqrt(log(2/max_error)))!=0 ||
+				f2M_fast_fill(&ft->sin, f2M_fast_sin_fn, max_error, 1.0, 2*F2M_PI)!=0) {
+				f2M_free(ft->sig.t);
+				f2M_free(ft->gau.t);
+				f2M_free(ft->sin.t);
+				f2M_free(ft);
+				ft=NULL;
+			} else {
+				_fast_cache[i]=ft;
+			}
+		}
+	}
+	LeaveCriticalSection(&_fast_lock.cs);
+
+	return ft;
+}
+
+/* Interpolates a table at x>=0, the last entry is used beyond the table */
+static __forceinline double f2M_fast_lookup(const fastTable *t, double x)
+{
+	double p=x*t->inv_step;
+	int i;
+
+	if (p>=t->size-1) return t->t[t->size-1];
+	i=(int) p;
+	return t->t[i]+(p-i)*(t->t[i+1]-t->t[i]);
+}
+
+static __forceinline double f2M_fast_sigmoid(const fastTables *ft, double x)
+{
+	double s=f2M_fast_lookup(&ft->sig, x<0 ? -x : x);
+	return (x<0 ? 1-s : s);
+}
+
+static __forceinline double f2M_fast_sin(const fastTables *ft, double x)
+{
+	x-=floor(x*(1/(2*F2M_PI)))*(2*F2M_PI);
+	return f2M_fast_lookup(&ft->sin, x);
+}
+
+static __forceinline double f2M_fast_cos(const fastTables *ft, double x)
+{
+	return f2M_fast_sin(ft, x+F2M_PI/2);
+}
+
+/* Computes an activation function, approximated if the function has a table
+ *  *ft - table set, must not be NULL
+ *  activation_function - FANN activation function
+ *  x - neuron sum multiplied by steepness
+ */
+double f2M_fast_activation(const fastTables *ft, unsigned int activation_function, double x)
+{
+	double result;
+
+	switch (activation_function) {
+	case FANN_SIGMOID:
+		return f2M_fast_sigmoid(ft, x);
+	case FANN_SIGMOID_SYMMETRIC:
+		return 2*f2M_fast_sigmoid(ft, x)-1;
+	case FANN_GAUSSIAN:
+		return f2M_fast_lookup(&ft->gau, x<0 ? -x : x);
+	case FANN_GAUSSIAN_SYMMETRIC:
+		return 2*f2M_fast_lookup(&ft->gau, x<0 ? -x : x)-1;
+	case FANN_SIN_SYMMETRIC:
+		return f2M_fast_sin(ft, x);
+	case FANN_COS_SYMMETRIC:
+		return f2M_fast_cos(ft, x);
+	case FANN_SIN:
+		return f2M_fast_sin(ft, x)/2+0.5;
+	case FANN_COS:
+		return f2M_fast_cos(ft, x)/2+0.5;
+	}
+
+	fann_activation_switch(activation_function, x, result);
+	return result;
+}
+
+/* Computes the derivative of an activation function like fann_activation_derived(),
+ * with the sine family approximated when the network is in fast math mode.
+ *  *ft - table set or NULL
+ */
+double f2M_fast_derived(const fastTables *ft, unsigned int activation_function,
+						double steepness, double value, double sum)
+{
+	if (ft!=NULL) {
+		switch (activation_function) {
+		case FANN_SIN_SYMMETRIC:
+			return steepness*f2M_fast_cos(ft, steepness*sum);
+		case FANN_COS_SYMMETRIC:
+			return -steepness*f2M_fast_sin(ft, steepness*sum);
+		case FANN_SIN:
+			return steepness*f2M_fast_cos(ft, steepness*sum)/2;
+		case FANN_COS:
+			return -steepness*f2M_fast_sin(ft, steepness*sum)/2;
+		}
+	}
+
+	return fann_activation_derived(activation_function, steepness, value, sum);
+}
+
+/* Runs a network like fann_run(), using the fast math tables if it has them.
+ * Neuron values and sums are stored in the network, so it can be trained then.
+ * Scaled networks take raw inputs and return descaled outputs.
+ *  ann - fann structure
+ *  *input - arrary of inputs
+ * Returns:
+ *  network outputs, like fann_run()
+ */
+double* f2M_forward(struct fann *ann, double *input)
+{
+	const fastTables *ft=(const fastTables*) ann->user_data;
+	struct fann_neuron *first, *neuron_it, *last_neuron;
+	struct fann_neuron **conns;
+	struct fann_layer *layer_it;
+	unsigned int i, c, num_connections;
+	double *w, neuron_sum, steepness, max_sum;
+	int scaled=f2M_scaled(ann);
+
+	if (ft==NULL && !scaled) return fann_run(ann, input);
+
+	/* input layer, scaled while loaded */
+	first=ann->first_layer->first_neuron;
+	if (scaled)
+		for (i=0; i<ann->num_input; i++) first[i].value=f2M_scale_input(ann, i, input[i]);
+	else
+		for (i=0; i<ann->num_input; i++) first[i].value=input[i];
+	/* bias of the input layer */
+	(ann->first_layer->last_neuron-1)->value=1;
+
+	for (layer_it=ann->first_layer+1; layer_it!=ann->last_layer; layer_it++) {
+		last_neuron=layer_it->last_neuron;
+		for (neuron_it=layer_it->first_neuron; neuron_it!=last_neuron; neuron_it++) {
+			/* bias neuron */
+			if (neuron_it->first_con==neuron_it->last_con) {
+				neuron_it->value=1;
+				continue;
+			}
+
+			num_connections=neuron_it->last_con-neuron_it->first_con;
+			w=ann->weights+neuron_it->first_con;
+			conns=ann->connections+neuron_it->first_con;
+
+			/* the remainder first and then groups of four, like fann_run() */
+			neuron_sum=0;
+			c=num_connections&3;
+			switch (c) {
+			case 3:
+				neuron_sum+=w[2]*conns[2]->value;
+			case 2:
+				neuron_sum+=w[1]*conns[1]->value;
+			case 1:
+				neuron_sum+=w[0]*conns[0]->value;
+			case 0:
+				break;
+			}
+			for (; c!=num_connections; c+=4)
+				neuron_sum+=w[c]*conns[c]->value+w[c+1]*conns[c+1]->value+
+					w[c+2]*conns[c+2]->value+w[c+3]*conns[c+3]->value;
+
+			steepness=neuron_it->activation_steepness;
+			neuron_sum=steepness*neuron_sum;
+			max_sum=150/steepness;
+			if (neuron_sum>max_sum)
+				neuron_sum=max_sum;
+			else if (neuron_sum<-max_sum)
+				neuron_sum=-max_sum;
+			neuron_it->sum=neuron_sum;
+			if (ft!=NULL)
+				neuron_it->value=f2M_fast_activation(ft, neuron_it->activation_function, neuron_sum);
+			else
+				fann_activation_switch(neuron_it->activation_function, neuron_sum, neuron_it->value);
+		}
+	}
+
+	/* output layer, descaled while read */
+	neuron_it=(ann->last_layer-1)->first_neuron;
+	if (scaled)
+		for (i=0; i<ann->num_output; i++) ann->output[i]=f2M_descale_output(ann, i, neuron_it[i].value);
+	else
+		for (i=0; i<ann->num_output; i++) ann->output[i]=neuron_it[i].value;
+
+	return ann->output;
+}
+
+/* Attaches the fast math tables of a handler to a newly loaded fann structure */
+void f2M_fast_math_attach(int ann, struct fann *f)
+{
+	f->user_data=_fast[ann];
+}
+
+/* Forgets the fast math mode of a handler being destroyed */
+void f2M_fast_math_release(int ann)
+{
+	_fast[ann]=NULL;
+}
+
+/**
+ * Switches the fast math mode of a network
+ *  ann - network handler returned by f2M_create*
+ *  max_error - maximum absolute error of the approximated activation functions,
+ *    1e-9..0.1; 0 turns the fast math mode off
+ * Returns:
+ *  0 on success, <0 on error
+ * Note:
+ *  Sigmoid, gaussian, sine and cosine activations are approximated by f2M_run(),
+ *  f2M_train(), f2M_train_fast(), the parallel functions and the batched kernels.
+ *  Stepwise, linear and Elliot activations are computed exactly. Training on
+ *  whole datasets (f2M_train_on_file(), f2M_train_on_data(), cascade training,
+ *  f2M_train_async(), online learning and f2M_sweep()) runs FANN's epochs and
+ *  is not approximated: the mode speeds up inference and single sample steps.
+ */
+FANN2MQL_API int __stdcall f2M_set_fast_math(int ann, double max_error)
+{
+	fastTables *ft=NULL;
+	AnnPin pin;
+
+	/* this network is not allocated */
+	if (!pin.acquire(ann)) return f2M_error_handle(-1, ann, __FUNCTION__);
+
+	/* not accepting bogus arguments */
+	if (max_error!=0 && (max_error<F2M_FAST_MIN_ERROR || max_error>F2M_FAST_MAX_ERROR))
+		return f2M_error(-2, ann, __FUNCTION__, "maximum error out of range");
+
+	if (max_error>0) {
+		ft=f2M_fast_tables(max_error);
+		if (ft==NULL) return f2M_error(-3, ann, __FUNCTION__, "out of memory or too many distinct maximum errors");
+	}
+
+	_fast[ann]=ft;
+	_fanns[ann]->user_data=ft;
+	if (_trainfanns[ann]!=NULL) _trainfanns[ann]->user_data=ft;
+	if (_sparefanns[ann]!=NULL) _sparefanns[ann]->user_data=ft;
+	/* the outputs change slightly */
+	f2M_weights_changed(ann);
+
+	return 0;
+}
@@ -0,0 +1,273 @@
+/* Fann2MQL-forecast.cpp
+ *
+ * Copyright (C) 2008-2009 Mariusz Woloszyn
+ *
+ *  This file is part of Fann2MQL package
+ *
+ *  Fann2MQL is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Fann2MQL is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Fann2MQL; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include "stdafx.h"
+#include "Fann2MQL.h"
+#include "doublefann.h"
+#include "fann_internal.h"
+#include "windows.h"
+
+#include "tbb/blocked_range.h"
+#include "tbb/parallel_for.h"
+
+using namespace tbb;
+
+/* Recursive multi-step forecasts.
+ * Every step runs the network on a window of inputs, then the window is
+ * shifted towards its start by the number of fed back outputs and the
+ * outputs are written to the inputs they are mapped to. Up to F2M_BATCH
+ * seed windows of a network are rolled out together as lanes of the batched
+ * kernel, whose scratch memory is reused by all the steps; blocks of seeds
+ * and networks are rolled out in parallel.
+ */
+
+/* Checks an output to input map
+ *  *map - num_output input indexes, -1 for outputs not fed back, or NULL
+ * Returns:
+ *  number of inputs the window is shifted by every step, -1 if the map is invalid
+ */
+static int f2M_forecast_shift(struct fann *ann, int *map)
+{
+	unsigned int o;
+	int shift=0;
+
+	/* the outputs are the newest inputs */
+	if (map==NULL) return (ann->num_output<=ann->num_input ? (int) ann->num_output : -1);
+
+	for (o=0; o<ann->num_output; o++) {
+		if (map[o]<-1 || map[o]>=(int) ann->num_input) return -1;
+		if (map[o]>=0) shift++;
+	}
+	return shift;
+}
+
+/* Rolls out a block of seed windows of a network
+ *  ann - fann structure
+ *  n - number of seed windows, 1..F2M_BATCH
+ *  *windows - n windows of num_input inputs, used as the rolling state
+ *  horizon - number of steps
+ *  *map - see f2M_forecast_shift()
+ *  shift - f2M_forecast_shift()
+ *  *paths - n paths of horizon rows of num_output outputs
+ *  *values - f2M_batch_scratch_size() doubles
+ *  *out - n*num_output doubles
+ */
+static void f2M_rollout(struct fann *ann, int n, double *windows, int horizon, int *map, int shift,
+						double *paths, double *values, double *out)
+{
+	int num_input=(int) ann->num_input, num_output=(int) ann->num_output;
+	double *w;
+	int step, b, o;
+
+	for (step=0; step<horizon; step++) {
+		f2M_run_batch(ann, NULL, n, windows, out, values, NULL);
+
+		for (b=0; b<n; b++) {
+			memcpy(paths+((size_t) b*horizon+step)*num_output, out+b*num_output, num_output*sizeof(double));
+
+			/* feed the outputs back */
+			w=windows+b*num_input;
+			memmove(w, w+shift, (num_input-shift)*sizeof(double));
+			for (o=0; o<num_output; o++) {
+				if (map==NULL)
+					w[num_input-num_output+o]=out[b*num_output+o];
+				else if (map[o]>=0)
+					w[map[o]]=out[b*num_output+o];
+			}
+		}
+	}
+}
+
+/* Intel TBB paralelized class used by f2M_forecast_parallel().
+ * Every task rolls out a block of up to F2M_BATCH seeds of a network.
+ */
+class Apply_forecast {
+	int *anns;
+	int num_seeds;
+	double *seeds;
+	int horizon;
+	int *map;
+	int shift;
+	double *paths;
+	volatile LONG *failed;
+public:
+	void operator()( const blocked_range<size_t>& r ) const {
+		int blocks=(num_seeds+F2M_BATCH-1)/F2M_BATCH;
+		struct fann *f;
+		double *values, *windows, *out;
+		int num_input, num_output, ann, first, n, phase;
+
+		for (size_t k=r.begin(); k!=r.end(); k++) {
+			ann=anns[k/blocks];
+			first=(int) (k%blocks)*F2M_BATCH;
+			n=num_seeds-first<F2M_BATCH ? num_seeds-first : F2M_BATCH;
+
+			f=f2M_read_lock(ann, &phase);
+			if (f==NULL) {
+				f2M_read_unlock(ann, phase);
+				InterlockedCompareExchange(failed, ann, -1);
+				continue;
+			}
+			num_input=(int) f->num_input;
+			num_output=(int) f->num_output;
+
+			values=(double*) f2M_malloc((f2M_batch_scratch_size(f)+F2M_BATCH*(num_input+num_output))*sizeof(double));
+			if (values==NULL) {
+				f2M_read_unlock(ann, phase);
+				InterlockedCompareExchange(failed, ann, -1);
+				continue;
+			}
+			windows=values+f2M_batch_scratch_size(f);
+			out=windows+F2M_BATCH*num_input;
+
+			memcpy(windows, seeds+(size_t) first*num_input, n*num_input*sizeof(double));
+			f2M_rollout(f, n, windows, horizon, map, shift,
+						paths+((k/blocks)*num_seeds+first)*(size_t) horizon*num_output, values, out);
+
+			f2M_read_unlock(ann, phase);
+			f2M_free(values);
+		}
+	}
+	Apply_forecast(int *a, int ns, double *s, int h, int *m, int sh, double *p, volatile LONG *fl) :
+		anns(a), num_seeds(ns), seeds(s), horizon(h), map(m), shift(sh), paths(p), failed(fl)
+	{}
+};
+
+/**
+ * Forecasts several steps ahead by feeding the outputs of a network back to its inputs
+ *  ann - network handler returned by f2M_create*
+ *  *seed_window - num_input inputs of the first step
+ *  horizon - number of steps
+ *  *output_to_input - num_output indexes of the inputs the outputs are fed
+ *    back to, -1 for outputs not fed back; before that, the inputs are shifted
+ *    towards index 0 by the number of outputs fed back. NULL feeds all the
+ *    outputs back as the newest num_output inputs.
+ *  *path - horizon*num_output array receiving the outputs of every step
+ * Returns:
+ *  0 on success, <0 on error
+ * Note:
+ *  Every step computes what f2M_run() would. The outputs of the network
+ *  (f2M_get_output()) are not changed.
+ */
+FANN2MQL_API int __stdcall f2M_forecast(int ann, double *seed_window, int horizon, int *output_to_input, double *path)
+{
+	struct fann *f;
+	double *values, *window, *out;
+	int phase, shift;
+	AnnPin pin;
+
+	/* this network is not allocated */
+	if (!pin.acquire(ann)) return f2M_error_handle(-1, ann, __FUNCTION__);
+
+	/* not accepting bogus arguments */
+	if (seed_window==NULL || path==NULL || horizon<1) return f2M_error(-2, ann, __FUNCTION__, "invalid arguments");
+
+	f2M_inference_enter();
+	f=f2M_read_lock(ann, &phase);
+	shift=(f!=NULL ? f2M_forecast_shift(f, output_to_input) : -1);
+	if (shift<0) {
+		f2M_read_unlock(ann, phase);
+		f2M_inference_leave();
+		return f2M_error(-3, ann, __FUNCTION__, "invalid output to input map");
+	}
+
+	values=(double*) f2M_malloc((f2M_batch_scratch_size(f)+f->num_input+f->num_output)*sizeof(double));
+	if (values==NULL) {
+		f2M_read_unlock(ann, phase);
+		f2M_inference_leave();
+		return f2M_error(-4, ann, __FUNCTION__, "out of memory");
+	}
+	window=values+f2M_batch_scratch_size(f);
+	out=window+f->num_input;
+
+	memcpy(window, seed_window, f->num_input*sizeof(double));
+	f2M_rollout(f, 1, window, horizon, output_to_input, shift, path, values, out);
+
+	f2M_read_unlock(ann, phase);
+	f2M_inference_leave();
+	f2M_free(values);
+
+	return 0;
+}
+
+/**
+ * Forecasts several steps ahead with many networks and seed windows in parallel using Intel TBB
+ *  anns_count - number of networks, all with the same numbers of inputs and outputs
+ *  anns[] - network handlers returned by f2M_create*
+ *  num_seeds - number of seed windows, rolled out by every network
+ *  *seed_windows - num_seeds*num_input inputs of the first steps
+ *  horizon - number of steps
+ *  *output_to_input - see f2M_forecast()
+ *  *paths - anns_count*num_seeds*horizon*num_output array receiving the
+ *    outputs, network after network, seed after seed, step after step
+ * Returns:
+ *  0 on success, <0 on error
+ */
+FANN2MQL_API int __stdcall f2M_forecast_parallel(int anns_count, int *anns, int num_seeds, double *seed_windows,
+												 int horizon, int *output_to_input, double *paths)
+{
+	struct fann *f;
+	int i, shift, blocks, ret=0;
+	unsigned int num_input, num_output;
+	volatile LONG failed=-1;
+
+	if (!_TBB_Initialized) return f2M_error(-1, -1, __FUNCTION__, "f2M_parallel_init() was not called");
+
+	/* not accepting bogus arguments */
+	if (anns==NULL || anns_count<1 || seed_windows==NULL || paths==NULL || num_seeds<1 || horizon<1)
+		return f2M_error(-2, -1, __FUNCTION__, "invalid arguments");
+
+	/* this network is not allocated, otherwise loaded and kept in memory */
+	if ((i=f2M_acquire_all(anns_count, anns))>=0) return f2M_error_handle(-12, anns[i], __FUNCTION__);
+
+	/* the seeds and the map must suit every network */
+	num_input=_fanns[anns[0]]->num_input;
+	num_output=_fanns[anns[0]]->num_output;
+	shift=f2M_forecast_shift(_fanns[anns[0]], output_to_input);
+	for (i=0; i<anns_count && shift>=0; i++) {
+		f=_fanns[anns[i]];
+		if (f->num_input!=num_input || f->num_output!=num_output) {
+			f2M_release_all(anns_count, anns);
+			return f2M_error(-4, anns[i], __FUNCTION__, "networks differ in the number of inputs or outputs");
+		}
+	}
+	if (shift<0) {
+		f2M_release_all(anns_count, anns);
+		return f2M_error(-3, -1, __FUNCTION__, "invalid output to input map");
+	}
+
+	/* a task per block of seeds of a network */
+	blocks=(num_seeds+F2M_BATCH-1)/F2M_BATCH;
+	f2M_inference_enter();
+	try {
+		parallel_for(blocked_range<size_t>(0, (size_t) anns_count*blocks, 1),
+		             Apply_forecast(anns, num_seeds, seed_windows, horizon, output_to_input, shift, paths, &failed),
+		             auto_partitioner());
+	} catch (...) {
+		ret=f2M_error(-5, -1, __FUNCTION__, "parallel execution failed");
+	}
+	f2M_inference_leave();
+	f2M_release_all(anns_count, anns);
+
+	if (ret==0 && failed>=0) ret=f2M_error(-10, (int) failed, __FUNCTION__, "network failed to run");
+
+	return ret;
+}
@@ -0,0 +1,241 @@
+/* Fann2MQL-fused.cpp
+ *
+ * Copyright (C) 2008-2009 Mariusz Woloszyn
+ *
+ *  This file is part of Fann2MQL package
+ *
+ *  Fann2MQL is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Fann2MQL is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Fann2MQL; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include "stdafx.h"
+#include "Fann2MQL.h"
+#include "doublefann.h"
+#include "fann_internal.h"
+#include "windows.h"
+#include <math.h>
+#include <emmintrin.h>
+
+/* Incremental training kernel for fully connected layered networks.
+ * fann_train() walks all connections three times after the forward pass
+ * (fann_compute_MSE, fann_backpropagate_MSE, fann_update_weights). Here the
+ * errors of a layer are propagated to the previous one and its weights are
+ * updated in the same sweep: both use the weights before the update, exactly
+ * like FANN, so the trained weights are bit-identical to fann_train().
+ * The sweep is blocked over the previous layer so its values and errors stay
+ * in the L1 cache while the weight rows are streamed, two weights at a time.
+ */
+
+/* number of previous layer neurons processed together */
+#define F2M_FUSED_BLOCK	512
+
+/* Returns nonzero if a network can be trained by the fused kernel */
+int f2M_fused_supported(struct fann *ann)
+{
+	return (ann->network_type==FANN_NETTYPE_LAYER && ann->connection_rate>=1);
+}
+
+/* Updates a part of a weight row and propagates the error of its neuron
+ *  *w, *d - weights and previous weight deltas
+ *  *val - values of connected neurons
+ *  *err - errors of connected neurons to accumulate to, NULL if not needed
+ *  n - number of connections
+ *  tmp_error - error of the neuron
+ *  lr_error - error of the neuron multiplied by the learning rate
+ *  momentum - learning momentum
+ */
+static void f2M_fused_row(double *w, double *d, double *val, double *err, unsigned int n,
+						  double tmp_error, double lr_error, double momentum)
+{
+	__m128d te=_mm_set1_pd(tmp_error), le=_mm_set1_pd(lr_error), mo=_mm_set1_pd(momentum);
+	__m128d wv, dv, ev;
+	double delta_w;
+	unsigned int i=0;
+
+	if (err!=NULL) {
+		for (; i+2<=n; i+=2) {
+			wv=_mm_loadu_pd(w+i);
+			ev=_mm_loadu_pd(err+i);
+			_mm_storeu_pd(err+i, _mm_add_pd(ev, _mm_mul_pd(te, wv)));
+			dv=_mm_add_pd(_mm_mul_pd(le, _mm_loadu_pd(val+i)), _mm_mul_pd(mo, _mm_loadu_pd(d+i)));
+			_mm_storeu_pd(w+i, _mm_add_pd(wv, dv));
+			_mm_storeu_pd(d+i, dv);
+		}
+		for (; i<n; i++) {
+			err[i]+=tmp_error*w[i];
+			delta_w=lr_error*val[i]+momentum*d[i];
+			w[i]+=delta_w;
+			d[i]=delta_w;
+		}
+	} else {
+		for (; i+2<=n; i+=2) {
+			dv=_mm_add_pd(_mm_mul_pd(le, _mm_loadu_pd(val+i)), _mm_mul_pd(mo, _mm_loadu_pd(d+i)));
+			_mm_storeu_pd(w+i, _mm_add_pd(_mm_loadu_pd(w+i), dv));
+			_mm_storeu_pd(d+i, dv);
+		}
+		for (; i<n; i++) {
+			delta_w=lr_error*val[i]+momentum*d[i];
+			w[i]+=delta_w;
+			d[i]=delta_w;
+		}
+	}
+}
+
+/* Computes output errors, backpropagates them and updates the weights.
+ * The network must have been run on the training input before.
+ *  ann - fann structure, f2M_fused_supported() must be true
+ *  *desired_output - arrary of desired outputs
+ */
+void f2M_backward_fused(struct fann *ann, double *desired_output)
+{
+	struct fann_neuron *first=ann->first_layer->first_neuron;
+	struct fann_neuron *neuron_it, *last_neuron, *prev_first;
+	struct fann_layer *layer_it;
+	const fastTables *ft=(const fastTables*) ann->user_data;
+	unsigned int i, num_prev, jb, je;
+	double *errors, *prev_err, *val, neuron_value, neuron_diff, tmp_error;
+	double learning_rate=ann->learning_rate, momentum=ann->learning_momentum;
+	int scaled=f2M_scaled(ann);
+
+	if (ann->train_errors==NULL) {
+		ann->train_errors=(fann_type*) calloc(ann->total_neurons, sizeof(fann_type));
+		if (ann->train_errors==NULL) {
+			fann_error((struct fann_error *) ann, FANN_E_CANT_ALLOCATE_MEM);
+			return;
+		}
+	}
+	/* allocated like fann_update_weights() does, the other training arrays are kept */
+	if (ann->prev_weights_deltas==NULL) {
+		ann->prev_weights_deltas=(fann_type*) calloc(ann->total_connections_allocated, sizeof(fann_type));
+		if (ann->prev_weights_deltas==NULL) {
+			fann_error((struct fann_error *) ann, FANN_E_CANT_ALLOCATE_MEM);
+			return;
+		}
+	}
+	errors=ann->train_errors;
+
+	/* output layer errors, see fann_compute_MSE() */
+	neuron_it=(ann->last_layer-1)->first_neuron;
+	for (i=0; i<ann->num_output; i++, neuron_it++) {
+		neuron_value=neuron_it->value;
+		/* desired outputs of scaled networks are scaled here */
+		neuron_diff=((scaled ? f2M_scale_output(ann, i, desired_output[i]) : desired_output[i])-neuron_value)*
+			f2M_mse_factor(neuron_it);
+		ann->MSE_value+=(float) (neuron_diff*neuron_diff);
+		if (fann_abs(neuron_diff)>=ann->bit_fail_limit) ann->num_bit_fail++;
+
+		if (ann->train_error_function) {
+			if (neuron_diff<-.9999999)
+				neuron_diff=-17.0;
+			else if (neuron_diff>.9999999)
+				neuron_diff=17.0;
+			else
+				neuron_diff=(fann_type) log((1.0+neuron_diff)/(1.0-neuron_diff));
+		}
+		errors[neuron_it-first]=f2M_fast_derived(ft, neuron_it->activation_function,
+			neuron_it->activation_steepness, neuron_value, neuron_it->sum)*neuron_diff;
+		ann->num_MSE++;
+	}
+
+	/* scratch for values of the previous layer, gathered from the neurons */
+	val=(double*) f2M_malloc((ann->total_neurons)*sizeof(double));
+	if (val==NULL) {
+		fann_error((struct fann_error *) ann, FANN_E_CANT_ALLOCATE_MEM);
+		return;
+	}
+
+	for (layer_it=ann->last_layer-1; layer_it!=ann->first_layer; layer_it--) {
+		prev_first=(layer_it-1)->first_neuron;
+		num_prev=(unsigned int) ((layer_it-1)->last_neuron-prev_first);
+		for (i=0; i<num_prev; i++) val[i]=prev_first[i].value;
+
+		/* no errors are propagated to the input layer */
+		prev_err=NULL;
+		if (layer_it-1!=ann->first_layer) {
+			prev_err=errors+(prev_first-first);
+			memset(prev_err, 0, num_prev*sizeof(double));
+		}
+
+		last_neuron=layer_it->last_neuron;
+		for (jb=0; jb<num_prev; jb=je) {
+			je=jb+F2M_FUSED_BLOCK<num_prev ? jb+F2M_FUSED_BLOCK : num_prev;
+			for (neuron_it=layer_it->first_neuron; neuron_it!=last_neuron; neuron_it++) {
+				/* bias neuron */
+				if (neuron_it->first_con==neuron_it->last_con) continue;
+
+				tmp_error=errors[neuron_it-first];
+				f2M_fused_row(ann->weights+neuron_it->first_con+jb, ann->prev_weights_deltas+neuron_it->first_con+jb,
+							  val+jb, prev_err!=NULL ? prev_err+jb : NULL, je-jb,
+							  tmp_error, tmp_error*learning_rate, momentum);
+			}
+		}
+
+		/* then calculate the actual errors in the previous layer */
+		if (prev_err!=NULL)
+			for (i=0; i<num_prev; i++)
+				prev_err[i]*=f2M_fast_derived(ft, prev_first[i].activation_function,
+					prev_first[i].activation_steepness, prev_first[i].value, prev_first[i].sum);
+	}
+
+	f2M_free(val);
+}
+
+/* Trains one iteration of a network, using the fused kernel when possible.
+ * Equivalent to fann_train(), but for the fast math mode.
+ *  ann - fann structure
+ *  *input_vector - arrary of inputs
+ *  *output_vector - arrary of desired outputs
+ */
+void f2M_train_step(struct fann *ann, double *input_vector, double *output_vector)
+{
+	if (!f2M_fused_supported(ann)) {
+		if (ann->user_data==NULL && !f2M_scaled(ann)) {
+			fann_train(ann, input_vector, output_vector);
+		} else {
+			f2M_forward(ann, input_vector);
+			f2M_backward(ann, output_vector);
+		}
+		return;
+	}
+
+	f2M_forward(ann, input_vector);
+	f2M_backward_fused(ann, output_vector);
+}
+
+/* Computes output errors, backpropagates them and updates the weights with
+ * FANN's own functions, for networks the fused kernel does not support.
+ * The network must have been run on the training input before.
+ *  ann - fann structure
+ *  *output_vector - arrary of desired outputs
+ */
+void f2M_backward(struct fann *ann, double *output_vector)
+{
+	double *desired=output_vector;
+
+	/* fann_compute_MSE() takes the desired outputs of scaled networks scaled */
+	if (f2M_scaled(ann)) {
+		desired=(double*) f2M_malloc(ann->num_output*sizeof(double));
+		if (desired==NULL) {
+			fann_error((struct fann_error *) ann, FANN_E_CANT_ALLOCATE_MEM);
+			return;
+		}
+		f2M_scale_outputs(ann, output_vector, desired);
+	}
+
+	fann_compute_MSE(ann, desired);
+	fann_backpropagate_MSE(ann);
+	fann_update_weights(ann);
+
+	if (desired!=output_vector) f2M_free(desired);
+}
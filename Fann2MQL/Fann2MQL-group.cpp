@@ -0,0 +1,475 @@
+/* Fann2MQL-group.cpp
+ *
+ * Copyright (C) 2008-2009 Mariusz Woloszyn
+ *
+ *  This file is part of Fann2MQL package
+ *
+ *  Fann2MQL is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Fann2MQL is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Fann2MQL; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include "stdafx.h"
+#include "Fann2MQL.h"
+#include "doublefann.h"
+#include "fann_internal.h"
+#include "windows.h"
+
+#include "tbb/blocked_range.h"
+#include "tbb/parallel_for.h"
+
+using namespace tbb;
+
+/* Stacked ensembles.
+ * A group of networks of the same topology is run as one network whose every
+ * value is a vector over the members. The weights of the members are packed
+ * member-minor in blocks of F2M_BATCH members (weights[connection*F2M_BATCH+member]),
+ * the layout f2M_run_batch() uses for samples, so each connection is applied
+ * to a whole block by one contiguous vector operation and the shared input
+ * vector is read once per block instead of once per network. Blocks run in
+ * parallel. The packed weights follow the members: a member whose weights
+ * generation changed since it was packed is packed again before the next run.
+ * The members are read locked during a run, so the fast math tables taken
+ * from them stay with the published structures. A group is freed by the last
+ * of f2M_group_destroy() and the runs using it.
+ */
+
+/* maximum number of groups */
+#define F2M_GROUPS	256
+
+typedef struct eG {
+	int count;			/* number of members */
+	int blocks;			/* number of blocks of F2M_BATCH members */
+	int *anns;			/* members */
+	LONG *generations;	/* weights generations of the packed members */
+	const fastTables **fts;	/* fast math tables of the read locked members */
+	int *phases;		/* read lock phases of the members during a run */
+	struct fann *shape;	/* copy of the first member, gives the topology */
+	double *weights;	/* blocks*shape->total_connections*F2M_BATCH packed weights */
+	CRITICAL_SECTION cs;	/* one run or repack at a time */
+	int users;			/* number of calls using the group */
+	int destroyed;		/* set by f2M_group_destroy(), freed by the last user */
+} ensembleGroup;
+
+/* Critical section guarding _groups[] and the user counts */
+class GroupLock {
+public:
+	CRITICAL_SECTION cs;
+	GroupLock() { InitializeCriticalSection(&cs); }
+	~GroupLock() { DeleteCriticalSection(&cs); }
+};
+
+ensembleGroup* _groups[F2M_GROUPS];
+
+GroupLock _group_lock;
+
+/* Returns nonzero if two networks have the same topology and activation functions */
+static int f2M_same_topology(struct fann *a, struct fann *b)
+{
+	struct fann_neuron *fa=a->first_layer->first_neuron, *fb=b->first_layer->first_neuron;
+	unsigned int i;
+
+	if (a->network_type!=b->network_type || a->total_neurons!=b->total_neurons ||
+		a->total_connections!=b->total_connections || a->num_input!=b->num_input ||
+		a->num_output!=b->num_output || a->last_layer-a->first_layer!=b->last_layer-b->first_layer)
+		return 0;
+
+	for (i=0; i<a->total_neurons; i++) {
+		if (fa[i].first_con!=fb[i].first_con || fa[i].last_con!=fb[i].last_con ||
+			fa[i].activation_function!=fb[i].activation_function ||
+			fa[i].activation_steepness!=fb[i].activation_steepness)
+			return 0;
+	}
+	for (i=0; i<a->total_connections; i++)
+		if (a->connections[i]-fa!=b->connections[i]-fb) return 0;
+
+	/* members are scaled with the parameters of the shape */
+	if (f2M_scaled(a)!=f2M_scaled(b)) return 0;
+	if (f2M_scaled(a)) {
+		for (i=0; i<a->num_input; i++)
+			if (f2M_scale_input(a, i, 0)!=f2M_scale_input(b, i, 0) || f2M_scale_input(a, i, 1)!=f2M_scale_input(b, i, 1))
+				return 0;
+		for (i=0; i<a->num_output; i++)
+			if (f2M_descale_output(a, i, 0)!=f2M_descale_output(b, i, 0) || f2M_descale_output(a, i, 1)!=f2M_descale_output(b, i, 1))
+				return 0;
+	}
+
+	return 1;
+}
+
+/* Packs the weights of a member
+ * Returns:
+ *  0 on success, <0 on error
+ */
+static int f2M_group_pack(ensembleGroup *g, int m)
+{
+	int ann=g->anns[m], phase;
+	unsigned int c, total=g->shape->total_connections;
+	double *w=g->weights+(m/F2M_BATCH)*total*F2M_BATCH+m%F2M_BATCH;
+	struct fann *f;
+	LONG generation;
+	AnnPin pin;
+
+	/* load it if registered and evicted */
+	if (!pin.acquire(ann)) return f2M_error_handle(-12, ann, "f2M_group_run");
+
+	/* read before the weights, a change while packing is packed next time */
+	generation=f2M_generation(ann);
+	f=f2M_read_lock(ann, &phase);
+	if (f==NULL || !f2M_same_topology(g->shape, f)) {
+		f2M_read_unlock(ann, phase);
+		return f2M_error(-13, ann, "f2M_group_run", "member does not have the topology of the group anymore");
+	}
+	for (c=0; c<total; c++)
+		w[c*F2M_BATCH]=f->weights[c];
+	f2M_read_unlock(ann, phase);
+
+	g->generations[m]=generation;
+	return 0;
+}
+
+/* Computes the outputs of a block of members for a single input vector.
+ * Like f2M_run_batch() with a vector of weights per connection; sums are
+ * accumulated in the order of fann_run(), so every member gets the same
+ * outputs it would get from f2M_run().
+ *  ann - network giving the topology
+ *  *weights - packed weights of the block
+ *  **fts - fast math tables of the members of the block, NULL for exact activations
+ *  n - number of members of the block, 1..F2M_BATCH
+ *  *values - f2M_batch_scratch_size() doubles receiving all neuron values
+ */
+static void f2M_run_stacked(struct fann *ann, const fastTables **fts, double *weights, int n, double *input, double *values)
+{
+	struct fann_neuron *first=ann->first_layer->first_neuron;
+	struct fann_neuron *neuron_it, *last_neuron;
+	struct fann_layer *layer_it;
+	struct fann_neuron **conns;
+	unsigned int i, c, num_connections, activation_function;
+	double *v, *s0, *s1, *s2, *s3, *w;
+	double steepness, max_sum, neuron_sum;
+	int b;
+
+	/* input layer, the same for every member, and its bias */
+	for (i=0; i<ann->num_input; i++) {
+		neuron_sum=f2M_scaled(ann) ? f2M_scale_input(ann, i, input[i]) : input[i];
+		for (b=0; b<n; b++)
+			values[i*F2M_BATCH+b]=neuron_sum;
+	}
+	v=values+(ann->first_layer->last_neuron-1-first)*F2M_BATCH;
+	for (b=0; b<n; b++) v[b]=1;
+
+	for (layer_it=ann->first_layer+1; layer_it!=ann->last_layer; layer_it++) {
+		last_neuron=layer_it->last_neuron;
+		for (neuron_it=layer_it->first_neuron; neuron_it!=last_neuron; neuron_it++) {
+			v=values+(neuron_it-first)*F2M_BATCH;
+
+			/* bias neuron */
+			if (neuron_it->first_con==neuron_it->last_con) {
+				for (b=0; b<n; b++) v[b]=1;
+				continue;
+			}
+
+			activation_function=neuron_it->activation_function;
+			steepness=neuron_it->activation_steepness;
+			num_connections=neuron_it->last_con-neuron_it->first_con;
+			w=weights+neuron_it->first_con*F2M_BATCH;
+			conns=ann->connections+neuron_it->first_con;
+
+			for (b=0; b<n; b++) v[b]=0;
+
+			/* the remainder first and then groups of four, like fann_run() */
+			c=num_connections&3;
+			switch (c) {
+			case 3:
+				s2=values+(conns[2]-first)*F2M_BATCH;
+				for (b=0; b<n; b++) v[b]+=w[2*F2M_BATCH+b]*s2[b];
+			case 2:
+				s1=values+(conns[1]-first)*F2M_BATCH;
+				for (b=0; b<n; b++) v[b]+=w[F2M_BATCH+b]*s1[b];
+			case 1:
+				s0=values+(conns[0]-first)*F2M_BATCH;
+				for (b=0; b<n; b++) v[b]+=w[b]*s0[b];
+			case 0:
+				break;
+			}
+			for (; c!=num_connections; c+=4) {
+				s0=values+(conns[c]-first)*F2M_BATCH;
+				s1=values+(conns[c+1]-first)*F2M_BATCH;
+				s2=values+(conns[c+2]-first)*F2M_BATCH;
+				s3=values+(conns[c+3]-first)*F2M_BATCH;
+				for (b=0; b<n; b++)
+					v[b]+=w[c*F2M_BATCH+b]*s0[b]+w[(c+1)*F2M_BATCH+b]*s1[b]+
+						  w[(c+2)*F2M_BATCH+b]*s2[b]+w[(c+3)*F2M_BATCH+b]*s3[b];
+			}
+
+			max_sum=150/steepness;
+			for (b=0; b<n; b++) {
+				neuron_sum=steepness*v[b];
+				if (neuron_sum>max_sum)
+					neuron_sum=max_sum;
+				else if (neuron_sum<-max_sum)
+					neuron_sum=-max_sum;
+				/* every member with its own activations */
+				if (fts[b]!=NULL)
+					v[b]=f2M_fast_activation(fts[b], activation_function, neuron_sum);
+				else
+					fann_activation_switch(activation_function, neuron_sum, v[b]);
+			}
+		}
+	}
+}
+
+/* Intel TBB paralelized class used by f2M_group_run() */
+class Apply_group_run {
+	ensembleGroup *g;
+	double *input_vector;
+	volatile LONG *failed;
+public:
+	void operator()( const blocked_range<size_t>& r ) const {
+		struct fann *ann=g->shape;
+		unsigned int num_output=ann->num_output, o;
+		double *values, *v;
+		size_t k;
+		int b, n, m;
+
+		values=(double*) f2M_malloc(f2M_batch_scratch_size(ann)*sizeof(double));
+		if (values==NULL) {
+			InterlockedExchange(failed, 1);
+			return;
+		}
+		v=values+((ann->last_layer-1)->first_neuron-ann->first_layer->first_neuron)*F2M_BATCH;
+
+		for (k=r.begin(); k!=r.end(); k++) {
+			n=(g->count-(int) k*F2M_BATCH<F2M_BATCH ? g->count-(int) k*F2M_BATCH : F2M_BATCH);
+			f2M_run_stacked(ann, g->fts+k*F2M_BATCH, g->weights+k*ann->total_connections*F2M_BATCH, n, input_vector, values);
+
+			/* outputs of the members, as f2M_run() leaves them */
+			for (b=0; b<n; b++) {
+				m=g->anns[k*F2M_BATCH+b];
+				for (o=0; o<num_output; o++)
+					_outbufs[m][o]=f2M_scaled(ann) ? f2M_descale_output(ann, o, v[o*F2M_BATCH+b]) : v[o*F2M_BATCH+b];
+				_outputs[m]=_outbufs[m];
+			}
+		}
+		f2M_free(values);
+	}
+	Apply_group_run(ensembleGroup *gr, double *iv, volatile LONG *fl) :
+		g(gr), input_vector(iv), failed(fl)
+	{}
+};
+
+/* Frees a group */
+static void f2M_group_free(ensembleGroup *g)
+{
+	if (g->shape!=NULL) fann_destroy(g->shape);
+	f2M_free(g->weights);
+	f2M_free(g->anns);
+	f2M_free(g->generations);
+	f2M_free((void*) g->fts);
+	f2M_free(g->phases);
+	DeleteCriticalSection(&g->cs);
+	f2M_free(g);
+}
+
+/* Returns a group and keeps it from being freed until f2M_group_release(),
+ * NULL if the handler is invalid
+ */
+static ensembleGroup* f2M_group_acquire(int group)
+{
+	ensembleGroup *g=NULL;
+
+	if (group<0 || group>=F2M_GROUPS) return NULL;
+
+	EnterCriticalSection(&_group_lock.cs);
+	g=_groups[group];
+	if (g!=NULL) g->users++;
+	LeaveCriticalSection(&_group_lock.cs);
+
+	return g;
+}
+
+/* Releases a group acquired by f2M_group_acquire(), freeing it if destroyed meanwhile */
+static void f2M_group_release(ensembleGroup *g)
+{
+	int last;
+
+	EnterCriticalSection(&_group_lock.cs);
+	last=(--g->users==0 && g->destroyed);
+	LeaveCriticalSection(&_group_lock.cs);
+
+	if (last) f2M_group_free(g);
+}
+
+/**
+ * Creates a group of networks of the same topology run together
+ *  count - number of networks
+ *  anns[] - network handlers returned by f2M_create*
+ * Returns:
+ *  handler to the group, <0 on error
+ * Note:
+ *  All the networks must have the same layers, connections and activation
+ *  functions. Networks can be trained, published and evicted as usual, the
+ *  group follows their weights. A network can belong to many groups.
+ */
+FANN2MQL_API int __stdcall f2M_group_create(int count, int *anns)
+{
+	ensembleGroup *g;
+	struct fann *f;
+	int i, group, phase;
+
+	/* not accepting bogus arguments */
+	if (anns==NULL || count<1) return f2M_error(-2, -1, __FUNCTION__, "no networks given");
+
+	/* this network is not allocated, otherwise loaded and kept in memory while packed */
+	if ((i=f2M_acquire_all(count, anns))>=0) return f2M_error_handle(-12, anns[i], __FUNCTION__);
+
+	g=(ensembleGroup*) f2M_calloc(sizeof(ensembleGroup));
+	if (g==NULL) {
+		f2M_release_all(count, anns);
+		return f2M_error(-4, -1, __FUNCTION__, "out of memory");
+	}
+	InitializeCriticalSection(&g->cs);
+	g->count=count;
+	g->blocks=(count+F2M_BATCH-1)/F2M_BATCH;
+
+	f=f2M_read_lock(anns[0], &phase);
+	g->shape=(f!=NULL ? fann_copy(f) : NULL);
+	f2M_read_unlock(anns[0], phase);
+
+	g->anns=(int*) f2M_malloc(count*sizeof(int));
+	g->generations=(LONG*) f2M_malloc(count*sizeof(LONG));
+	g->fts=(const fastTables**) f2M_calloc(count*sizeof(fastTables*));
+	g->phases=(int*) f2M_malloc(count*sizeof(int));
+	if (g->shape!=NULL)
+		g->weights=(double*) f2M_calloc(g->blocks*g->shape->total_connections*F2M_BATCH*sizeof(double));
+	if (g->shape==NULL || g->anns==NULL || g->generations==NULL || g->fts==NULL || g->phases==NULL ||
+		g->weights==NULL) {
+		f2M_group_free(g);
+		f2M_release_all(count, anns);
+		return f2M_error(-4, -1, __FUNCTION__, "out of memory");
+	}
+	memcpy(g->anns, anns, count*sizeof(int));
+
+	for (i=0; i<count; i++) {
+		if (f2M_group_pack(g, i)!=0) {
+			f2M_group_free(g);
+			f2M_release_all(count, anns);
+			return f2M_get_last_error();
+		}
+	}
+	f2M_release_all(count, anns);
+
+	/* the slot is claimed under the lock, calls in other threads create groups too */
+	EnterCriticalSection(&_group_lock.cs);
+	for (group=0; group<F2M_GROUPS && _groups[group]!=NULL; group++);
+	if (group<F2M_GROUPS) _groups[group]=g;
+	LeaveCriticalSection(&_group_lock.cs);
+
+	if (group==F2M_GROUPS) {
+		f2M_group_free(g);
+		return f2M_error(-1, -1, __FUNCTION__, "too many groups");
+	}
+	return group;
+}
+
+/**
+ * Runs all the networks of a group on the same input vector
+ *  group - handler returned by f2M_group_create()
+ *  *input_vector - arrary of inputs
+ * Returns:
+ *  0 on success, <0 on error
+ * Note:
+ *  To obtain the output of a network use f2M_get_output(). The outputs are
+ *  the same as from f2M_run() of every network.
+ */
+FANN2MQL_API int __stdcall f2M_group_run(int group, double *input_vector)
+{
+	ensembleGroup *g;
+	struct fann *f;
+	volatile LONG failed=0;
+	int i, ret=0;
+
+	/* the input vector is empty */
+	if (input_vector==NULL) return f2M_error(-30, -1, __FUNCTION__, "input vector is NULL");
+
+	g=f2M_group_acquire(group);
+	if (g==NULL) return f2M_error(-1, -1, __FUNCTION__, "invalid group handler");
+
+	EnterCriticalSection(&g->cs);
+
+	/* the members are loaded and kept in memory while their outputs are written */
+	if ((i=f2M_acquire_all(g->count, g->anns))>=0) {
+		ret=f2M_error_handle(-12, g->anns[i], __FUNCTION__);
+		LeaveCriticalSection(&g->cs);
+		f2M_group_release(g);
+		return ret;
+	}
+
+	/* follow the weights changed since the last run */
+	for (i=0; ret==0 && i<g->count; i++)
+		if (f2M_generation(g->anns[i])!=g->generations[i])
+			ret=f2M_group_pack(g, i);
+
+	if (ret==0) {
+		/* the tables of the members are used while the structures holding them are locked */
+		for (i=0; i<g->count; i++) {
+			f=f2M_read_lock(g->anns[i], &g->phases[i]);
+			g->fts[i]=(f!=NULL ? (const fastTables*) f->user_data : NULL);
+		}
+
+		f2M_inference_enter();
+		try {
+			parallel_for(blocked_range<size_t>(0,g->blocks,1),
+			             Apply_group_run(g, input_vector, &failed),simple_partitioner());
+		} catch (...) {
+			failed=1;
+		}
+		f2M_inference_leave();
+
+		for (i=0; i<g->count; i++) f2M_read_unlock(g->anns[i], g->phases[i]);
+		if (failed) ret=f2M_error(-5, -1, __FUNCTION__, "parallel execution failed");
+	}
+
+	f2M_release_all(g->count, g->anns);
+	LeaveCriticalSection(&g->cs);
+	f2M_group_release(g);
+	return ret;
+}
+
+/**
+ * Destroys a group, the networks are kept
+ *  group - handler returned by f2M_group_create()
+ * Returns:
+ *  0 on success, -1 on error
+ * Note:
+ *  A group being run by another thread is freed when the run returns.
+ */
+FANN2MQL_API int __stdcall f2M_group_destroy(int group)
+{
+	ensembleGroup *g=NULL;
+	int last=0;
+
+	EnterCriticalSection(&_group_lock.cs);
+	if (group>=0 && group<F2M_GROUPS && _groups[group]!=NULL) {
+		g=_groups[group];
+		_groups[group]=NULL;
+		g->destroyed=1;
+		last=(g->users==0);
+	}
+	LeaveCriticalSection(&_group_lock.cs);
+
+	if (g==NULL) return f2M_error(-1, -1, __FUNCTION__, "invalid group handler");
+	if (last) f2M_group_free(g);
+
+	return 0;
+}
@@ -0,0 +1,335 @@
+/* Fann2MQL-jobs.cpp
+ *
+ * Copyright (C) 2008-2009 Mariusz Woloszyn
+ *
+ *  This file is part of Fann2MQL package
+ *
+ *  Fann2MQL is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Fann2MQL is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Fann2MQL; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include "stdafx.h"
+#include "Fann2MQL.h"
+#include "doublefann.h"
+#include "fann_internal.h"
+#include "windows.h"
+
+/* Background training jobs.
+ * A job trains a private copy of a network on copies of its datasets in a
+ * thread of its own, at a lower priority and yielding to inference between
+ * epochs, so the calling expert advisor goes on trading. After every epoch
+ * it publishes its progress and checks for cancellation. With a validation
+ * dataset the weights of the best validation error are kept aside, training
+ * stops when it did not improve for a number of epochs, and the best weights
+ * are published. The network keeps serving its old weights until the job
+ * publishes; a cancelled or failed job publishes nothing.
+ */
+
+/* maximum number of jobs */
+#define F2M_JOBS	64
+
+typedef struct tJ {
+	int ann;
+	int pinned;				/* nonzero while the job keeps the network in memory */
+	struct fann *train;		/* private copy being trained */
+	struct fann *best;		/* weights of the best validation error, NULL without validation */
+	struct fann_train_data *data;		/* copy of the training rows */
+	struct fann_train_data *validation;	/* copy of the validation rows, or NULL */
+	unsigned int max_epoch;
+	float desired_error;
+	int patience;			/* epochs without improvement before stopping */
+	HANDLE thread;
+	volatile LONG cancel;
+	volatile LONG state;	/* F2M_JOB_* */
+	CRITICAL_SECTION cs;	/* guards progress */
+	double progress[F2M_JOB_PROGRESS];
+} trainJob;
+
+trainJob* _jobs[F2M_JOBS];
+
+/* Frees a job, its thread must have finished */
+static void f2M_job_free(trainJob *job)
+{
+	if (job->pinned) f2M_release(job->ann);
+	if (job->thread!=NULL) CloseHandle(job->thread);
+	if (job->train!=NULL) fann_destroy(job->train);
+	if (job->best!=NULL) fann_destroy(job->best);
+	if (job->data!=NULL) fann_destroy_train(job->data);
+	if (job->validation!=NULL) fann_destroy_train(job->validation);
+	DeleteCriticalSection(&job->cs);
+	f2M_free(job);
+}
+
+/* Stores the progress of a job */
+static void f2M_job_report(trainJob *job, unsigned int epoch, double mse, double validation_mse,
+						   unsigned int bit_fail, unsigned int best_epoch)
+{
+	EnterCriticalSection(&job->cs);
+	job->progress[0]=epoch;
+	job->progress[1]=mse;
+	job->progress[2]=validation_mse;
+	job->progress[3]=bit_fail;
+	job->progress[4]=best_epoch;
+	LeaveCriticalSection(&job->cs);
+}
+
+/* Worker thread of a job */
+DWORD WINAPI f2M_job_loop(LPVOID lpParam)
+{
+	trainJob *job=(trainJob*) lpParam;
+	struct fann *f=job->train, *result;
+	unsigned int epoch, bit_fail, best_epoch=0;
+	double mse, validation_mse=-1, best_mse=0;
+	LONG state=F2M_JOB_DONE;
+	int prio=f2M_training_begin();
+
+	fann_reset_errno((struct fann_error*) f);
+	for (epoch=1; epoch<=job->max_epoch; epoch++) {
+		if (job->cancel) {
+			state=F2M_JOB_CANCELLED;
+			break;
+		}
+
+		/* let the inference go first */
+		f2M_training_yield();
+		mse=fann_train_epoch(f, job->data);
+		if (fann_get_errno((struct fann_error*) f)!=FANN_E_NO_ERROR) {
+			state=F2M_JOB_FAILED;
+			break;
+		}
+		bit_fail=f->num_bit_fail;
+		f2M_checkpoint_epoch(job->ann, f);
+
+		if (job->validation!=NULL) {
+			validation_mse=fann_test_data(f, job->validation);
+			if (best_epoch==0 || validation_mse<best_mse) {
+				best_mse=validation_mse;
+				best_epoch=epoch;
+				f2M_copy_fann_state(job->best, f);
+			}
+		}
+		f2M_job_report(job, epoch, mse, validation_mse, bit_fail, best_epoch);
+
+		if ((f->train_stop_function==FANN_STOPFUNC_BIT ? (double) bit_fail : mse)<=job->desired_error) break;
+		if (job->validation!=NULL && (int) (epoch-best_epoch)>=job->patience) {
+			state=F2M_JOB_STOPPED;
+			break;
+		}
+	}
+	f2M_training_end(prio);
+
+	if (state==F2M_JOB_DONE || state==F2M_JOB_STOPPED) {
+		/* the best weights if validated, the last ones otherwise */
+		result=(job->best!=NULL ? job->best : job->train);
+		if (job->best!=NULL) job->best=NULL; else job->train=NULL;
+		f2M_fast_math_attach(job->ann, result);
+		f2M_registry_modified(job->ann);
+		fann_destroy(f2M_publish_fann(job->ann, result));
+	}
+
+	/* finished, failed or cancelled, the network may be evicted again */
+	f2M_release(job->ann);
+	job->pinned=0;
+
+	InterlockedExchange(&job->state, state);
+	return 0;
+}
+
+/* Returns a job, NULL if the handler is invalid */
+static trainJob* f2M_job_get(int job)
+{
+	if (job<0 || job>=F2M_JOBS) return NULL;
+	return _jobs[job];
+}
+
+/* Cancels the jobs of a handler being destroyed and waits for them */
+void f2M_jobs_release(int ann)
+{
+	int i;
+
+	for (i=0; i<F2M_JOBS; i++) {
+		if (_jobs[i]==NULL || _jobs[i]->ann!=ann || _jobs[i]->thread==NULL) continue;
+		InterlockedExchange(&_jobs[i]->cancel, 1);
+		WaitForSingleObject(_jobs[i]->thread, INFINITE);
+	}
+}
+
+/* Returns nonzero if a job trains a network */
+int f2M_job_running(int ann)
+{
+	int i;
+
+	for (i=0; i<F2M_JOBS; i++)
+		if (_jobs[i]!=NULL && _jobs[i]->ann==ann && _jobs[i]->state==F2M_JOB_RUNNING) return 1;
+	return 0;
+}
+
+/**
+ * Starts training a network in the background
+ *  ann - network handler returned by f2M_create*
+ *  data - dataset handler returned by f2M_data_*, the rows trained on
+ *  validation - dataset handler of the rows validated on, -1 for none
+ *  max_epoch - maximum number of epochs
+ *  desired_error - the desired training MSE or bit fail, depending on the stop function
+ *  patience - with validation, number of epochs without a better validation
+ *    error after which training stops
+ * Returns:
+ *  handler to the job, <0 on error
+ * Note:
+ *  The datasets are copied, they may be changed or destroyed meanwhile.
+ *  The network serves its old weights until the job is finished, then the
+ *  best validated or the last weights. Do not train the network otherwise
+ *  while the job is running. Release the job with f2M_job_release().
+ */
+FANN2MQL_API int __stdcall f2M_train_async(int ann, int data, int validation, unsigned int max_epoch, float desired_error, int patience)
+{
+	struct fann_train_data *d, *v=NULL;
+	trainJob *job;
+	int slot;
+	AnnPin pin;
+	DataPin data_pin, validation_pin;
+
+	/* this network is not allocated */
+	if (!pin.acquire(ann)) return f2M_error_handle(-1, ann, __FUNCTION__);
+
+	/* the job publishes the weights it trains */
+	if (_trainfanns[ann]!=NULL || f2M_online_enabled(ann) || f2M_job_running(ann))
+		return f2M_error(-3, ann, __FUNCTION__, "network is trained on a copy, learns online or by another job");
+
+	/* not accepting bogus arguments */
+	d=data_pin.acquire(data);
+	if (validation>=0) v=validation_pin.acquire(validation);
+	if (d==NULL || d->num_data<1 || (validation>=0 && (v==NULL || v->num_data<1)) || max_epoch<1 || patience<1)
+		return f2M_error(-2, ann, __FUNCTION__, "invalid arguments");
+	if (d->num_input!=_fanns[ann]->num_input || d->num_output!=_fanns[ann]->num_output ||
+		(v!=NULL && (v->num_input!=d->num_input || v->num_output!=d->num_output)))
+		return f2M_error(-2, ann, __FUNCTION__, "dataset does not fit the network");
+
+	job=(trainJob*) f2M_calloc(sizeof(trainJob));
+	if (job==NULL) return f2M_error(-5, ann, __FUNCTION__, "out of memory");
+	InitializeCriticalSection(&job->cs);
+	job->ann=ann;
+	job->max_epoch=max_epoch;
+	job->desired_error=desired_error;
+	job->patience=patience;
+	job->state=F2M_JOB_RUNNING;
+	job->progress[2]=-1;
+
+	job->train=fann_copy(_fanns[ann]);
+	if (v!=NULL) job->best=fann_copy(_fanns[ann]);
+	job->data=f2M_data_copy(d);
+	if (v!=NULL) job->validation=f2M_data_copy(v);
+	if (job->train==NULL || job->data==NULL || (v!=NULL && (job->best==NULL || job->validation==NULL))) {
+		f2M_job_free(job);
+		return f2M_error(-5, ann, __FUNCTION__, "out of memory");
+	}
+
+	/* FANN's epochs run the network unscaled */
+	if (f2M_scaled(job->train)) {
+		fann_scale_train(job->train, job->data);
+		if (job->validation!=NULL) fann_scale_train(job->train, job->validation);
+	}
+
+	/* kept in memory until the job ends, pinned under the registry lock */
+	job->pinned=f2M_acquire(ann);
+	if (!job->pinned) {
+		f2M_job_free(job);
+		return f2M_error_handle(-1, ann, __FUNCTION__);
+	}
+
+	/* claimed atomically, calls in other threads start jobs too */
+	for (slot=0; slot<F2M_JOBS; slot++)
+		if (InterlockedCompareExchangePointer((PVOID*) &_jobs[slot], job, NULL)==NULL) break;
+	if (slot==F2M_JOBS) {
+		f2M_job_free(job);
+		return f2M_error(-4, ann, __FUNCTION__, "too many jobs");
+	}
+
+	job->thread=CreateThread(NULL, 0, f2M_job_loop, job, 0, NULL);
+	if (job->thread==NULL) {
+		f2M_error_system(-6, __FUNCTION__, "CreateThread");
+		InterlockedExchangePointer((PVOID*) &_jobs[slot], NULL);
+		f2M_job_free(job);
+		return -6;
+	}
+
+	return slot;
+}
+
+/**
+ * Reports the progress of a training job
+ *  job - handler returned by f2M_train_async()
+ *  *progress - array of F2M_JOB_PROGRESS doubles receiving:
+ *    [0] number of epochs trained
+ *    [1] training MSE of the last epoch
+ *    [2] validation MSE of the last epoch, -1 without validation
+ *    [3] number of fail bits of the last epoch
+ *    [4] epoch of the best validation MSE, 0 without validation
+ * Returns:
+ *  state of the job: F2M_JOB_RUNNING, F2M_JOB_DONE, F2M_JOB_STOPPED (early),
+ *  F2M_JOB_CANCELLED or F2M_JOB_FAILED; other <0 on error
+ */
+FANN2MQL_API int __stdcall f2M_job_progress(int job, double *progress)
+{
+	trainJob *j=f2M_job_get(job);
+
+	if (j==NULL) return f2M_error(-10, -1, __FUNCTION__, "invalid job handler");
+
+	if (progress!=NULL) {
+		EnterCriticalSection(&j->cs);
+		memcpy(progress, j->progress, F2M_JOB_PROGRESS*sizeof(double));
+		LeaveCriticalSection(&j->cs);
+	}
+	return (int) j->state;
+}
+
+/**
+ * Cancels a training job, the network keeps its weights
+ *  job - handler returned by f2M_train_async()
+ * Returns:
+ *  0 on success, <0 on error
+ * Note:
+ *  The job stops after the epoch in progress, see f2M_job_progress().
+ */
+FANN2MQL_API int __stdcall f2M_job_cancel(int job)
+{
+	trainJob *j=f2M_job_get(job);
+
+	if (j==NULL) return f2M_error(-10, -1, __FUNCTION__, "invalid job handler");
+
+	InterlockedExchange(&j->cancel, 1);
+	return 0;
+}
+
+/**
+ * Releases a training job, cancelling it if still running
+ *  job - handler returned by f2M_train_async()
+ * Returns:
+ *  state of the job, see f2M_job_progress(); other <0 on error
+ */
+FANN2MQL_API int __stdcall f2M_job_release(int job)
+{
+	trainJob *j=f2M_job_get(job);
+	int state;
+
+	if (j==NULL) return f2M_error(-10, -1, __FUNCTION__, "invalid job handler");
+
+	InterlockedExchange(&j->cancel, 1);
+	WaitForSingleObject(j->thread, INFINITE);
+	state=(int) j->state;
+
+	_jobs[job]=NULL;
+	f2M_job_free(j);
+	return state;
+}
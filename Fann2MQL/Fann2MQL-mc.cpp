@@ -0,0 +1,273 @@
+/* Fann2MQL-mc.cpp
+ *
+ * Copyright (C) 2008-2009 Mariusz Woloszyn
+ *
+ *  This file is part of Fann2MQL package
+ *
+ *  Fann2MQL is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Fann2MQL is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Fann2MQL; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include "stdafx.h"
+#include "Fann2MQL.h"
+#include "doublefann.h"
+#include "fann_internal.h"
+#include "windows.h"
+#include <math.h>
+
+#include "tbb/blocked_range.h"
+#include "tbb/parallel_for.h"
+
+using namespace tbb;
+
+/* Monte Carlo uncertainty.
+ * The confidence of a prediction is estimated from the spread of the outputs
+ * of a network run on noisy copies of the input, optionally with noisy
+ * weights too. The noise is gaussian, drawn from counter-based streams of
+ * f2M_random(), so every draw is independent of the order it is computed
+ * in. Input noise only draws are evaluated F2M_BATCH at a time by the batched
+ * kernel; with weight noise every draw has weights of its own and is run
+ * alone. The mean and the standard deviation of the outputs are reduced
+ * natively, networks are processed in parallel by f2M_run_mc_parallel().
+ */
+
+/* number of calls, part of the counter of the noise streams */
+volatile LONG _mc_calls=0;
+
+/* Returns a standard normal number made of the numbers 2n and 2n+1 of a stream, Box-Muller */
+static double f2M_gauss(unsigned __int64 stream, unsigned __int64 n)
+{
+	double u1=1-f2M_random(f2M_base_seed(), stream, 2*n), u2=f2M_random(f2M_base_seed(), stream, 2*n+1);
+
+	return sqrt(-2*log(u1))*cos(6.283185307179586*u2);
+}
+
+/* Runs a network on noisy draws of an input and reduces the outputs
+ *  ann - fann structure
+ *  stream - noise stream of the call
+ *  *input - num_input inputs
+ *  n_draws - number of draws
+ *  *noise_spec - see f2M_run_mc()
+ *  *mean, *stddev - receive num_output means and standard deviations
+ * Returns:
+ *  0 on success, -1 if out of memory
+ */
+static int f2M_mc(struct fann *ann, unsigned __int64 stream, double *input, int n_draws, double *noise_spec,
+				  double *mean, double *stddev)
+{
+	unsigned int num_input=ann->num_input, num_output=ann->num_output, nc=ann->total_connections, i, o, c;
+	double weight_noise=noise_spec[num_input], *values, *x, *out, *w=NULL, diff;
+	unsigned __int64 n;
+	int first, b, k, lanes=(weight_noise>0 ? 1 : F2M_BATCH);
+
+	values=(double*) f2M_malloc((f2M_batch_scratch_size(ann)+F2M_BATCH*num_input+(size_t) n_draws*num_output)*sizeof(double));
+	if (weight_noise>0) w=(double*) f2M_malloc(nc*sizeof(double));
+	if (values==NULL || (weight_noise>0 && w==NULL)) {
+		f2M_free(values);
+		f2M_free(w);
+		return -1;
+	}
+	x=values+f2M_batch_scratch_size(ann);
+	out=x+F2M_BATCH*num_input;
+
+	for (first=0; first<n_draws; first+=k) {
+		k=n_draws-first<lanes ? n_draws-first : lanes;
+
+		/* draw d takes the numbers d*(num_input+total_connections)+j of the stream */
+		for (b=0; b<k; b++) {
+			n=(unsigned __int64) (first+b)*(num_input+nc);
+			for (i=0; i<num_input; i++)
+				x[b*num_input+i]=input[i]+(noise_spec[i]>0 ? noise_spec[i]*f2M_gauss(stream, n+i) : 0);
+		}
+		if (w!=NULL) {
+			n=(unsigned __int64) first*(num_input+nc)+num_input;
+			for (c=0; c<nc; c++) w[c]=ann->weights[c]+weight_noise*f2M_gauss(stream, n+c);
+		}
+
+		f2M_run_batch(ann, w, k, x, out+(size_t) first*num_output, values, NULL);
+	}
+
+	/* two passes, sums of squares lose the spread when it is small compared to the mean */
+	for (o=0; o<num_output; o++) {
+		mean[o]=0;
+		for (b=0; b<n_draws; b++) mean[o]+=out[(size_t) b*num_output+o];
+		mean[o]/=n_draws;
+
+		stddev[o]=0;
+		for (b=0; b<n_draws; b++) {
+			diff=out[(size_t) b*num_output+o]-mean[o];
+			stddev[o]+=diff*diff;
+		}
+		stddev[o]=(n_draws>1 ? sqrt(stddev[o]/(n_draws-1)) : 0);
+	}
+
+	f2M_free(values);
+	f2M_free(w);
+	return 0;
+}
+
+/* Returns nonzero if a noise specification is valid for a network */
+static int f2M_mc_spec_valid(struct fann *ann, double *noise_spec)
+{
+	unsigned int i;
+
+	for (i=0; i<=ann->num_input; i++)
+		if (!(noise_spec[i]>=0)) return 0;
+	return 1;
+}
+
+/* Returns the noise stream of a call for a network */
+static unsigned __int64 f2M_mc_stream(int ann, LONG call)
+{
+	return ((unsigned __int64) (unsigned int) call<<32)|(unsigned int) ann;
+}
+
+/**
+ * Estimates the outputs of a network and their uncertainty by running it on noisy inputs
+ *  ann - network handler returned by f2M_create*
+ *  *input - num_input inputs
+ *  n_draws - number of noisy draws
+ *  *noise_spec - num_input+1 doubles: the standard deviations of the
+ *    gaussian noise added to every input, in the units of the raw inputs,
+ *    then the standard deviation of the noise added to every weight, 0 for none
+ *  *mean - num_output array receiving the mean outputs of the draws
+ *  *stddev - num_output array receiving the standard deviations of the outputs
+ * Returns:
+ *  0 on success, <0 on error
+ * Note:
+ *  The noise differs from call to call; in the deterministic mode the n-th
+ *  call draws the same noise in every session. The outputs of the network
+ *  (f2M_get_output()) are not changed. Weight noise makes every draw a run
+ *  of its own, input noise only draws are run in blocks.
+ */
+FANN2MQL_API int __stdcall f2M_run_mc(int ann, double *input, int n_draws, double *noise_spec, double *mean, double *stddev)
+{
+	struct fann *f;
+	int phase, ret;
+	AnnPin pin;
+
+	/* this network is not allocated */
+	if (!pin.acquire(ann)) return f2M_error_handle(-1, ann, __FUNCTION__);
+
+	/* not accepting bogus arguments */
+	if (input==NULL || noise_spec==NULL || mean==NULL || stddev==NULL || n_draws<1)
+		return f2M_error(-2, ann, __FUNCTION__, "invalid arguments");
+
+	f2M_inference_enter();
+	f=f2M_read_lock(ann, &phase);
+	if (f==NULL || !f2M_mc_spec_valid(f, noise_spec)) {
+		f2M_read_unlock(ann, phase);
+		f2M_inference_leave();
+		return f2M_error(-3, ann, __FUNCTION__, "invalid noise specification");
+	}
+
+	ret=f2M_mc(f, f2M_mc_stream(ann, InterlockedIncrement(&_mc_calls)), input, n_draws, noise_spec, mean, stddev);
+
+	f2M_read_unlock(ann, phase);
+	f2M_inference_leave();
+
+	if (ret!=0) return f2M_error(-4, ann, __FUNCTION__, "out of memory");
+	return 0;
+}
+
+/* Intel TBB paralelized class used by f2M_run_mc_parallel(), a task per network */
+class Apply_mc {
+	int *anns;
+	LONG call;
+	double *input;
+	int n_draws;
+	double *noise_spec;
+	double *mean;
+	double *stddev;
+	volatile LONG *failed;
+public:
+	void operator()( const blocked_range<size_t>& r ) const {
+		struct fann *f;
+		int phase, num_output;
+
+		for (size_t k=r.begin(); k!=r.end(); k++) {
+			f=f2M_read_lock(anns[k], &phase);
+			if (f==NULL) {
+				f2M_read_unlock(anns[k], phase);
+				InterlockedCompareExchange(failed, anns[k], -1);
+				continue;
+			}
+			num_output=(int) f->num_output;
+			if (f2M_mc(f, f2M_mc_stream(anns[k], call), input, n_draws, noise_spec,
+					   mean+k*num_output, stddev+k*num_output)!=0)
+				InterlockedCompareExchange(failed, anns[k], -1);
+			f2M_read_unlock(anns[k], phase);
+		}
+	}
+	Apply_mc(int *a, LONG c, double *iv, int nd, double *ns, double *m, double *s, volatile LONG *fl) :
+		anns(a), call(c), input(iv), n_draws(nd), noise_spec(ns), mean(m), stddev(s), failed(fl)
+	{}
+};
+
+/**
+ * Estimates the outputs and their uncertainty of many networks in parallel using Intel TBB, see f2M_run_mc()
+ *  anns_count - number of networks, all with the same numbers of inputs and outputs
+ *  anns[] - network handlers returned by f2M_create*
+ *  *input - num_input inputs, the same for every network
+ *  n_draws - number of noisy draws of every network
+ *  *noise_spec - see f2M_run_mc()
+ *  *mean - anns_count*num_output array receiving the mean outputs, network after network
+ *  *stddev - anns_count*num_output array receiving the standard deviations
+ * Returns:
+ *  0 on success, <0 on error
+ */
+FANN2MQL_API int __stdcall f2M_run_mc_parallel(int anns_count, int *anns, double *input, int n_draws, double *noise_spec,
+											   double *mean, double *stddev)
+{
+	struct fann *f;
+	int i, ret=0;
+	volatile LONG failed=-1;
+
+	if (!_TBB_Initialized) return f2M_error(-1, -1, __FUNCTION__, "f2M_parallel_init() was not called");
+
+	/* not accepting bogus arguments */
+	if (anns==NULL || anns_count<1 || input==NULL || noise_spec==NULL || mean==NULL || stddev==NULL || n_draws<1)
+		return f2M_error(-2, -1, __FUNCTION__, "invalid arguments");
+
+	/* this network is not allocated, otherwise loaded and kept in memory */
+	if ((i=f2M_acquire_all(anns_count, anns))>=0) return f2M_error_handle(-12, anns[i], __FUNCTION__);
+
+	/* the input and the noise must suit every network */
+	for (i=0; i<anns_count; i++) {
+		f=_fanns[anns[i]];
+		if (f->num_input!=_fanns[anns[0]]->num_input || f->num_output!=_fanns[anns[0]]->num_output) {
+			f2M_release_all(anns_count, anns);
+			return f2M_error(-4, anns[i], __FUNCTION__, "networks differ in the number of inputs or outputs");
+		}
+	}
+	if (!f2M_mc_spec_valid(_fanns[anns[0]], noise_spec)) {
+		f2M_release_all(anns_count, anns);
+		return f2M_error(-3, -1, __FUNCTION__, "invalid noise specification");
+	}
+
+	f2M_inference_enter();
+	try {
+		parallel_for(blocked_range<size_t>(0, anns_count, 1),
+		             Apply_mc(anns, InterlockedIncrement(&_mc_calls), input, n_draws, noise_spec, mean, stddev, &failed),
+		             auto_partitioner());
+	} catch (...) {
+		ret=f2M_error(-5, -1, __FUNCTION__, "parallel execution failed");
+	}
+	f2M_inference_leave();
+	f2M_release_all(anns_count, anns);
+
+	if (ret==0 && failed>=0) ret=f2M_error(-10, (int) failed, __FUNCTION__, "network failed to run");
+
+	return ret;
+}
@@ -0,0 +1,360 @@
+/* Fann2MQL-memory.cpp
+ *
+ * Copyright (C) 2008-2009 Mariusz Woloszyn
+ *
+ *  This file is part of Fann2MQL package
+ *
+ *  Fann2MQL is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Fann2MQL is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Fann2MQL; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include "stdafx.h"
+#include "Fann2MQL.h"
+#include "doublefann.h"
+#include "fann_internal.h"
+#include "windows.h"
+
+/* Memory pool used for all allocations made by Fann2MQL itself.
+ * Blocks up to the largest size class are carved from slabs and recycled
+ * through per-thread caches and per-class free lists, so buffers allocated
+ * and freed over and over (scratch memory, replay buffers, output buffers)
+ * never go back to the process heap. The cache of a thread is given back to
+ * the free lists when the thread exits. Bigger blocks come from a private heap.
+ * The caches live in thread local storage allocated with TlsAlloc(), see
+ * Fann2MQL-error.cpp. Networks themselves are allocated by FANN with malloc()
+ * and are only accounted for, the pool does not cover them.
+ */
+
+/* smallest size class is 1<<F2M_POOL_MIN_SHIFT bytes */
+#define F2M_POOL_MIN_SHIFT	5
+/* number of size classes, the largest is 1MB */
+#define F2M_POOL_CLASSES	16
+/* size of block header, keeps blocks 16 bytes aligned */
+#define F2M_POOL_HEADER	16
+/* minimal size of a slab */
+#define F2M_POOL_SLAB	65536
+/* number of free blocks kept by a thread for every size class */
+#define F2M_POOL_CACHE	32
+
+/* header in front of every block */
+typedef struct pBH {
+	size_t size;	/* requested size */
+	int cls;		/* size class, -1 for blocks from the private heap */
+} poolBlockHeader;
+
+/* free block */
+typedef struct pFB {
+	struct pFB *next;
+} poolFreeBlock;
+
+/* free blocks kept by a thread */
+typedef struct pTC {
+	poolFreeBlock* blocks[F2M_POOL_CLASSES];
+	int count[F2M_POOL_CLASSES];
+} poolThreadCache;
+
+/* Private heap of the pool and the thread local storage slot of the caches */
+class PoolHeap {
+public:
+	HANDLE heap;
+	DWORD tls;
+	PoolHeap() { heap=HeapCreate(0, 0, 0); tls=TlsAlloc(); }
+	~PoolHeap() {
+		if (tls!=TLS_OUT_OF_INDEXES) TlsFree(tls);
+		if (heap!=NULL) HeapDestroy(heap);
+	}
+};
+
+PoolHeap _pool;
+
+/* free lists of size classes and the lock guarding them and the slabs */
+poolFreeBlock* _pool_free[F2M_POOL_CLASSES];
+volatile LONG _pool_lock[F2M_POOL_CLASSES];
+/* unused remainder of the last slab of size classes */
+char* _pool_carve[F2M_POOL_CLASSES];
+char* _pool_carve_end[F2M_POOL_CLASSES];
+
+/* statistics, pointer sized: InterlockedExchangeAdd64() is missing on 32-bit XP */
+volatile LONG_PTR _pool_reserved=0;		/* bytes of slabs */
+volatile LONG_PTR _pool_used=0;			/* bytes of blocks handed out from slabs */
+volatile LONG_PTR _pool_requested=0;	/* bytes requested by callers */
+volatile LONG_PTR _pool_large=0;		/* bytes of blocks from the private heap */
+volatile LONG _pool_slabs=0;
+
+/* Adds bytes to a statistics counter */
+static void f2M_pool_count(volatile LONG_PTR *counter, LONG_PTR bytes)
+{
+#ifdef _WIN64
+	InterlockedExchangeAdd64(counter, bytes);
+#else
+	InterlockedExchangeAdd((volatile LONG*) counter, bytes);
+#endif
+}
+
+/* Returns the value of a statistics counter, counters of 32-bit builds wrap around */
+static double f2M_pool_counter(volatile LONG_PTR *counter)
+{
+	return (double) (ULONG_PTR) *counter;
+}
+
+/* Returns the cache of the calling thread, NULL if it has none
+ *  create - allocate the cache if missing
+ */
+static poolThreadCache* f2M_pool_cache(int create)
+{
+	poolThreadCache *c;
+
+	if (_pool.tls==TLS_OUT_OF_INDEXES) return NULL;
+
+	c=(poolThreadCache*) TlsGetValue(_pool.tls);
+	if (c==NULL && create) {
+		c=(poolThreadCache*) HeapAlloc(_pool.heap, HEAP_ZERO_MEMORY, sizeof(poolThreadCache));
+		if (c!=NULL) TlsSetValue(_pool.tls, c);
+	}
+	return c;
+}
+
+/* Returns the size class of a block of a given size, F2M_POOL_CLASSES if none */
+static int f2M_pool_class(size_t size)
+{
+	int cls=0;
+
+	size+=F2M_POOL_HEADER;
+	while (cls<F2M_POOL_CLASSES && ((size_t) 1<<(cls+F2M_POOL_MIN_SHIFT))<size) cls++;
+
+	return cls;
+}
+
+/* Takes a block of a size class from the free list or a slab */
+static char* f2M_pool_take(int cls)
+{
+	size_t block=(size_t) 1<<(cls+F2M_POOL_MIN_SHIFT), slab;
+	char *ret;
+
+	while (InterlockedCompareExchange(&_pool_lock[cls], 1, 0)!=0) SwitchToThread();
+
+	if (_pool_free[cls]!=NULL) {
+		ret=(char*) _pool_free[cls];
+		_pool_free[cls]=_pool_free[cls]->next;
+	} else {
+		/* carve a new slab */
+		if (_pool_carve[cls]==NULL || _pool_carve[cls]+block>_pool_carve_end[cls]) {
+			slab=block*4>F2M_POOL_SLAB ? block*4 : F2M_POOL_SLAB;
+			_pool_carve[cls]=(char*) HeapAlloc(_pool.heap, 0, slab);
+			if (_pool_carve[cls]==NULL) {
+				InterlockedExchange(&_pool_lock[cls], 0);
+				return NULL;
+			}
+			_pool_carve_end[cls]=_pool_carve[cls]+slab;
+			f2M_pool_count(&_pool_reserved, slab);
+			InterlockedIncrement(&_pool_slabs);
+		}
+		ret=_pool_carve[cls];
+		_pool_carve[cls]+=block;
+	}
+
+	InterlockedExchange(&_pool_lock[cls], 0);
+	return ret;
+}
+
+/* Allocates memory from the Fann2MQL memory pool
+ *  size - number of bytes
+ * Returns:
+ *  pointer to the memory or NULL
+ */
+void* f2M_malloc(size_t size)
+{
+	int cls=f2M_pool_class(size);
+	poolThreadCache *c;
+	poolBlockHeader *h;
+	char *block;
+
+	if (cls>=F2M_POOL_CLASSES) {
+		/* too big for the slabs */
+		block=(char*) HeapAlloc(_pool.heap, 0, size+F2M_POOL_HEADER);
+		if (block==NULL) return NULL;
+		f2M_pool_count(&_pool_large, size+F2M_POOL_HEADER);
+		cls=-1;
+	} else if ((c=f2M_pool_cache(0))!=NULL && c->blocks[cls]!=NULL) {
+		block=(char*) c->blocks[cls];
+		c->blocks[cls]=c->blocks[cls]->next;
+		c->count[cls]--;
+		f2M_pool_count(&_pool_used, (LONG_PTR) 1<<(cls+F2M_POOL_MIN_SHIFT));
+	} else {
+		block=f2M_pool_take(cls);
+		if (block==NULL) return NULL;
+		f2M_pool_count(&_pool_used, (LONG_PTR) 1<<(cls+F2M_POOL_MIN_SHIFT));
+	}
+
+	h=(poolBlockHeader*) block;
+	h->size=size;
+	h->cls=cls;
+	f2M_pool_count(&_pool_requested, size);
+
+	return block+F2M_POOL_HEADER;
+}
+
+/* Allocates zeroed memory from the Fann2MQL memory pool */
+void* f2M_calloc(size_t size)
+{
+	void *ret=f2M_malloc(size);
+
+	if (ret!=NULL) memset(ret, 0, size);
+	return ret;
+}
+
+/* Returns memory allocated by f2M_malloc() or f2M_calloc() to the pool */
+void f2M_free(void *p)
+{
+	poolThreadCache *c;
+	poolBlockHeader *h;
+	poolFreeBlock *block;
+	int cls;
+
+	if (p==NULL) return;
+
+	h=(poolBlockHeader*) ((char*) p-F2M_POOL_HEADER);
+	cls=h->cls;
+	f2M_pool_count(&_pool_requested, -(LONG_PTR) h->size);
+
+	if (cls<0) {
+		f2M_pool_count(&_pool_large, -(LONG_PTR) (h->size+F2M_POOL_HEADER));
+		HeapFree(_pool.heap, 0, h);
+		return;
+	}
+
+	f2M_pool_count(&_pool_used, -((LONG_PTR) 1<<(cls+F2M_POOL_MIN_SHIFT)));
+	block=(poolFreeBlock*) h;
+
+	/* keep it for this thread */
+	c=f2M_pool_cache(1);
+	if (c!=NULL && c->count[cls]<F2M_POOL_CACHE) {
+		block->next=c->blocks[cls];
+		c->blocks[cls]=block;
+		c->count[cls]++;
+		return;
+	}
+
+	while (InterlockedCompareExchange(&_pool_lock[cls], 1, 0)!=0) SwitchToThread();
+	block->next=_pool_free[cls];
+	_pool_free[cls]=block;
+	InterlockedExchange(&_pool_lock[cls], 0);
+}
+
+/* Gives the free blocks cached by the calling thread back to the free lists,
+ * called when the thread exits */
+void f2M_pool_thread_detach()
+{
+	poolThreadCache *c=f2M_pool_cache(0);
+	poolFreeBlock *last;
+	int cls;
+
+	if (c==NULL) return;
+
+	for (cls=0; cls<F2M_POOL_CLASSES; cls++) {
+		if (c->blocks[cls]==NULL) continue;
+		for (last=c->blocks[cls]; last->next!=NULL; last=last->next);
+
+		while (InterlockedCompareExchange(&_pool_lock[cls], 1, 0)!=0) SwitchToThread();
+		last->next=_pool_free[cls];
+		_pool_free[cls]=c->blocks[cls];
+		InterlockedExchange(&_pool_lock[cls], 0);
+	}
+
+	TlsSetValue(_pool.tls, NULL);
+	HeapFree(_pool.heap, 0, c);
+}
+
+/* Returns the number of bytes allocated by FANN for a network */
+double f2M_fann_memory(struct fann *ann)
+{
+	double bytes;
+
+	if (ann==NULL) return 0;
+
+	bytes=sizeof(struct fann);
+	bytes+=(double) (ann->last_layer-ann->first_layer)*sizeof(struct fann_layer);
+	bytes+=(double) ann->total_neurons*(sizeof(struct fann_neuron)+sizeof(fann_type));	/* neurons and outputs */
+	bytes+=(double) ann->total_connections*(sizeof(fann_type)+sizeof(struct fann_neuron*));
+	if (ann->train_errors!=NULL) bytes+=(double) ann->total_neurons*sizeof(fann_type);
+	if (ann->train_slopes!=NULL) bytes+=(double) ann->total_connections*sizeof(fann_type);
+	if (ann->prev_steps!=NULL) bytes+=(double) ann->total_connections*sizeof(fann_type);
+	if (ann->prev_train_slopes!=NULL) bytes+=(double) ann->total_connections*sizeof(fann_type);
+	if (ann->prev_weights_deltas!=NULL) bytes+=(double) ann->total_connections*sizeof(fann_type);
+	if (ann->scale_mean_in!=NULL) bytes+=(double) 4*ann->num_input*sizeof(float);
+	if (ann->scale_mean_out!=NULL) bytes+=(double) 4*ann->num_output*sizeof(float);
+
+	return bytes;
+}
+
+/**
+ * Returns the number of bytes used by a network
+ *  ann - network handler returned by f2M_create*
+ * Returns:
+ *  bytes used by the network, its training copies, online learning buffers and
+ *  output buffer; -1 on error
+ */
+FANN2MQL_API double __stdcall f2M_get_ann_memory(int ann)
+{
+	double bytes;
+	AnnPin pin;
+
+	/* this network is not allocated, an evicted one is not loaded to be measured */
+	if (!pin.acquire_loaded(ann)) return (-1);
+
+	bytes=f2M_fann_memory(_fanns[ann]);
+	bytes+=f2M_fann_memory(_trainfanns[ann]);
+	bytes+=f2M_fann_memory(_sparefanns[ann]);
+	bytes+=f2M_online_memory(ann);
+	bytes+=f2M_cache_memory(ann);
+	bytes+=_fanns[ann]->num_output*sizeof(double);
+
+	return bytes;
+}
+
+/**
+ * Reports memory usage of the library
+ *  *stats - array of F2M_MEMORY_STATS doubles receiving:
+ *    [0] number of allocated networks
+ *    [1] bytes used by all networks (see f2M_get_ann_memory())
+ *    [2] bytes reserved by the memory pool: slabs and large blocks
+ *    [3] bytes of pool blocks in use
+ *    [4] bytes requested by the pool users
+ *    [5] pool fragmentation: part of reserved bytes not requested, 0..1
+ *    [6] number of slabs
+ * Returns:
+ *  0 on success, -1 on error
+ */
+FANN2MQL_API int __stdcall f2M_memory_stats(double *stats)
+{
+	double bytes;
+	int i;
+
+	if (stats==NULL) return f2M_error(-1, -1, __FUNCTION__, "stats is NULL");
+
+	stats[0]=0;
+	stats[1]=0;
+	for (i=0; i<=_ann; i++) {
+		if ((bytes=f2M_get_ann_memory(i))<0) continue;
+		stats[0]++;
+		stats[1]+=bytes;
+	}
+	stats[2]=f2M_pool_counter(&_pool_reserved)+f2M_pool_counter(&_pool_large);
+	stats[3]=f2M_pool_counter(&_pool_used)+f2M_pool_counter(&_pool_large);
+	stats[4]=f2M_pool_counter(&_pool_requested);
+	stats[5]=stats[2]>0 ? 1.0-stats[4]/stats[2] : 0;
+	stats[6]=(double) _pool_slabs;
+
+	return 0;
+}
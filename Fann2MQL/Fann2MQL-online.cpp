@@ -0,0 +1,356 @@
+/* Fann2MQL-online.cpp
+ *
+ * Copyright (C) 2008-2009 Mariusz Woloszyn
+ *
+ *  This file is part of Fann2MQL package
+ *
+ *  Fann2MQL is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Fann2MQL is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Fann2MQL; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include "stdafx.h"
+#include "Fann2MQL.h"
+#include "doublefann.h"
+#include "fann_internal.h"
+#include "windows.h"
+
+/* Online learning state of a single network */
+typedef struct oLD {
+	int capacity;		/* number of samples kept in the replay buffer */
+	int batch_size;		/* number of samples in every mini-batch update */
+	int update_every;	/* number of new samples between updates */
+	int epochs;			/* epochs trained on every mini-batch */
+	int row_size;		/* num_input+num_output */
+	double *ring;		/* replay buffer: capacity rows of row_size values */
+	int head;			/* next row to be written */
+	int count;			/* number of valid rows */
+	int fresh;			/* samples added since the last scheduled update */
+	unsigned int seed;	/* mini-batch sampling state */
+	volatile LONG pending;	/* update scheduled */
+	volatile LONG updates;	/* number of published updates */
+	struct fann *train;	/* private training copy of the network */
+	struct fann *spare;	/* retired serving copy, reused by the next update */
+	struct fann_train_data *batch;	/* preallocated mini-batch */
+	CRITICAL_SECTION cs;	/* guards the replay buffer */
+	HANDLE idle;		/* manual reset event, reset while an update is in progress */
+} onlineData;
+
+/* Critical section guarding _online[] against the worker thread, held only
+ * while an entry is looked up, never while it is trained */
+class OnlineLock {
+public:
+	CRITICAL_SECTION cs;
+	OnlineLock() { InitializeCriticalSection(&cs); }
+	~OnlineLock() { DeleteCriticalSection(&cs); }
+};
+
+/* online learning state of networks */
+onlineData* _online[ANNMAX];
+/* number of networks learning online */
+int _online_count=0;
+/* worker thread handler and its wake up event */
+HANDLE _online_thread=NULL;
+HANDLE _online_event=NULL;
+/* tells the worker thread to quit */
+volatile LONG _online_quit=0;
+
+OnlineLock _online_lock;
+
+/* Trains a mini-batch sampled from the replay buffer and publishes the result */
+static void f2M_online_update(int ann, onlineData* od)
+{
+	struct fann_train_data *batch=od->batch;
+	unsigned int i, n, row, num_input=batch->num_input;
+	int e;
+
+	/* sample the mini-batch; the lock is held only while copying */
+	EnterCriticalSection(&od->cs);
+	n=od->count<od->batch_size ? od->count : od->batch_size;
+	for (i=0; i<n; i++) {
+		od->seed=od->seed*1103515245+12345;
+		row=(od->seed>>8)%od->count;
+		memcpy(batch->input[i], od->ring+row*od->row_size, num_input*sizeof(double));
+		memcpy(batch->output[i], od->ring+row*od->row_size+num_input, batch->num_output*sizeof(double));
+	}
+	LeaveCriticalSection(&od->cs);
+
+	if (n==0) return;
+	batch->num_data=n;
+
+	for (e=0; e<od->epochs; e++) {
+		f2M_training_yield();
+		fann_train_epoch(od->train, batch);
+	}
+
+	/* readers keep running the old weights until the pointer flip; the copies
+	 * follow f2M_set_fast_math() called since they were made */
+	f2M_copy_fann_state(od->spare, od->train);
+	f2M_fast_math_attach(ann, od->train);
+	f2M_fast_math_attach(ann, od->spare);
+	od->spare=f2M_publish_fann(ann, od->spare);
+	InterlockedIncrement(&od->updates);
+}
+
+/* Worker thread performing mini-batch updates of all online networks */
+DWORD WINAPI f2M_online_loop(LPVOID lpParam)
+{
+	onlineData* od;
+	int i;
+
+	while (1) {
+		WaitForSingleObject(_online_event, INFINITE);
+		if (_online_quit) break;
+
+		for (i=0; i<ANNMAX; i++) {
+			/* the entry is marked busy before the lock is left, deinit waits for it */
+			EnterCriticalSection(&_online_lock.cs);
+			od=_online[i];
+			if (od!=NULL && InterlockedExchange(&od->pending, 0))
+				ResetEvent(od->idle);
+			else
+				od=NULL;
+			LeaveCriticalSection(&_online_lock.cs);
+
+			if (od==NULL) continue;
+			f2M_online_update(i, od);
+			SetEvent(od->idle);
+		}
+	}
+
+	return 0;
+}
+
+/* Releases online learning data */
+static void f2M_online_free(onlineData* od)
+{
+	if (od->train!=NULL) fann_destroy(od->train);
+	if (od->spare!=NULL) fann_destroy(od->spare);
+	if (od->batch!=NULL) fann_destroy_train(od->batch);
+	if (od->ring!=NULL) f2M_free(od->ring);
+	if (od->idle!=NULL) CloseHandle(od->idle);
+	DeleteCriticalSection(&od->cs);
+	f2M_free(od);
+}
+
+/**
+ * Enables online learning of a network
+ *  ann - network handler returned by f2M_create*
+ *  capacity - number of samples kept in the replay buffer
+ *  batch_size - number of samples drawn from the replay buffer for every update
+ *  update_every - number of samples added by f2M_online_add() between updates
+ *  epochs - number of epochs trained on every mini-batch
+ * Returns:
+ *  0 on success, <0 on error
+ * Note:
+ *  Updates are trained on a private copy of the network, using its training
+ *  algorithm and parameters at the time of this call, by a background thread.
+ *  New weights are published without blocking f2M_run().
+ *  Do not train the network with f2M_train*() while online learning is enabled.
+ */
+FANN2MQL_API int __stdcall f2M_online_init(int ann, int capacity, int batch_size, int update_every, int epochs)
+{
+	onlineData* od;
+	AnnPin pin;
+
+	/* this network is not allocated */
+	if (!pin.acquire(ann)) return f2M_error_handle(-1, ann, __FUNCTION__);
+
+	/* online learning already enabled or training on a copy */
+	if (_online[ann]!=NULL || _trainfanns[ann]!=NULL)
+		return f2M_error(-2, ann, __FUNCTION__, "online learning already enabled or network is trained on a copy");
+
+	/* not accepting bogus arguments */
+	if (capacity<1 || batch_size<1 || update_every<1 || epochs<1) return f2M_error(-3, ann, __FUNCTION__, "invalid arguments");
+
+	od=(onlineData*) f2M_calloc(sizeof(onlineData));
+	if (od==NULL) return f2M_error(-4, ann, __FUNCTION__, "out of memory");
+	InitializeCriticalSection(&od->cs);
+
+	od->capacity=capacity;
+	od->batch_size=batch_size;
+	od->update_every=update_every;
+	od->epochs=epochs;
+	od->row_size=_fanns[ann]->num_input+_fanns[ann]->num_output;
+	od->seed=(unsigned int) ann;
+
+	/* everything is allocated upfront, adding samples never allocates */
+	od->ring=(double*) f2M_malloc(capacity*od->row_size*sizeof(double));
+	od->batch=fann_create_train(batch_size, _fanns[ann]->num_input, _fanns[ann]->num_output);
+	od->train=fann_copy(_fanns[ann]);
+	od->spare=fann_copy(_fanns[ann]);
+	od->idle=CreateEvent(NULL, TRUE, TRUE, NULL);
+	if (od->ring==NULL || od->batch==NULL || od->train==NULL || od->spare==NULL || od->idle==NULL) {
+		f2M_online_free(od);
+		return f2M_error(-4, ann, __FUNCTION__, "out of memory");
+	}
+
+	/* start the worker thread with the first online network */
+	if (_online_thread==NULL) {
+		_online_quit=0;
+		_online_event=CreateEvent(NULL, FALSE, FALSE, NULL);
+		if (_online_event==NULL) {
+			f2M_error_system(-5, __FUNCTION__, "CreateEvent");
+			f2M_online_free(od);
+			return -5;
+		}
+		_online_thread=CreateThread(NULL, 0, f2M_online_loop, NULL, 0, NULL);
+		if (_online_thread==NULL) {
+			f2M_error_system(-5, __FUNCTION__, "CreateThread");
+			CloseHandle(_online_event);
+			_online_event=NULL;
+			f2M_online_free(od);
+			return -5;
+		}
+		/* training must not steal the CPU from the terminal */
+		SetThreadPriority(_online_thread, THREAD_PRIORITY_BELOW_NORMAL);
+	}
+
+	EnterCriticalSection(&_online_lock.cs);
+	_online[ann]=od;
+	_online_count++;
+	LeaveCriticalSection(&_online_lock.cs);
+
+	return 0;
+}
+
+/**
+ * Disables online learning of a network
+ *  ann - network handler returned by f2M_create*
+ * Returns:
+ *  0 on success, -1 if online learning was not enabled
+ * Note:
+ *  The network keeps the last published weights.
+ */
+FANN2MQL_API int __stdcall f2M_online_deinit(int ann)
+{
+	onlineData* od;
+
+	if (ann<0 || ann>=ANNMAX) return -1;
+
+	/* the worker does not pick the network up any more */
+	EnterCriticalSection(&_online_lock.cs);
+	od=_online[ann];
+	_online[ann]=NULL;
+	if (od!=NULL) _online_count--;
+	LeaveCriticalSection(&_online_lock.cs);
+
+	if (od==NULL) return -1;
+
+	/* waits for an update of this network in progress */
+	WaitForSingleObject(od->idle, INFINITE);
+	f2M_online_free(od);
+
+	/* stop the worker thread with the last online network */
+	if (_online_count==0 && _online_thread!=NULL) {
+		_online_quit=1;
+		SetEvent(_online_event);
+		WaitForSingleObject(_online_thread, INFINITE);
+		CloseHandle(_online_thread);
+		CloseHandle(_online_event);
+		_online_thread=NULL;
+		_online_event=NULL;
+	}
+
+	return 0;
+}
+
+/**
+ * Adds a sample to the replay buffer of an online network
+ *  ann - network handler returned by f2M_create*
+ *  *input_vector - arrary of inputs
+ *  *output_vector - arrary of desired outputs
+ * Returns:
+ *  0 on success, <0 on error
+ * Note:
+ *  The oldest sample is overwritten when the buffer is full. Every update_every
+ *  samples a mini-batch update is scheduled; this call never waits for it.
+ */
+FANN2MQL_API int __stdcall f2M_online_add(int ann, double *input_vector, double *output_vector)
+{
+	onlineData* od;
+	double *row;
+	unsigned int num_input, i;
+
+	/* online learning not enabled */
+	if (ann<0 || ann>_ann || _online[ann]==NULL) return f2M_error(-1, ann, __FUNCTION__, "online learning not enabled");
+
+	/* the input or output vector is empty */
+	if (input_vector==NULL || output_vector==NULL) return f2M_error(-2, ann, __FUNCTION__, "input or output vector is NULL");
+
+	od=_online[ann];
+	num_input=od->batch->num_input;
+
+	EnterCriticalSection(&od->cs);
+	row=od->ring+od->head*od->row_size;
+	memcpy(row, input_vector, num_input*sizeof(double));
+	memcpy(row+num_input, output_vector, (od->row_size-num_input)*sizeof(double));
+	/* the mini-batches are trained by FANN, which runs the network unscaled */
+	if (f2M_scaled(od->train)) {
+		for (i=0; i<num_input; i++)
+			row[i]=f2M_scale_input(od->train, i, row[i]);
+		f2M_scale_outputs(od->train, output_vector, row+num_input);
+	}
+	od->head=(od->head+1)%od->capacity;
+	if (od->count<od->capacity) od->count++;
+
+	/* schedule an update */
+	if (++od->fresh>=od->update_every) {
+		od->fresh=0;
+		InterlockedExchange(&od->pending, 1);
+		SetEvent(_online_event);
+	}
+	LeaveCriticalSection(&od->cs);
+
+	return 0;
+}
+
+/* Returns nonzero if online learning is enabled for a network */
+int f2M_online_enabled(int ann)
+{
+	return (_online[ann]!=NULL);
+}
+
+/* Returns the number of bytes used by online learning of a network, 0 if not enabled */
+double f2M_online_memory(int ann)
+{
+	onlineData* od;
+	double bytes;
+
+	EnterCriticalSection(&_online_lock.cs);
+	od=_online[ann];
+	bytes=0;
+	if (od!=NULL) {
+		bytes=sizeof(onlineData);
+		bytes+=(double) od->capacity*od->row_size*sizeof(double);
+		bytes+=(double) od->batch_size*od->row_size*sizeof(fann_type)+sizeof(struct fann_train_data);
+		bytes+=f2M_fann_memory(od->train)+f2M_fann_memory(od->spare);
+	}
+	LeaveCriticalSection(&_online_lock.cs);
+
+	return bytes;
+}
+
+/**
+ * Returns the number of mini-batch updates published for an online network
+ *  ann - network handler returned by f2M_create*
+ * Returns:
+ *  number of updates, -1 if online learning is not enabled
+ */
+FANN2MQL_API int __stdcall f2M_online_get_updates(int ann)
+{
+	/* online learning not enabled */
+	if (ann<0 || ann>_ann || _online[ann]==NULL) return -1;
+
+	return (int) _online[ann]->updates;
+}
@@ -0,0 +1,240 @@
+/* Fann2MQL-prune.cpp
+ *
+ * Copyright (C) 2008-2009 Mariusz Woloszyn
+ *
+ *  This file is part of Fann2MQL package
+ *
+ *  Fann2MQL is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Fann2MQL is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Fann2MQL; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include "stdafx.h"
+#include "Fann2MQL.h"
+#include "doublefann.h"
+#include "fann_internal.h"
+#include "windows.h"
+#include <stdlib.h>
+
+/* Weight pruning.
+ * Pruned connections are removed from the fann structure itself: the weights
+ * and connections arrays are compacted neuron by neuron, which is the
+ * compressed sparse row layout FANN already uses for sparse networks
+ * (connection_rate<1). fann_run(), the batched kernels and fann_save()
+ * handle it natively, so the work and memory scale with the kept connections
+ * and pruned networks are saved and loaded as ordinary .net files.
+ * Bias connections are never pruned so no neuron ends up without inputs.
+ */
+
+/* Marks the bias neurons of a network
+ *  *bias - total_neurons flags
+ */
+static void f2M_prune_bias(struct fann *ann, char *bias)
+{
+	struct fann_neuron *first=ann->first_layer->first_neuron;
+	struct fann_layer *layer_it;
+
+	memset(bias, 0, ann->total_neurons);
+
+	/* shortcut networks have a single bias neuron, the last one of the input layer */
+	if (ann->network_type==FANN_NETTYPE_SHORTCUT) {
+		bias[ann->first_layer->last_neuron-1-first]=1;
+		return;
+	}
+
+	for (layer_it=ann->first_layer; layer_it!=ann->last_layer; layer_it++)
+		bias[layer_it->last_neuron-1-first]=1;
+}
+
+/* Removes the connections with absolute weights not greater than a threshold
+ * Returns:
+ *  number of removed connections, -1 on error
+ */
+static int f2M_prune_compact(struct fann *ann, double threshold)
+{
+	struct fann_neuron *first=ann->first_layer->first_neuron;
+	struct fann_neuron *neuron_it, *last_neuron=(ann->last_layer-1)->last_neuron;
+	unsigned int total=ann->total_connections, k=0, c, first_con;
+	fann_type *weights;
+	struct fann_neuron **connections;
+	char *bias;
+
+	bias=(char*) f2M_malloc(ann->total_neurons);
+	if (bias==NULL) return -1;
+	f2M_prune_bias(ann, bias);
+
+	for (neuron_it=first; neuron_it!=last_neuron; neuron_it++) {
+		first_con=k;
+		for (c=neuron_it->first_con; c<neuron_it->last_con; c++) {
+			if (!bias[ann->connections[c]-first] && fann_abs(ann->weights[c])<=threshold) continue;
+			ann->weights[k]=ann->weights[c];
+			ann->connections[k]=ann->connections[c];
+			k++;
+		}
+		neuron_it->first_con=first_con;
+		neuron_it->last_con=k;
+	}
+	f2M_free(bias);
+
+	if (k==total) return 0;
+
+	/* training arrays are indexed by connections, FANN allocates them again */
+	if (ann->train_slopes!=NULL) free(ann->train_slopes);
+	if (ann->prev_steps!=NULL) free(ann->prev_steps);
+	if (ann->prev_train_slopes!=NULL) free(ann->prev_train_slopes);
+	if (ann->prev_weights_deltas!=NULL) free(ann->prev_weights_deltas);
+	ann->train_slopes=NULL;
+	ann->prev_steps=NULL;
+	ann->prev_train_slopes=NULL;
+	ann->prev_weights_deltas=NULL;
+
+	/* give the memory back, keeping the old arrays if that fails */
+	weights=(fann_type*) realloc(ann->weights, k*sizeof(fann_type));
+	if (weights!=NULL) ann->weights=weights;
+	connections=(struct fann_neuron**) realloc(ann->connections, k*sizeof(struct fann_neuron*));
+	if (connections!=NULL) ann->connections=connections;
+
+	/* from now on the network is sparse for FANN */
+	ann->connection_rate=(ann->connection_rate<1 ? ann->connection_rate : 1)*k/total;
+	if (ann->connection_rate>=1) ann->connection_rate=0.999999f;
+	ann->total_connections=k;
+	ann->total_connections_allocated=k;
+
+	return (int) (total-k);
+}
+
+/* Compares absolute values of doubles for qsort() */
+static int f2M_prune_cmp(const void *a, const void *b)
+{
+	double x=fann_abs(*(const double*) a), y=fann_abs(*(const double*) b);
+	return (x<y ? -1 : (x>y ? 1 : 0));
+}
+
+/* Prunes a copy of the published network and publishes it
+ *  *function - name of the calling function, for the last error
+ * Returns:
+ *  number of removed connections, <0 on error
+ */
+static int f2M_prune_publish(int ann, double threshold, double fraction, const char *function)
+{
+	struct fann *f;
+	double *w;
+	char *bias;
+	unsigned int c, n, k;
+	int ret;
+
+	/* the copies must keep the topology of the published network */
+	if (_trainfanns[ann]!=NULL || f2M_online_enabled(ann) || f2M_job_running(ann))
+		return f2M_error(-3, ann, function, "network is trained on a copy, learns online or by a job");
+
+	f=fann_copy(_fanns[ann]);
+	if (f==NULL) return f2M_error(-4, ann, function, "out of memory");
+
+	/* threshold of the smallest fraction of non-bias weights */
+	if (fraction>0) {
+		w=(double*) f2M_malloc(f->total_connections*sizeof(double));
+		bias=(char*) f2M_malloc(f->total_neurons);
+		if (w==NULL || bias==NULL) {
+			f2M_free(w);
+			f2M_free(bias);
+			fann_destroy(f);
+			return f2M_error(-4, ann, function, "out of memory");
+		}
+		f2M_prune_bias(f, bias);
+		for (c=0, n=0; c<f->total_connections; c++)
+			if (!bias[f->connections[c]-f->first_layer->first_neuron]) w[n++]=f->weights[c];
+		qsort(w, n, sizeof(double), f2M_prune_cmp);
+		k=(unsigned int) (fraction*n);
+		threshold=(k>0 ? fann_abs(w[k-1]) : -1);
+		f2M_free(w);
+		f2M_free(bias);
+	}
+
+	ret=f2M_prune_compact(f, threshold);
+	if (ret<0) {
+		fann_destroy(f);
+		return f2M_error(-4, ann, function, "out of memory");
+	}
+
+	/* a pruned registered network must not be loaded again from its file */
+	f2M_registry_modified(ann);
+	fann_destroy(f2M_publish_fann(ann, f));
+	f2M_registry_resized(ann);
+
+	return ret;
+}
+
+/**
+ * Prunes the connections of a network with small weights
+ *  ann - network handler returned by f2M_create*
+ *  threshold - connections with absolute weights not greater than this are removed
+ * Returns:
+ *  number of removed connections, <0 on error
+ * Note:
+ *  The network becomes sparse: it runs faster, uses less memory and is saved
+ *  as such by f2M_save(). Bias connections are kept. Training a pruned network
+ *  does not bring the removed connections back. Not available while the
+ *  network is trained on a copy or learns online.
+ */
+FANN2MQL_API int __stdcall f2M_prune(int ann, double threshold)
+{
+	AnnPin pin;
+
+	/* this network is not allocated */
+	if (!pin.acquire(ann)) return f2M_error_handle(-1, ann, __FUNCTION__);
+
+	/* not accepting bogus arguments */
+	if (threshold<0) return f2M_error(-2, ann, __FUNCTION__, "threshold is negative");
+
+	return f2M_prune_publish(ann, threshold, 0, __FUNCTION__);
+}
+
+/**
+ * Prunes a given fraction of the connections of a network, smallest weights first
+ *  ann - network handler returned by f2M_create*
+ *  fraction - part of the non-bias connections to remove, 0..1
+ * Returns:
+ *  number of removed connections, <0 on error
+ * Note:
+ *  See f2M_prune(). Connections with weights equal to the last pruned one are
+ *  removed too.
+ */
+FANN2MQL_API int __stdcall f2M_prune_fraction(int ann, double fraction)
+{
+	AnnPin pin;
+
+	/* this network is not allocated */
+	if (!pin.acquire(ann)) return f2M_error_handle(-1, ann, __FUNCTION__);
+
+	/* not accepting bogus arguments */
+	if (fraction<0 || fraction>1) return f2M_error(-2, ann, __FUNCTION__, "fraction out of 0..1");
+	if (fraction==0) return 0;
+
+	return f2M_prune_publish(ann, 0, fraction, __FUNCTION__);
+}
+
+/**
+ * Returns the number of connections of a network
+ *  ann - network handler returned by f2M_create*
+ * Returns:
+ *  number of connections, -1 on error
+ */
+FANN2MQL_API int __stdcall f2M_get_total_connections(int ann)
+{
+	AnnPin pin;
+
+	/* this network is not allocated */
+	if (!pin.acquire(ann)) return f2M_error_handle(-1, ann, __FUNCTION__);
+
+	return (int) _fanns[ann]->total_connections;
+}
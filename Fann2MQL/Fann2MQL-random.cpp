@@ -0,0 +1,167 @@
+/* Fann2MQL-random.cpp
+ *
+ * Copyright (C) 2008-2009 Mariusz Woloszyn
+ *
+ *  This file is part of Fann2MQL package
+ *
+ *  Fann2MQL is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Fann2MQL is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Fann2MQL; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include "stdafx.h"
+#include "Fann2MQL.h"
+#include "doublefann.h"
+#include "fann_internal.h"
+#include "windows.h"
+
+/* Reproducible random numbers.
+ * FANN draws initial and randomized weights from the C runtime rand(), seeded
+ * from the clock when a network is created and shared by all threads. Seeded
+ * networks use counter-based streams instead: the n-th number of a stream is
+ * a hash of (seed, stream, n), so it does not depend on the order in which
+ * threads ask for numbers. In the deterministic mode every network created by
+ * f2M_create_standard*() and f2M_sweep() gets its own stream.
+ */
+
+/* range of initial weights of FANN networks */
+#define F2M_INIT_WEIGHT	0.1
+
+/* nonzero in the deterministic mode */
+int _deterministic=0;
+/* seed of the deterministic mode */
+unsigned __int64 _base_seed=0;
+
+/* seeds of networks, used when _seeded[] is set */
+unsigned __int64 _seeds[ANNMAX];
+int _seeded[ANNMAX];
+/* number of randomizations of seeded networks, part of the counter */
+unsigned int _rng_calls[ANNMAX];
+
+/* Mixes a 64 bit value, the SplitMix64 finalizer */
+static __forceinline unsigned __int64 f2M_mix(unsigned __int64 z)
+{
+	z=(z^(z>>30))*0xbf58476d1ce4e5b9ULL;
+	z=(z^(z>>27))*0x94d049bb133111ebULL;
+	return z^(z>>31);
+}
+
+/* Returns the n-th number of a stream, uniformly distributed in [0, 1) */
+double f2M_random(unsigned __int64 seed, unsigned __int64 stream, unsigned __int64 n)
+{
+	unsigned __int64 z=f2M_mix(seed+0x9e3779b97f4a7c15ULL*(stream+1));
+
+	z=f2M_mix(z^(n*0x9e3779b97f4a7c15ULL));
+	return (double) (z>>11)*(1.0/9007199254740992.0);
+}
+
+/* Gives each connection a random weight from a stream, like fann_randomize_weights()
+ *  ann - fann structure
+ *  seed, stream - the stream
+ *  call - number of the randomization within the stream
+ */
+void f2M_randomize_fann(struct fann *ann, unsigned __int64 seed, unsigned __int64 stream, unsigned int call,
+						double min_weight, double max_weight)
+{
+	unsigned int i;
+
+	for (i=0; i<ann->total_connections; i++)
+		ann->weights[i]=min_weight+(max_weight-min_weight)*
+			f2M_random(seed, stream, ((unsigned __int64) call<<32)+i);
+
+	if (ann->prev_train_slopes!=NULL) fann_clear_train_arrays(ann);
+}
+
+/* Returns nonzero in the deterministic mode */
+int f2M_deterministic()
+{
+	return _deterministic;
+}
+
+/* Returns the seed of the deterministic mode */
+unsigned __int64 f2M_base_seed()
+{
+	return _base_seed;
+}
+
+/* Seeds a network just created, in the deterministic mode only
+ *  ann - handler returned by f2M_new_handle(), may be negative
+ * Returns:
+ *  ann
+ */
+int f2M_seed_new(int ann)
+{
+	if (ann<0 || !_deterministic) return ann;
+
+	_seeds[ann]=f2M_mix(_base_seed+ann);
+	_seeded[ann]=1;
+	_rng_calls[ann]=0;
+	f2M_randomize_fann(_fanns[ann], _seeds[ann], ann, _rng_calls[ann]++, -F2M_INIT_WEIGHT, F2M_INIT_WEIGHT);
+
+	return ann;
+}
+
+/* Randomizes the weights of a network, from its stream if it is seeded */
+void f2M_randomize(int ann, struct fann *f, double min_weight, double max_weight)
+{
+	if (_seeded[ann])
+		f2M_randomize_fann(f, _seeds[ann], ann, _rng_calls[ann]++, min_weight, max_weight);
+	else
+		fann_randomize_weights(f, min_weight, max_weight);
+}
+
+/* Forgets the seed of a handler being destroyed */
+void f2M_seed_release(int ann)
+{
+	_seeded[ann]=0;
+}
+
+/**
+ * Switches the deterministic mode
+ *  enable - nonzero to enable
+ *  seed - seed of all the random streams
+ * Returns:
+ *  0
+ * Note:
+ *  Networks created from now on are initialized and randomized from their own
+ *  streams, and so are the networks of f2M_sweep(). Together with the fixed
+ *  order reductions used by all the parallel functions, results are identical
+ *  for the same seed regardless of the number of cores.
+ */
+FANN2MQL_API int __stdcall f2M_set_deterministic(int enable, int seed)
+{
+	_deterministic=(enable!=0);
+	_base_seed=(unsigned __int64) (unsigned int) seed;
+	return 0;
+}
+
+/**
+ * Seeds the random stream of a network used by f2M_randomize_weights()
+ *  ann - network handler returned by f2M_create*
+ *  seed - seed of the stream
+ * Returns:
+ *  0 on success, -1 on error
+ */
+FANN2MQL_API int __stdcall f2M_seed(int ann, int seed)
+{
+	AnnPin pin;
+
+	/* this network is not allocated */
+	if (!pin.acquire(ann)) return f2M_error_handle(-1, ann, __FUNCTION__);
+
+	_seeds[ann]=f2M_mix((unsigned __int64) (unsigned int) seed);
+	_seeded[ann]=1;
+	_rng_calls[ann]=0;
+
+	return 0;
+}
@@ -0,0 +1,451 @@
+/* Fann2MQL-registry.cpp
+ *
+ * Copyright (C) 2008-2009 Mariusz Woloszyn
+ *
+ *  This file is part of Fann2MQL package
+ *
+ *  Fann2MQL is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Fann2MQL is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Fann2MQL; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include "stdafx.h"
+#include "Fann2MQL.h"
+#include "doublefann.h"
+#include "fann_internal.h"
+#include "windows.h"
+
+/* Registry of networks loaded on demand.
+ * f2M_register_file() allocates a handler without loading the network; it
+ * is loaded by the first call which needs it (f2M_acquire()). Networks of
+ * registered handlers are evicted by the CLOCK algorithm whenever the memory
+ * budget would be exceeded and are loaded again when needed. Networks which
+ * were trained, have a training copy or online learning are never evicted.
+ */
+
+/* paths of registered networks, NULL for networks created otherwise */
+char* _paths[ANNMAX];
+/* CLOCK reference bits, set whenever a network is used */
+volatile LONG _referenced[ANNMAX];
+/* number of calls using a network, not to be evicted while nonzero */
+volatile LONG _pinned[ANNMAX];
+/* set while a network is being loaded */
+volatile LONG _loading[ANNMAX];
+/* set once a registered network was modified, it stays in memory */
+volatile LONG _dirty[ANNMAX];
+/* bytes used by loaded registered networks */
+double _sizes[ANNMAX];
+
+/* requests of the prefetch thread */
+volatile LONG _prefetch[ANNMAX];
+
+double _registry_bytes=0;
+double _registry_budget=0;
+int _clock_hand=0;
+
+/* Registry lock and the prefetch thread, started with the first prefetch and
+ * stopped by f2M_prefetch_stop(). The thread is not waited for here: static
+ * destructors run under the loader lock, which the exiting thread needs too.
+ */
+class RegistryLock {
+public:
+	CRITICAL_SECTION cs;
+	HANDLE event;
+	HANDLE thread;
+	volatile DWORD thread_id;	/* the prefetch thread quits once it is not its id */
+	RegistryLock() {
+		InitializeCriticalSection(&cs);
+		event=NULL;
+		thread=NULL;
+		thread_id=0;
+	}
+	~RegistryLock() {
+		/* f2M_prefetch_stop() was not called, the thread dies with the process */
+		if (thread!=NULL) return;
+		DeleteCriticalSection(&cs);
+	}
+};
+
+RegistryLock _registry;
+
+/* Evicts networks until size more bytes fit into the budget.
+ * Must be called with the registry lock held.
+ *  keep - handler which must not be evicted
+ */
+static void f2M_registry_evict(double size, int keep)
+{
+	struct fann *f;
+	int scanned, i;
+
+	if (_registry_budget<=0) return;
+
+	/* two revolutions: the first one may only clear the reference bits */
+	for (scanned=0; _registry_bytes+size>_registry_budget && scanned<2*(_ann+1); scanned++) {
+		if (_clock_hand>_ann) _clock_hand=0;
+		i=_clock_hand++;
+
+		if (i==keep || _paths[i]==NULL || _fanns[i]==NULL) continue;
+		if (_pinned[i] || _dirty[i] || _trainfanns[i]!=NULL || f2M_online_enabled(i)) continue;
+		if (InterlockedExchange(&_referenced[i], 0)) continue;
+
+		/* readers still running it are waited for */
+		f=f2M_publish_fann(i, NULL);
+		fann_destroy(f);
+		_registry_bytes-=_sizes[i];
+		_sizes[i]=0;
+	}
+}
+
+/* Loads the network of a registered handler
+ *  ann - registered network handler
+ *  evict - nonzero to evict other networks to fit into the budget; if zero
+ *    and the budget would be exceeded the network is not kept
+ *  pin - nonzero to pin the network, under the same lock it is found or loaded
+ * Returns:
+ *  0 on success, -1 on error
+ */
+static int f2M_registry_load(int ann, int evict, int pin)
+{
+	struct fann *f;
+	double size;
+
+	EnterCriticalSection(&_registry.cs);
+
+	/* somebody else is loading it */
+	while (_loading[ann]) {
+		LeaveCriticalSection(&_registry.cs);
+		SwitchToThread();
+		EnterCriticalSection(&_registry.cs);
+	}
+	if (_fanns[ann]!=NULL || _paths[ann]==NULL) {
+		if (_fanns[ann]!=NULL && pin) {
+			_referenced[ann]=1;
+			InterlockedIncrement(&_pinned[ann]);
+		}
+		LeaveCriticalSection(&_registry.cs);
+		return (_fanns[ann]!=NULL ? 0 : -1);
+	}
+
+	/* do not block the other networks while reading the file */
+	_loading[ann]=1;
+	LeaveCriticalSection(&_registry.cs);
+	f=fann_create_from_file(_paths[ann]);
+	EnterCriticalSection(&_registry.cs);
+	_loading[ann]=0;
+
+	if (f==NULL) {
+		LeaveCriticalSection(&_registry.cs);
+		return -1;
+	}
+
+	size=f2M_fann_memory(f);
+	if (_outbufs[ann]==NULL)
+		_outbufs[ann]=(double*) f2M_calloc(f->num_output*sizeof(double));
+	if (_outbufs[ann]==NULL || (!evict && _registry_budget>0 && _registry_bytes+size>_registry_budget)) {
+		LeaveCriticalSection(&_registry.cs);
+		fann_destroy(f);
+		return -1;
+	}
+
+	f2M_registry_evict(size, ann);
+	f2M_fast_math_attach(ann, f);
+	_sizes[ann]=size;
+	_registry_bytes+=size;
+	_referenced[ann]=1;
+	if (pin) InterlockedIncrement(&_pinned[ann]);
+	f2M_publish_fann(ann, f);
+
+	LeaveCriticalSection(&_registry.cs);
+	return 0;
+}
+
+/* Makes sure the network of a handler is in memory, loading it if it was
+ * registered by f2M_register_file() and is not loaded yet or was evicted,
+ * and pins it until f2M_release().
+ *  ann - network handler
+ * Returns:
+ *  nonzero if ann is a handler of a network in memory
+ */
+int f2M_acquire(int ann)
+{
+	if (ann<0 || ann>_ann) return 0;
+
+	/* registered networks are found and pinned under the lock of the eviction */
+	if (_paths[ann]!=NULL) return (f2M_registry_load(ann, 1, 1)==0);
+
+	if (_fanns[ann]==NULL) return 0;
+	InterlockedIncrement(&_pinned[ann]);
+	return 1;
+}
+
+/* Pins the network of a handler like f2M_acquire(), but only if it is in memory
+ * Returns:
+ *  nonzero if the network was pinned
+ */
+int f2M_acquire_loaded(int ann)
+{
+	int ret=0;
+
+	if (ann<0 || ann>_ann) return 0;
+
+	/* eviction checks the pins under the lock */
+	EnterCriticalSection(&_registry.cs);
+	if (_fanns[ann]!=NULL) {
+		InterlockedIncrement(&_pinned[ann]);
+		ret=1;
+	}
+	LeaveCriticalSection(&_registry.cs);
+
+	return ret;
+}
+
+/* Unpins a network pinned by f2M_acquire() */
+void f2M_release(int ann)
+{
+	InterlockedDecrement(&_pinned[ann]);
+}
+
+/* Acquires networks used by a parallel call and pins them until f2M_release_all()
+ * Returns:
+ *  -1 on success, otherwise the position in anns[] of the first invalid handler
+ */
+int f2M_acquire_all(int count, int *anns)
+{
+	int i;
+
+	for (i=0; i<count; i++) {
+		if (!f2M_acquire(anns[i])) {
+			f2M_release_all(i, anns);
+			return i;
+		}
+	}
+
+	return -1;
+}
+
+/* Unpins networks pinned by f2M_acquire_all() */
+void f2M_release_all(int count, int *anns)
+{
+	int i;
+
+	for (i=0; i<count; i++) f2M_release(anns[i]);
+}
+
+/* Accounts the new size of a registered network, called when its topology changes */
+void f2M_registry_resized(int ann)
+{
+	double size;
+
+	if (_paths[ann]==NULL) return;
+
+	EnterCriticalSection(&_registry.cs);
+	if (_fanns[ann]!=NULL) {
+		size=f2M_fann_memory(_fanns[ann]);
+		_registry_bytes+=size-_sizes[ann];
+		_sizes[ann]=size;
+	}
+	LeaveCriticalSection(&_registry.cs);
+}
+
+/* Keeps a registered network in memory from now on, called when it is modified */
+void f2M_registry_modified(int ann)
+{
+	if (_paths[ann]!=NULL) _dirty[ann]=1;
+}
+
+/* Returns nonzero if a handler was allocated by f2M_register_file() */
+int f2M_registered(int ann)
+{
+	return (_paths[ann]!=NULL);
+}
+
+/* Forgets a registered network, called when its handler is destroyed */
+void f2M_registry_release(int ann)
+{
+	if (_paths[ann]==NULL) return;
+
+	EnterCriticalSection(&_registry.cs);
+	while (_loading[ann]) {
+		LeaveCriticalSection(&_registry.cs);
+		SwitchToThread();
+		EnterCriticalSection(&_registry.cs);
+	}
+	_registry_bytes-=_sizes[ann];
+	_sizes[ann]=0;
+	_dirty[ann]=0;
+	_prefetch[ann]=0;
+	f2M_free(_paths[ann]);
+	_paths[ann]=NULL;
+	LeaveCriticalSection(&_registry.cs);
+}
+
+/* Prefetch thread, loads requested networks as long as they fit into the budget
+ *  lpParam - event signalled when there are requests or the thread should quit
+ */
+DWORD WINAPI f2M_prefetch_loop(LPVOID lpParam)
+{
+	HANDLE event=(HANDLE) lpParam;
+	DWORD self=GetCurrentThreadId();
+	int i;
+
+	while (WaitForSingleObject(event, INFINITE)==WAIT_OBJECT_0 && _registry.thread_id==self) {
+		for (i=0; i<=_ann && _registry.thread_id==self; i++) {
+			if (!InterlockedExchange(&_prefetch[i], 0)) continue;
+			if (_paths[i]==NULL || _fanns[i]!=NULL) continue;
+			f2M_registry_load(i, 0, 0);
+		}
+	}
+
+	return 0;
+}
+
+/**
+ * Registers a network file without loading it
+ *  *path - path to .net file
+ * Returns:
+ *	handler to ann, -1 on error
+ * Note:
+ *  The network is loaded by the first call which needs it and may be evicted
+ *  later to stay within the memory budget set by f2M_set_memory_budget().
+ */
+FANN2MQL_API int __stdcall f2M_register_file(char *path)
+{
+	char *p;
+	int handle;
+
+	if (path==NULL) return f2M_error(-1, -1, __FUNCTION__, "path is NULL");
+	p=(char*) f2M_malloc(strlen(path)+1);
+	if (p==NULL) return f2M_error(-1, -1, __FUNCTION__, "out of memory");
+	strcpy(p, path);
+
+	f2M_handles_lock();
+
+	/* too many networks allocated */
+	if (_ann>=ANNMAX-1) {
+		f2M_handles_unlock();
+		f2M_free(p);
+		return f2M_error(-1, -1, __FUNCTION__, "too many networks");
+	}
+
+	/* allocate the handler for ann */
+	_ann++;
+	_paths[_ann]=p;
+	_fanns[_ann]=NULL;
+	_outbufs[_ann]=NULL;
+	_outputs[_ann]=NULL;
+	handle=_ann;
+
+	f2M_handles_unlock();
+	return handle;
+}
+
+/**
+ * Sets the memory budget of networks registered by f2M_register_file()
+ *  bytes - maximum number of bytes used by registered networks, 0 for no limit
+ * Returns:
+ *  0 on success, -1 on error
+ * Note:
+ *  The budget may be exceeded while all the loaded networks are in use.
+ */
+FANN2MQL_API int __stdcall f2M_set_memory_budget(double bytes)
+{
+	if (bytes<0) return f2M_error(-1, -1, __FUNCTION__, "budget is negative");
+
+	EnterCriticalSection(&_registry.cs);
+	_registry_budget=bytes;
+	f2M_registry_evict(0, -1);
+	LeaveCriticalSection(&_registry.cs);
+
+	return 0;
+}
+
+/**
+ * Loads registered networks in the background
+ *  count - number of handlers
+ *  anns[] - handlers returned by f2M_register_file() which will be needed soon
+ * Returns:
+ *  0 on success, <0 on error
+ * Note:
+ *  Networks are only prefetched while they fit into the memory budget.
+ */
+FANN2MQL_API int __stdcall f2M_prefetch(int count, int *anns)
+{
+	int i;
+
+	if (anns==NULL || count<0) return f2M_error(-1, -1, __FUNCTION__, "invalid arguments");
+
+	EnterCriticalSection(&_registry.cs);
+	if (_registry.thread==NULL) {
+		if (_registry.event==NULL) _registry.event=CreateEvent(NULL, FALSE, FALSE, NULL);
+		if (_registry.event!=NULL)
+			_registry.thread=CreateThread(NULL, 0, f2M_prefetch_loop, _registry.event, 0,
+										  (LPDWORD) &_registry.thread_id);
+		if (_registry.thread==NULL) {
+			f2M_error_system(-2, __FUNCTION__, _registry.event==NULL ? "CreateEvent" : "CreateThread");
+			LeaveCriticalSection(&_registry.cs);
+			return (-2);
+		}
+		SetThreadPriority(_registry.thread, THREAD_PRIORITY_BELOW_NORMAL);
+	}
+
+	for (i=0; i<count; i++)
+		if (anns[i]>=0 && anns[i]<=_ann && _paths[anns[i]]!=NULL) _prefetch[anns[i]]=1;
+	SetEvent(_registry.event);
+	LeaveCriticalSection(&_registry.cs);
+
+	return 0;
+}
+
+/**
+ * Stops the prefetch thread started by f2M_prefetch()
+ * Returns:
+ *  0 on success
+ * Note:
+ *  Call it before the library is unloaded, f2M_parallel_deinit() calls it
+ *  as well. A later f2M_prefetch() starts the thread again.
+ */
+FANN2MQL_API int __stdcall f2M_prefetch_stop()
+{
+	HANDLE event, thread;
+
+	EnterCriticalSection(&_registry.cs);
+	event=_registry.event;
+	thread=_registry.thread;
+	_registry.event=NULL;
+	_registry.thread=NULL;
+	_registry.thread_id=0;
+	LeaveCriticalSection(&_registry.cs);
+
+	/* the thread takes the registry lock while loading, it is waited for outside of it */
+	if (thread!=NULL) {
+		SetEvent(event);
+		WaitForSingleObject(thread, INFINITE);
+		CloseHandle(thread);
+	}
+	if (event!=NULL) CloseHandle(event);
+
+	return 0;
+}
+
+/**
+ * Tells whether the network of a handler is in memory
+ *  ann - network handler
+ * Returns:
+ *  1 if loaded, 0 if registered but not loaded, -1 on error
+ */
+FANN2MQL_API int __stdcall f2M_is_loaded(int ann)
+{
+	if (ann<0 || ann>_ann) return f2M_error_handle(-1, ann, __FUNCTION__);
+	if (_fanns[ann]!=NULL) return 1;
+	return (_paths[ann]!=NULL ? 0 : -1);
+}
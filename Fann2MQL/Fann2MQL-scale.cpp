@@ -0,0 +1,370 @@
+/* Fann2MQL-scale.cpp
+ *
+ * Copyright (C) 2008-2009 Mariusz Woloszyn
+ *
+ *  This file is part of Fann2MQL package
+ *
+ *  Fann2MQL is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Fann2MQL is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Fann2MQL; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include "stdafx.h"
+#include "Fann2MQL.h"
+#include "doublefann.h"
+#include "fann_internal.h"
+#include "windows.h"
+#include <math.h>
+
+#include "tbb/blocked_range.h"
+#include "tbb/parallel_for.h"
+
+using namespace tbb;
+
+/* Input and output scaling.
+ * The parameters live in FANN's own scale arrays, so fann_save() and
+ * fann_create_from_file() keep them with the network and FANN applies the
+ * same formulas (fann_scale_input(), fann_descale_output()). Both statistics
+ * map onto them: mean/std directly, min/max with the mean at the middle of the
+ * range and the deviation at its half. The kernels apply them while loading
+ * the input layer and while reading the output layer, and the training
+ * kernels scale the desired outputs where the output errors are computed, so
+ * callers always work in the units of their data.
+ */
+
+/* number of rows whose statistics are computed by a single thread */
+#define F2M_SCALE_CHUNK	1024
+
+/* statistics of a column over a chunk of rows */
+typedef struct sS {
+	double n;
+	double mean;
+	double m2;		/* sum of squared differences from the mean */
+	double min;
+	double max;
+} scaleStats;
+
+/* Returns nonzero if a network has scaling parameters */
+int f2M_scaled(struct fann *ann)
+{
+	return (ann->scale_mean_in!=NULL);
+}
+
+/* Scales an input, like fann_scale_input() */
+double f2M_scale_input(struct fann *ann, unsigned int i, double x)
+{
+	return ((x-ann->scale_mean_in[i])/ann->scale_deviation_in[i]+1.0)*ann->scale_factor_in[i]+ann->scale_new_min_in[i];
+}
+
+/* Scales a desired output, like fann_scale_output() */
+double f2M_scale_output(struct fann *ann, unsigned int o, double y)
+{
+	return ((y-ann->scale_mean_out[o])/ann->scale_deviation_out[o]+1.0)*ann->scale_factor_out[o]+ann->scale_new_min_out[o];
+}
+
+/* Descales an output, like fann_descale_output() */
+double f2M_descale_output(struct fann *ann, unsigned int o, double y)
+{
+	return ((y-ann->scale_new_min_out[o])/ann->scale_factor_out[o]-1.0)*ann->scale_deviation_out[o]+ann->scale_mean_out[o];
+}
+
+/* Scales desired outputs into a buffer of num_output doubles */
+void f2M_scale_outputs(struct fann *ann, double *output_vector, double *scaled)
+{
+	unsigned int o;
+
+	for (o=0; o<ann->num_output; o++)
+		scaled[o]=f2M_scale_output(ann, o, output_vector[o]);
+}
+
+/* Intel TBB paralelized class used by f2M_set_scaling().
+ * Every chunk of rows has its own statistics, merged in chunk order
+ * afterwards, so the result does not depend on how the chunks were scheduled.
+ */
+class Apply_scale_stats {
+	int num_data;
+	int num_cols;
+	int num_input;
+	double **inputs;
+	double **outputs;
+	scaleStats *stats;
+public:
+	void operator()( const blocked_range<size_t>& r ) const {
+		scaleStats *s;
+		size_t chunk, i, end;
+		double x, delta;
+		int c;
+
+		for (chunk=r.begin(); chunk!=r.end(); chunk++) {
+			s=stats+chunk*num_cols;
+			end=(chunk+1)*F2M_SCALE_CHUNK<(size_t) num_data ? (chunk+1)*F2M_SCALE_CHUNK : num_data;
+			for (i=chunk*F2M_SCALE_CHUNK; i<end; i++) {
+				for (c=0; c<num_cols; c++) {
+					x=(c<num_input ? inputs[i][c] : outputs[i][c-num_input]);
+					/* Welford's update */
+					s[c].n++;
+					delta=x-s[c].mean;
+					s[c].mean+=delta/s[c].n;
+					s[c].m2+=delta*(x-s[c].mean);
+					if (s[c].n==1 || x<s[c].min) s[c].min=x;
+					if (s[c].n==1 || x>s[c].max) s[c].max=x;
+				}
+			}
+		}
+	}
+	Apply_scale_stats(int nd, int nc, int ni, double **in, double **out, scaleStats *st) :
+		num_data(nd), num_cols(nc), num_input(ni), inputs(in), outputs(out), stats(st)
+	{}
+};
+
+/* Merges the statistics of chunks b into a */
+static void f2M_scale_merge(scaleStats *a, scaleStats *b)
+{
+	double n=a->n+b->n, delta=b->mean-a->mean;
+
+	if (b->n==0) return;
+	if (a->n==0) {
+		*a=*b;
+		return;
+	}
+	a->mean+=delta*b->n/n;
+	a->m2+=b->m2+delta*delta*a->n*b->n/n;
+	if (b->min<a->min) a->min=b->min;
+	if (b->max>a->max) a->max=b->max;
+	a->n=n;
+}
+
+/* Sets the scaling parameters of a column from its statistics */
+static void f2M_scale_set(scaleStats *s, int mode, double new_min, double new_max,
+						  float *mean, float *deviation, float *factor, float *new_min_out)
+{
+	double m, d;
+
+	if (mode==0) {
+		m=s->mean;
+		d=sqrt(s->m2/s->n);
+	} else {
+		m=(s->min+s->max)/2;
+		d=(s->max-s->min)/2;
+	}
+	/* a constant column */
+	if (d<=0) d=1;
+
+	*mean=(float) m;
+	*deviation=(float) d;
+	*factor=(float) ((new_max-new_min)/2);
+	*new_min_out=(float) new_min;
+}
+
+/* Frees the scaling parameters of a network */
+static void f2M_scale_free(struct fann *ann)
+{
+	free(ann->scale_mean_in);
+	free(ann->scale_deviation_in);
+	free(ann->scale_new_min_in);
+	free(ann->scale_factor_in);
+	free(ann->scale_mean_out);
+	free(ann->scale_deviation_out);
+	free(ann->scale_new_min_out);
+	free(ann->scale_factor_out);
+	ann->scale_mean_in=NULL;
+	ann->scale_deviation_in=NULL;
+	ann->scale_new_min_in=NULL;
+	ann->scale_factor_in=NULL;
+	ann->scale_mean_out=NULL;
+	ann->scale_deviation_out=NULL;
+	ann->scale_new_min_out=NULL;
+	ann->scale_factor_out=NULL;
+}
+
+/* Computes the input and output scaling of a network from rows of data,
+ * see f2M_set_scaling()
+ *  **inputs - num_data rows of num_input inputs
+ *  **outputs - num_data rows of num_output desired outputs, NULL to keep outputs unscaled
+ *  function - name of the exported function, for errors
+ * Returns:
+ *  0 on success, <0 on error
+ */
+static int f2M_scaling_from_rows(int ann, int num_data, double **inputs, double **outputs, int mode,
+								 double new_input_min, double new_input_max,
+								 double new_output_min, double new_output_max, const char *function)
+{
+	struct fann *f;
+	scaleStats *stats;
+	int num_input, num_output, num_cols, chunks, k, c;
+
+	/* not accepting bogus arguments */
+	if (num_data<1 || inputs==NULL || (mode!=0 && mode!=1) ||
+		new_input_min>=new_input_max || (outputs!=NULL && new_output_min>=new_output_max))
+		return f2M_error(-2, ann, function, "invalid arguments");
+
+	/* the copies must keep the scaling of the published network */
+	if (_trainfanns[ann]!=NULL || f2M_online_enabled(ann) || f2M_job_running(ann))
+		return f2M_error(-3, ann, function, "network is trained on a copy, learns online or by a job");
+
+	num_input=(int) _fanns[ann]->num_input;
+	num_output=(int) _fanns[ann]->num_output;
+	num_cols=num_input+(outputs!=NULL ? num_output : 0);
+	chunks=(num_data+F2M_SCALE_CHUNK-1)/F2M_SCALE_CHUNK;
+
+	/* a single pass over the data */
+	stats=(scaleStats*) f2M_calloc(chunks*num_cols*sizeof(scaleStats));
+	if (stats==NULL) return f2M_error(-4, ann, function, "out of memory");
+	try {
+		parallel_for(blocked_range<size_t>(0, chunks),
+		             Apply_scale_stats(num_data, num_cols, num_input, inputs, outputs, stats), auto_partitioner());
+	} catch (...) {
+		f2M_free(stats);
+		return f2M_error(-5, ann, function, "parallel execution failed");
+	}
+	for (k=1; k<chunks; k++)
+		for (c=0; c<num_cols; c++)
+			f2M_scale_merge(stats+c, stats+k*num_cols+c);
+
+	/* scale a copy and publish it */
+	f=fann_copy(_fanns[ann]);
+	if (f==NULL || (f->scale_mean_in==NULL && fann_allocate_scale(f)!=0)) {
+		if (f!=NULL) fann_destroy(f);
+		f2M_free(stats);
+		return f2M_error(-4, ann, function, "out of memory");
+	}
+	for (c=0; c<num_input; c++)
+		f2M_scale_set(stats+c, mode, new_input_min, new_input_max,
+					  f->scale_mean_in+c, f->scale_deviation_in+c, f->scale_factor_in+c, f->scale_new_min_in+c);
+	for (c=0; c<num_output; c++) {
+		if (outputs!=NULL) {
+			f2M_scale_set(stats+num_input+c, mode, new_output_min, new_output_max,
+						  f->scale_mean_out+c, f->scale_deviation_out+c, f->scale_factor_out+c, f->scale_new_min_out+c);
+		} else {
+			/* the identity */
+			f->scale_mean_out[c]=0;
+			f->scale_deviation_out[c]=1;
+			f->scale_factor_out[c]=1;
+			f->scale_new_min_out[c]=-1;
+		}
+	}
+	f2M_free(stats);
+
+	f2M_registry_modified(ann);
+	fann_destroy(f2M_publish_fann(ann, f));
+
+	return 0;
+}
+
+/**
+ * Computes the input and output scaling of a network from a dataset
+ *  ann - network handler returned by f2M_create*
+ *  num_data - number of samples
+ *  *inputs - num_data rows of num_input inputs
+ *  *outputs - num_data rows of num_output desired outputs, NULL to keep outputs unscaled
+ *  mode - 0 scales by mean and standard deviation, 1 by minimum and maximum
+ *  new_input_min, new_input_max - range the inputs are mapped to; with mode 0
+ *    it is the range of the mean -/+ one standard deviation
+ *  new_output_min, new_output_max - the same for the outputs
+ * Returns:
+ *  0 on success, <0 on error
+ * Note:
+ *  From now on f2M_run(), the parallel functions and f2M_get_output() take
+ *  and return values in the units of the data, training functions take
+ *  desired outputs in these units, and f2M_save() stores the scaling with the
+ *  network. Not available while the network is trained on a copy or learns
+ *  online.
+ */
+FANN2MQL_API int __stdcall f2M_set_scaling(int ann, int num_data, double *inputs, double *outputs, int mode,
+										   double new_input_min, double new_input_max,
+										   double new_output_min, double new_output_max)
+{
+	double **rows;
+	int i, num_input, num_output, ret;
+	AnnPin pin;
+
+	/* this network is not allocated */
+	if (!pin.acquire(ann)) return f2M_error_handle(-1, ann, __FUNCTION__);
+
+	if (num_data<1 || inputs==NULL) return f2M_error(-2, ann, __FUNCTION__, "invalid arguments");
+
+	/* the rows of the arrays */
+	num_input=(int) _fanns[ann]->num_input;
+	num_output=(int) _fanns[ann]->num_output;
+	rows=(double**) f2M_malloc(2*num_data*sizeof(double*));
+	if (rows==NULL) return f2M_error(-4, ann, __FUNCTION__, "out of memory");
+	for (i=0; i<num_data; i++) {
+		rows[i]=inputs+(size_t) i*num_input;
+		rows[num_data+i]=(outputs!=NULL ? outputs+(size_t) i*num_output : NULL);
+	}
+
+	ret=f2M_scaling_from_rows(ann, num_data, rows, outputs!=NULL ? rows+num_data : NULL, mode,
+							  new_input_min, new_input_max, new_output_min, new_output_max, __FUNCTION__);
+	f2M_free(rows);
+	return ret;
+}
+
+/**
+ * Computes the input and output scaling of a network from a dataset handle, see f2M_set_scaling()
+ *  ann - network handler returned by f2M_create*
+ *  data - dataset handler returned by f2M_data_*, with the inputs and outputs of the network
+ *  scale_outputs - nonzero to scale the outputs too
+ * Returns:
+ *  0 on success, <0 on error
+ */
+FANN2MQL_API int __stdcall f2M_data_set_scaling(int ann, int data, int scale_outputs, int mode,
+												double new_input_min, double new_input_max,
+												double new_output_min, double new_output_max)
+{
+	struct fann_train_data *d;
+	AnnPin pin;
+	DataPin data_pin;
+
+	/* this network is not allocated */
+	if (!pin.acquire(ann)) return f2M_error_handle(-1, ann, __FUNCTION__);
+
+	d=data_pin.acquire(data);
+	if (d==NULL) return f2M_error(-6, ann, __FUNCTION__, "invalid dataset handler");
+	if (d->num_input!=_fanns[ann]->num_input || d->num_output!=_fanns[ann]->num_output)
+		return f2M_error(-7, ann, __FUNCTION__, "dataset does not fit the network");
+
+	return f2M_scaling_from_rows(ann, (int) d->num_data, d->input, scale_outputs ? d->output : NULL, mode,
+								 new_input_min, new_input_max, new_output_min, new_output_max, __FUNCTION__);
+}
+
+/**
+ * Removes the input and output scaling of a network
+ *  ann - network handler returned by f2M_create*
+ * Returns:
+ *  0 on success, <0 on error
+ * Note:
+ *  Not available while the network is trained on a copy or learns online.
+ */
+FANN2MQL_API int __stdcall f2M_clear_scaling(int ann)
+{
+	struct fann *f;
+	AnnPin pin;
+
+	/* this network is not allocated */
+	if (!pin.acquire(ann)) return f2M_error_handle(-1, ann, __FUNCTION__);
+
+	/* the copies must keep the scaling of the published network */
+	if (_trainfanns[ann]!=NULL || f2M_online_enabled(ann) || f2M_job_running(ann))
+		return f2M_error(-3, ann, __FUNCTION__, "network is trained on a copy, learns online or by a job");
+
+	if (!f2M_scaled(_fanns[ann])) return 0;
+
+	f=fann_copy(_fanns[ann]);
+	if (f==NULL) return f2M_error(-4, ann, __FUNCTION__, "out of memory");
+	f2M_scale_free(f);
+
+	f2M_registry_modified(ann);
+	fann_destroy(f2M_publish_fann(ann, f));
+
+	return 0;
+}
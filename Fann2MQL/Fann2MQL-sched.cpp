@@ -0,0 +1,163 @@
+/* Fann2MQL-sched.cpp
+ *
+ * Copyright (C) 2008-2009 Mariusz Woloszyn
+ *
+ *  This file is part of Fann2MQL package
+ *
+ *  Fann2MQL is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Fann2MQL is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Fann2MQL; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include "stdafx.h"
+#include "Fann2MQL.h"
+#include "doublefann.h"
+#include "fann_internal.h"
+#include "windows.h"
+
+/* Priorities of inference and training.
+ * Intel TBB 3.0 has no task priorities, so the two classes cooperate:
+ *  - inference calls count themselves in _inference_pending while running,
+ *  - training loops of their own threads call f2M_training_yield() between
+ *    epochs, which gives the processor away while any inference is pending,
+ *  - training tasks of Intel TBB never wait inside a task, which would keep
+ *    a worker from inference: they check f2M_training_preempted() between
+ *    networks and epochs and end early, and their caller yields and spawns
+ *    the rest of the work again,
+ *  - training runs at a lower thread priority, so the OS prefers inference,
+ *  - parallel training is split into at most share*cores chunks, so the
+ *    remaining TBB workers stay free for inference.
+ */
+
+/* number of inference calls running */
+volatile LONG _inference_pending=0;
+/* part of the processors parallel training may use */
+double _training_share=1;
+
+/* Marks the start of a latency-critical inference call */
+void f2M_inference_enter()
+{
+	InterlockedIncrement(&_inference_pending);
+}
+
+/* Marks the end of an inference call started by f2M_inference_enter() */
+void f2M_inference_leave()
+{
+	InterlockedDecrement(&_inference_pending);
+}
+
+/* Waits while inference is running, called by training at chunk boundaries
+ * outside of Intel TBB tasks */
+void f2M_training_yield()
+{
+	while (_inference_pending>0) SwitchToThread();
+}
+
+/* Returns nonzero if a training task should end at this chunk boundary, to be
+ * spawned again by its caller once inference is done */
+int f2M_training_preempted()
+{
+	return (_inference_pending>0);
+}
+
+/* Lowers the priority of the calling thread for training
+ * Returns:
+ *  the previous priority, to be passed to f2M_training_end()
+ */
+int f2M_training_begin()
+{
+	int prio=GetThreadPriority(GetCurrentThread());
+
+	if (prio>THREAD_PRIORITY_BELOW_NORMAL)
+		SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_BELOW_NORMAL);
+	return prio;
+}
+
+/* Restores the thread priority changed by f2M_training_begin() */
+void f2M_training_end(int prio)
+{
+	if (prio>THREAD_PRIORITY_BELOW_NORMAL)
+		SetThreadPriority(GetCurrentThread(), prio);
+}
+
+/* Returns the number of processors parallel training may use */
+int f2M_training_workers()
+{
+	SYSTEM_INFO si;
+	int workers;
+
+	GetSystemInfo(&si);
+	workers=(int) (_training_share*si.dwNumberOfProcessors);
+	return (workers<1 ? 1 : workers);
+}
+
+/* Returns the grain size splitting n training items into at most share*cores
+ * chunks, 0 if training is not capped and the auto partitioner can be used.
+ */
+size_t f2M_training_grain(size_t n)
+{
+	size_t chunks;
+
+	if (_training_share>=1) return 0;
+
+	chunks=(size_t) f2M_training_workers();
+	return (n+chunks-1)/chunks;
+}
+
+/* Trains a network on a dataset until the desired error or the maximum number
+ * of epochs is reached, like fann_train_on_data(), yielding to inference
+ * between epochs and taking the checkpoints of the network.
+ *  ann - network handler
+ *  f - fann structure trained, the network or its training copy
+ * Returns:
+ *  number of epochs trained
+ */
+unsigned int f2M_train_epochs(int ann, struct fann *f, struct fann_train_data *data, unsigned int max_epochs, float desired_error)
+{
+	unsigned int epoch;
+	float error;
+	int prio=f2M_training_begin();
+
+	fann_reset_errno((struct fann_error*) f);
+	for (epoch=1; epoch<=max_epochs; epoch++) {
+		f2M_training_yield();
+		error=fann_train_epoch(f, data);
+		if (fann_get_errno((struct fann_error*) f)!=FANN_E_NO_ERROR) break;
+		f2M_checkpoint_epoch(ann, f);
+
+		if (f->train_stop_function==FANN_STOPFUNC_BIT)
+			error=(float) f->num_bit_fail;
+		if (error<=desired_error) break;
+	}
+
+	f2M_training_end(prio);
+	return (epoch>max_epochs ? max_epochs : epoch);
+}
+
+/**
+ * Caps the processors used by parallel training
+ *  share - part of the processors training may use, 0..1; 1 removes the cap
+ * Returns:
+ *  0 on success, -1 on error
+ * Note:
+ *  Training always runs at a lower priority and yields while f2M_run(),
+ *  f2M_run_parallel() or f2M_test_dataset() are running. The cap keeps TBB
+ *  workers free for them.
+ */
+FANN2MQL_API int __stdcall f2M_set_training_share(double share)
+{
+	if (share<=0 || share>1) return f2M_error(-1, -1, __FUNCTION__, "share must be in (0, 1]");
+
+	_training_share=share;
+	return 0;
+}
@@ -0,0 +1,357 @@
+/* Fann2MQL-sensitivity.cpp
+ *
+ * Copyright (C) 2008-2009 Mariusz Woloszyn
+ *
+ *  This file is part of Fann2MQL package
+ *
+ *  Fann2MQL is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Fann2MQL is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Fann2MQL; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include "stdafx.h"
+#include "Fann2MQL.h"
+#include "doublefann.h"
+#include "fann_internal.h"
+#include "windows.h"
+#include <math.h>
+
+#include "tbb/blocked_range.h"
+#include "tbb/parallel_for.h"
+
+using namespace tbb;
+
+/* Input sensitivity.
+ * Choosing inputs by perturbing them one at a time from MQL costs a call of
+ * f2M_run() per input, sample and network. Here the whole dataset is
+ * analysed natively, blocks of samples by the batched kernel and chunks of
+ * samples of every network in parallel, in one of two ways:
+ *  - gradients: the batched forward pass keeps the sums of all neurons and a
+ *    backward pass over the same block computes the derivatives of every
+ *    output with respect to every input, through scaling and fast math;
+ *  - permutation: the error of the network is measured again with the
+ *    values of one input taken from other samples, which breaks its relation
+ *    to the targets and keeps its distribution.
+ * Every chunk has its own partial sums, added up in chunk order afterwards,
+ * so the results do not depend on how the chunks were scheduled.
+ */
+
+/* number of samples of a chunk analysed by a single task */
+#define F2M_SENSITIVITY_CHUNK	(16*F2M_BATCH)
+
+/* Returns the slope of the linear scaling of an input, 1 if unscaled */
+static double f2M_input_slope(struct fann *ann, unsigned int i)
+{
+	if (!f2M_scaled(ann)) return 1;
+	return f2M_scale_input(ann, i, 1)-f2M_scale_input(ann, i, 0);
+}
+
+/* Returns the slope of the linear descaling of an output, 1 if unscaled */
+static double f2M_output_slope(struct fann *ann, unsigned int o)
+{
+	if (!f2M_scaled(ann)) return 1;
+	return f2M_descale_output(ann, o, 1)-f2M_descale_output(ann, o, 0);
+}
+
+/* Adds the absolute derivatives of the outputs of a block of samples with
+ * respect to their inputs, summed over the outputs, to a sum per input.
+ * The network must have been run on the block by f2M_run_batch() with sums.
+ *  ann - fann structure
+ *  n - number of samples, 1..F2M_BATCH
+ *  *values, *sums - neuron values and sums of f2M_run_batch()
+ *  *deltas - f2M_batch_scratch_size() doubles of scratch memory
+ *  *importance - num_input sums
+ */
+static void f2M_gradient_block(struct fann *ann, int n, double *values, double *sums, double *deltas, double *importance)
+{
+	struct fann_neuron *first=ann->first_layer->first_neuron;
+	struct fann_neuron *neuron_it, *output_first=(ann->last_layer-1)->first_neuron;
+	struct fann_layer *layer_it;
+	struct fann_neuron **conns;
+	const fastTables *ft=(const fastTables*) ann->user_data;
+	unsigned int i, o, c, num_connections;
+	double *d, *s, *w, slope;
+	size_t k;
+	int b;
+
+	for (o=0; o<ann->num_output; o++) {
+		/* the derivative of output o with respect to itself, descaled */
+		memset(deltas, 0, f2M_batch_scratch_size(ann)*sizeof(double));
+		d=deltas+(output_first+o-first)*F2M_BATCH;
+		slope=f2M_output_slope(ann, o);
+		for (b=0; b<n; b++) d[b]=slope;
+
+		/* every neuron has got the deltas of all the later neurons it feeds */
+		for (layer_it=ann->last_layer-1; layer_it!=ann->first_layer; layer_it--) {
+			for (neuron_it=layer_it->last_neuron-1; neuron_it>=layer_it->first_neuron; neuron_it--) {
+				/* bias neuron */
+				if (neuron_it->first_con==neuron_it->last_con) continue;
+
+				k=(neuron_it-first)*F2M_BATCH;
+				d=deltas+k;
+				for (b=0; b<n; b++)
+					d[b]*=f2M_fast_derived(ft, neuron_it->activation_function, neuron_it->activation_steepness,
+										   values[k+b], sums[k+b]);
+
+				num_connections=neuron_it->last_con-neuron_it->first_con;
+				w=ann->weights+neuron_it->first_con;
+				conns=ann->connections+neuron_it->first_con;
+				for (c=0; c<num_connections; c++) {
+					s=deltas+(conns[c]-first)*F2M_BATCH;
+					for (b=0; b<n; b++) s[b]+=w[c]*d[b];
+				}
+			}
+		}
+
+		/* the deltas of the input neurons, with respect to raw inputs */
+		for (i=0; i<ann->num_input; i++) {
+			d=deltas+i*F2M_BATCH;
+			slope=f2M_input_slope(ann, i);
+			for (b=0; b<n; b++) importance[i]+=fabs(d[b]*slope);
+		}
+	}
+}
+
+/* Returns the squared error of a block of samples, measured like f2M_test_dataset()
+ *  *out - n rows of outputs
+ *  *targets - n rows of desired outputs
+ */
+static double f2M_block_error(struct fann *ann, int n, double *out, double *targets)
+{
+	struct fann_neuron *output_first=(ann->last_layer-1)->first_neuron;
+	unsigned int num_output=ann->num_output, o;
+	double diff, error=0;
+	int b;
+
+	for (b=0; b<n; b++) {
+		for (o=0; o<num_output; o++) {
+			diff=targets[b*num_output+o]-out[b*num_output+o];
+			if (f2M_scaled(ann)) diff*=ann->scale_factor_out[o]/ann->scale_deviation_out[o];
+			diff*=f2M_mse_factor(output_first+o);
+			error+=diff*diff;
+		}
+	}
+	return error;
+}
+
+/* Intel TBB paralelized class used by f2M_input_sensitivity*().
+ * Every task analyses a chunk of samples of a network into num_input+1
+ * partial sums: per input, and the error of the intact samples last.
+ */
+class Apply_sensitivity {
+	int *anns;
+	int mode;
+	int num_data;
+	double *inputs;
+	double *targets;
+	int *perm;
+	double *partial;
+	volatile LONG *failed;
+public:
+	void operator()( const blocked_range<size_t>& r ) const {
+		int chunks=(num_data+F2M_SENSITIVITY_CHUNK-1)/F2M_SENSITIVITY_CHUNK;
+		struct fann *f;
+		double *values, *sums, *x, *out, *p;
+		int num_input, num_output, ann, phase, start, end, s, n, b, i;
+
+		for (size_t k=r.begin(); k!=r.end(); k++) {
+			ann=anns[k/chunks];
+			start=(int) (k%chunks)*F2M_SENSITIVITY_CHUNK;
+			end=start+F2M_SENSITIVITY_CHUNK<num_data ? start+F2M_SENSITIVITY_CHUNK : num_data;
+
+			f=f2M_read_lock(ann, &phase);
+			if (f==NULL) {
+				f2M_read_unlock(ann, phase);
+				InterlockedCompareExchange(failed, ann, -1);
+				continue;
+			}
+			num_input=(int) f->num_input;
+			num_output=(int) f->num_output;
+			p=partial+k*(num_input+1);
+
+			/* values, sums and deltas, or values, inputs and outputs of a block */
+			values=(double*) f2M_malloc((3*f2M_batch_scratch_size(f)+F2M_BATCH*(num_input+num_output))*sizeof(double));
+			if (values==NULL) {
+				f2M_read_unlock(ann, phase);
+				InterlockedCompareExchange(failed, ann, -1);
+				continue;
+			}
+			sums=values+f2M_batch_scratch_size(f);
+			x=sums+2*f2M_batch_scratch_size(f);
+			out=x+F2M_BATCH*num_input;
+
+			for (s=start; s<end; s+=n) {
+				n=end-s<F2M_BATCH ? end-s : F2M_BATCH;
+				if (mode==F2M_SENSITIVITY_GRADIENT) {
+					f2M_run_batch(f, NULL, n, inputs+(size_t) s*num_input, NULL, values, sums);
+					f2M_gradient_block(f, n, values, sums, sums+f2M_batch_scratch_size(f), p);
+					continue;
+				}
+
+				f2M_run_batch(f, NULL, n, inputs+(size_t) s*num_input, out, values, NULL);
+				p[num_input]+=f2M_block_error(f, n, out, targets+(size_t) s*num_output);
+				for (i=0; i<num_input; i++) {
+					memcpy(x, inputs+(size_t) s*num_input, n*num_input*sizeof(double));
+					for (b=0; b<n; b++) x[b*num_input+i]=inputs[(size_t) perm[s+b]*num_input+i];
+					f2M_run_batch(f, NULL, n, x, out, values, NULL);
+					p[i]+=f2M_block_error(f, n, out, targets+(size_t) s*num_output);
+				}
+			}
+
+			f2M_read_unlock(ann, phase);
+			f2M_free(values);
+		}
+	}
+	Apply_sensitivity(int *a, int m, int nd, double *iv, double *tv, int *pm, double *pt, volatile LONG *fl) :
+		anns(a), mode(m), num_data(nd), inputs(iv), targets(tv), perm(pm), partial(pt), failed(fl)
+	{}
+};
+
+/* Analyses the inputs of networks already acquired, see f2M_input_sensitivity_parallel() */
+static int f2M_sensitivity(int anns_count, int *anns, int data, int mode, double *importance, const char *function)
+{
+	struct fann_train_data *d;
+	double *inputs=NULL, *targets=NULL, *partial=NULL, *p;
+	int *perm=NULL;
+	unsigned int num_input, num_output;
+	int i, j, t, a, c, chunks, ret=0;
+	volatile LONG failed=-1;
+	DataPin data_pin;
+
+	d=data_pin.acquire(data);
+	if (d==NULL || d->num_data<1) return f2M_error(-30, anns[0], function, "invalid or empty dataset");
+	num_input=d->num_input;
+	num_output=d->num_output;
+	for (a=0; a<anns_count; a++)
+		if (_fanns[anns[a]]->num_input!=num_input || _fanns[anns[a]]->num_output!=num_output)
+			return f2M_error(-32, anns[a], function, "dataset does not fit the network");
+
+	/* the batched kernel reads samples from contiguous rows */
+	chunks=((int) d->num_data+F2M_SENSITIVITY_CHUNK-1)/F2M_SENSITIVITY_CHUNK;
+	inputs=(double*) f2M_malloc((size_t) d->num_data*num_input*sizeof(double));
+	targets=(double*) f2M_malloc((size_t) d->num_data*num_output*sizeof(double));
+	partial=(double*) f2M_calloc((size_t) anns_count*chunks*(num_input+1)*sizeof(double));
+	if (mode==F2M_SENSITIVITY_PERMUTATION) perm=(int*) f2M_malloc(d->num_data*sizeof(int));
+	if (inputs==NULL || targets==NULL || partial==NULL || (mode==F2M_SENSITIVITY_PERMUTATION && perm==NULL) ||
+		f2M_data_gather(d, inputs, targets)!=0) {
+		ret=f2M_error(-31, anns[0], function, "out of memory");
+		goto cleanup;
+	}
+
+	/* the same permutation for every input and every run */
+	if (perm!=NULL) {
+		for (i=0; i<(int) d->num_data; i++) perm[i]=i;
+		for (i=(int) d->num_data-1; i>0; i--) {
+			j=(int) (f2M_random(0, 0, i)*(i+1));
+			t=perm[i];
+			perm[i]=perm[j];
+			perm[j]=t;
+		}
+	}
+
+	f2M_inference_enter();
+	try {
+		parallel_for(blocked_range<size_t>(0, (size_t) anns_count*chunks, 1),
+		             Apply_sensitivity(anns, mode, (int) d->num_data, inputs, targets, perm, partial, &failed),
+		             auto_partitioner());
+	} catch (...) {
+		ret=f2M_error(-5, -1, function, "parallel execution failed");
+	}
+	f2M_inference_leave();
+
+	if (ret==0 && failed>=0) ret=f2M_error(-10, (int) failed, function, "network failed to run");
+	if (ret!=0) goto cleanup;
+
+	/* means over the samples, the increase of the MSE for permutations */
+	for (a=0; a<anns_count; a++) {
+		for (i=0; i<(int) num_input; i++) importance[a*num_input+i]=0;
+		for (c=0; c<chunks; c++) {
+			p=partial+((size_t) a*chunks+c)*(num_input+1);
+			for (i=0; i<(int) num_input; i++)
+				importance[a*num_input+i]+=(mode==F2M_SENSITIVITY_GRADIENT ? p[i] : p[i]-p[num_input]);
+		}
+		for (i=0; i<(int) num_input; i++)
+			importance[a*num_input+i]/=(mode==F2M_SENSITIVITY_GRADIENT ? (double) d->num_data : (double) d->num_data*num_output);
+	}
+
+cleanup:
+	f2M_free(inputs);
+	f2M_free(targets);
+	f2M_free(partial);
+	f2M_free(perm);
+	return ret;
+}
+
+/**
+ * Measures the importance of every input of a network over a dataset in parallel using Intel TBB
+ *  ann - network handler returned by f2M_create*
+ *  data - dataset handler returned by f2M_data_*
+ *  mode - F2M_SENSITIVITY_GRADIENT: the mean over the samples of the absolute
+ *    derivatives of the outputs with respect to the input, summed over the
+ *    outputs, in the units of the raw inputs and outputs;
+ *    F2M_SENSITIVITY_PERMUTATION: the increase of the MSE (see f2M_test_data())
+ *    when the values of the input are shuffled among the samples
+ *  *importance - num_input array receiving the importance of every input
+ * Returns:
+ *  0 on success, <0 on error
+ * Note:
+ *  Gradients of inputs of different units are comparable once multiplied by
+ *  the standard deviations of the inputs. The permutation is the same on
+ *  every call, so the results are reproducible.
+ */
+FANN2MQL_API int __stdcall f2M_input_sensitivity(int ann, int data, int mode, double *importance)
+{
+	AnnPin pin;
+
+	if (!_TBB_Initialized) return f2M_error(-1, ann, __FUNCTION__, "f2M_parallel_init() was not called");
+
+	/* this network is not allocated */
+	if (!pin.acquire(ann)) return f2M_error_handle(-12, ann, __FUNCTION__);
+
+	/* not accepting bogus arguments */
+	if (importance==NULL || (mode!=F2M_SENSITIVITY_GRADIENT && mode!=F2M_SENSITIVITY_PERMUTATION))
+		return f2M_error(-2, ann, __FUNCTION__, "invalid arguments");
+
+	return f2M_sensitivity(1, &ann, data, mode, importance, __FUNCTION__);
+}
+
+/**
+ * Measures the importance of the inputs of many networks over a dataset in parallel using Intel TBB
+ *  anns_count - number of networks, all with the numbers of inputs and outputs of the dataset
+ *  anns[] - network handlers returned by f2M_create*
+ *  data - dataset handler returned by f2M_data_*
+ *  mode - see f2M_input_sensitivity()
+ *  *importance - anns_count*num_input array receiving the importance of the
+ *    inputs, network after network
+ * Returns:
+ *  0 on success, <0 on error
+ */
+FANN2MQL_API int __stdcall f2M_input_sensitivity_parallel(int anns_count, int *anns, int data, int mode, double *importance)
+{
+	int i, ret;
+
+	if (!_TBB_Initialized) return f2M_error(-1, -1, __FUNCTION__, "f2M_parallel_init() was not called");
+
+	/* not accepting bogus arguments */
+	if (anns==NULL || anns_count<1 || importance==NULL ||
+		(mode!=F2M_SENSITIVITY_GRADIENT && mode!=F2M_SENSITIVITY_PERMUTATION))
+		return f2M_error(-2, -1, __FUNCTION__, "invalid arguments");
+
+	/* this network is not allocated, otherwise loaded and kept in memory */
+	if ((i=f2M_acquire_all(anns_count, anns))>=0) return f2M_error_handle(-12, anns[i], __FUNCTION__);
+
+	ret=f2M_sensitivity(anns_count, anns, data, mode, importance, __FUNCTION__);
+	f2M_release_all(anns_count, anns);
+
+	return ret;
+}
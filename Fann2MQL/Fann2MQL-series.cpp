@@ -0,0 +1,188 @@
+/* Fann2MQL-series.cpp
+ *
+ * Copyright (C) 2008-2009 Mariusz Woloszyn
+ *
+ *  This file is part of Fann2MQL package
+ *
+ *  Fann2MQL is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Fann2MQL is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Fann2MQL; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include "stdafx.h"
+#include "Fann2MQL.h"
+#include "doublefann.h"
+#include "fann_internal.h"
+#include "windows.h"
+#include <math.h>
+
+#include "tbb/blocked_range.h"
+#include "tbb/parallel_for.h"
+
+using namespace tbb;
+
+/* Signals of a whole price history.
+ * An expert advisor in the strategy tester builds its inputs from the last
+ * bars and calls f2M_run() on every tick, millions of times per optimisation.
+ * Here the inputs of every bar are built natively from the price history and
+ * the network is run on blocks of bars by the batched kernel, chunks of bars
+ * in parallel; the expert advisor only indexes the signals of the bar.
+ */
+
+/* number of bars processed by a single task */
+#define F2M_SERIES_CHUNK	1024
+
+/* Returns the number of bars before the first one having all its inputs
+ *  feature_spec - F2M_FEATURE_*
+ *  window - number of inputs
+ */
+int f2M_series_history(int feature_spec, int window)
+{
+	return (feature_spec==F2M_FEATURE_DIFFS || feature_spec==F2M_FEATURE_LOG_RETURNS) ? window : window-1;
+}
+
+/* Builds the inputs of a bar, oldest first
+ *  feature_spec - F2M_FEATURE_*
+ *  *prices - price history, oldest bar first
+ *  t - the bar, at least f2M_series_history() bars from the start
+ *  window - number of inputs
+ *  *x - receives window inputs
+ */
+void f2M_series_features(int feature_spec, double *prices, int t, int window, double *x)
+{
+	double *p=prices+t-window+1;
+	int i;
+
+	switch (feature_spec) {
+	case F2M_FEATURE_PRICES:
+		for (i=0; i<window; i++) x[i]=p[i];
+		break;
+	case F2M_FEATURE_DIFFS:
+		for (i=0; i<window; i++) x[i]=p[i]-p[i-1];
+		break;
+	case F2M_FEATURE_LOG_RETURNS:
+		for (i=0; i<window; i++) x[i]=log(p[i]/p[i-1]);
+		break;
+	case F2M_FEATURE_RELATIVE:
+		for (i=0; i<window; i++) x[i]=p[i]/prices[t]-1;
+		break;
+	}
+}
+
+/* Intel TBB paralelized class used by f2M_run_series() */
+class Apply_series {
+	struct fann *ann;
+	double *prices;
+	int n_bars;
+	int window;
+	int feature_spec;
+	double *signals;
+	volatile LONG *failed;
+public:
+	void operator()( const blocked_range<size_t>& r ) const {
+		int num_input=(int) ann->num_input, num_output=(int) ann->num_output;
+		int history=f2M_series_history(feature_spec, window);
+		double *values, *features;
+		size_t chunk;
+		int t, end, b, n;
+
+		values=(double*) f2M_malloc((f2M_batch_scratch_size(ann)+F2M_BATCH*num_input)*sizeof(double));
+		if (values==NULL) {
+			InterlockedExchange(failed, 1);
+			return;
+		}
+		features=values+f2M_batch_scratch_size(ann);
+
+		for (chunk=r.begin(); chunk!=r.end(); chunk++) {
+			t=(int) chunk*F2M_SERIES_CHUNK;
+			end=t+F2M_SERIES_CHUNK<n_bars ? t+F2M_SERIES_CHUNK : n_bars;
+
+			/* bars without enough history */
+			for (; t<end && t<history; t++)
+				for (b=0; b<num_output; b++) signals[t*num_output+b]=DOUBLE_ERROR;
+
+			/* consecutive bars, so their outputs are consecutive rows of signals */
+			for (; t<end; t+=n) {
+				n=end-t<F2M_BATCH ? end-t : F2M_BATCH;
+				for (b=0; b<n; b++)
+					f2M_series_features(feature_spec, prices, t+b, window, features+b*num_input);
+				f2M_run_batch(ann, NULL, n, features, signals+t*num_output, values, NULL);
+			}
+		}
+
+		f2M_free(values);
+	}
+	Apply_series(struct fann *a, double *p, int nb, int w, int fs, double *s, volatile LONG *fl) :
+		ann(a), prices(p), n_bars(nb), window(w), feature_spec(fs), signals(s), failed(fl)
+	{}
+};
+
+/**
+ * Computes the signals of a network for every bar of a price history in parallel using Intel TBB
+ *  ann - network handler returned by f2M_create*
+ *  *prices - n_bars prices, oldest bar first
+ *  n_bars - number of bars
+ *  window - number of inputs built for every bar, must be the number of inputs of the network
+ *  feature_spec - how the inputs of a bar are built from the window of prices ending at it:
+ *    F2M_FEATURE_PRICES the prices themselves,
+ *    F2M_FEATURE_DIFFS differences to the previous price,
+ *    F2M_FEATURE_LOG_RETURNS logarithms of the ratio to the previous price,
+ *    F2M_FEATURE_RELATIVE ratios to the price of the bar minus 1
+ *  *signals - n_bars*num_output array receiving the outputs of every bar;
+ *    bars without enough history (the first window-1 bars, or window bars for
+ *    differences and returns) receive DOUBLE_ERROR
+ * Returns:
+ *  0 on success, <0 on error
+ * Note:
+ *  The outputs are those f2M_run() returns for the same inputs, scaling and
+ *  fast math included. The outputs of the network (f2M_get_output()) are not
+ *  changed.
+ */
+FANN2MQL_API int __stdcall f2M_run_series(int ann, double *prices, int n_bars, int window, int feature_spec, double *signals)
+{
+	struct fann *f;
+	int phase, chunks, ret=0;
+	volatile LONG failed=0;
+	AnnPin pin;
+
+	if (!_TBB_Initialized) return f2M_error(-1, ann, __FUNCTION__, "f2M_parallel_init() was not called");
+
+	/* this network is not allocated */
+	if (!pin.acquire(ann)) return f2M_error_handle(-12, ann, __FUNCTION__);
+
+	/* not accepting bogus arguments */
+	if (prices==NULL || signals==NULL || n_bars<1) return f2M_error(-30, ann, __FUNCTION__, "prices or signals are NULL");
+	if (feature_spec<F2M_FEATURE_PRICES || feature_spec>F2M_FEATURE_RELATIVE)
+		return f2M_error(-31, ann, __FUNCTION__, "unknown feature specification");
+
+	chunks=(n_bars+F2M_SERIES_CHUNK-1)/F2M_SERIES_CHUNK;
+	f=f2M_read_lock(ann, &phase);
+	if (f==NULL || window!=(int) f->num_input) {
+		f2M_read_unlock(ann, phase);
+		return f2M_error(-32, ann, __FUNCTION__, "window is not the number of inputs of the network");
+	}
+
+	f2M_inference_enter();
+	try {
+		parallel_for(blocked_range<size_t>(0, chunks),
+		             Apply_series(f, prices, n_bars, window, feature_spec, signals, &failed), auto_partitioner());
+	} catch (...) {
+		ret=f2M_error(-5, ann, __FUNCTION__, "parallel execution failed");
+	}
+	f2M_inference_leave();
+	f2M_read_unlock(ann, phase);
+
+	if (ret==0 && failed) ret=f2M_error(-4, ann, __FUNCTION__, "out of memory");
+
+	return ret;
+}
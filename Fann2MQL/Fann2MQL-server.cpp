@@ -0,0 +1,616 @@
+/* Fann2MQL-server.cpp
+ *
+ * Copyright (C) 2008-2009 Mariusz Woloszyn
+ *
+ *  This file is part of Fann2MQL package
+ *
+ *  Fann2MQL is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Fann2MQL is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Fann2MQL; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include "stdafx.h"
+#include "Fann2MQL.h"
+#include "doublefann.h"
+#include "fann_internal.h"
+#include "windows.h"
+#include <stdio.h>
+
+/* Local model server.
+ * One process (a terminal or any host loading the DLL) calls f2M_server_start()
+ * and keeps the networks; other processes call f2M_client_connect() and from
+ * then on f2M_create_from_file() returns proxy handlers whose f2M_run() is
+ * executed by the server thread pool. Requests go through a ring of slots in
+ * a named shared memory section, signalled by a named semaphore (server side)
+ * and per slot named events (client side). Networks loaded from the same path
+ * are shared by all clients. A client giving up on a request being executed
+ * leaves its slot abandoned, the server frees it when done.
+ * The server publishes its process id in the section. Clients keep a handle
+ * of that process and fail at once when it is gone, and a new server takes
+ * over a section left behind by a dead one.
+ */
+
+/* slot states */
+#define F2M_SLOT_FREE		0
+#define F2M_SLOT_CLAIMED	1
+#define F2M_SLOT_REQUEST	2
+#define F2M_SLOT_BUSY		3
+#define F2M_SLOT_DONE		4
+#define F2M_SLOT_ABANDONED	5	/* the client timed out, freed by the server when done */
+
+/* requests */
+#define F2M_OP_LOAD		1
+#define F2M_OP_UNLOAD	2
+#define F2M_OP_RUN		3
+
+#define F2M_SERVER_MAGIC	0x4d324646
+/* number of polls before a client waits for its event */
+#define F2M_SERVER_SPIN		2000
+/* milliseconds a client waits for the server */
+#define F2M_SERVER_TIMEOUT	5000
+
+/* header of the shared memory section */
+typedef struct sSH {
+	LONG magic;
+	LONG slots;
+	LONG io;
+	DWORD pid;		/* process id of the server */
+} serverHeader;
+
+/* single request slot */
+typedef struct sSS {
+	volatile LONG state;
+	LONG op;
+	LONG ann;		/* server side handler */
+	LONG count;		/* number of values in data */
+	LONG ret;
+	double data[F2M_SERVER_IO];	/* inputs, outputs or path */
+} serverSlot;
+
+/* shared memory section and its synchronisation objects, server or client side */
+typedef struct sCN {
+	HANDLE mapping;
+	serverHeader *header;
+	serverSlot *slots;
+	HANDLE requests;		/* semaphore counting requests */
+	HANDLE done[F2M_SERVER_SLOTS];	/* events signalling finished requests */
+	HANDLE process;		/* client side, the server process */
+	DWORD pid;			/* client side, process id of the server connected to */
+} serverConnection;
+
+/* proxy handlers, NULL for local networks */
+remoteData* _remote[ANNMAX];
+
+/* server side */
+serverConnection _server;
+HANDLE _server_threads[F2M_MAX_THREADS];
+int _server_nthreads=0;
+volatile LONG _server_quit=0;
+/* paths and reference counts of networks loaded by clients */
+char* _server_paths[ANNMAX];
+int _server_refs[ANNMAX];
+CRITICAL_SECTION _server_cs;
+
+/* client side */
+serverConnection _client;
+int _client_connected=0;
+
+/* Opens or creates the shared memory section and synchronisation objects */
+static int f2M_server_open(serverConnection *c, char *name, int create)
+{
+	char objname[MAX_PATH];
+	DWORD size=sizeof(serverHeader)+F2M_SERVER_SLOTS*sizeof(serverSlot);
+	int i;
+
+	memset(c, 0, sizeof(serverConnection));
+
+	_snprintf(objname, sizeof(objname)-1, "Local\\Fann2MQL_%s", name);
+	objname[sizeof(objname)-1]=0;
+	if (create)
+		c->mapping=CreateFileMappingA(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE, 0, size, objname);
+	else
+		c->mapping=OpenFileMappingA(FILE_MAP_ALL_ACCESS, FALSE, objname);
+	if (c->mapping==NULL) return -1;
+
+	c->header=(serverHeader*) MapViewOfFile(c->mapping, FILE_MAP_ALL_ACCESS, 0, 0, size);
+	if (c->header==NULL) return -1;
+	c->slots=(serverSlot*) (c->header+1);
+
+	_snprintf(objname, sizeof(objname)-1, "Local\\Fann2MQL_%s_requests", name);
+	c->requests=CreateSemaphoreA(NULL, 0, F2M_SERVER_SLOTS, objname);
+	if (c->requests==NULL) return -1;
+
+	for (i=0; i<F2M_SERVER_SLOTS; i++) {
+		_snprintf(objname, sizeof(objname)-1, "Local\\Fann2MQL_%s_done_%d", name, i);
+		c->done[i]=CreateEventA(NULL, FALSE, FALSE, objname);
+		if (c->done[i]==NULL) return -1;
+	}
+
+	return 0;
+}
+
+/* Closes the shared memory section and synchronisation objects */
+static void f2M_server_close(serverConnection *c)
+{
+	int i;
+
+	for (i=0; i<F2M_SERVER_SLOTS; i++)
+		if (c->done[i]!=NULL) CloseHandle(c->done[i]);
+	if (c->process!=NULL) CloseHandle(c->process);
+	if (c->requests!=NULL) CloseHandle(c->requests);
+	if (c->header!=NULL) UnmapViewOfFile(c->header);
+	if (c->mapping!=NULL) CloseHandle(c->mapping);
+	memset(c, 0, sizeof(serverConnection));
+}
+
+/* Returns nonzero if the process with a given id is running */
+static int f2M_process_running(DWORD pid)
+{
+	HANDLE process=OpenProcess(SYNCHRONIZE, FALSE, pid);
+	int running;
+
+	/* no such process, otherwise it exists but may not be waited for */
+	if (process==NULL) return (GetLastError()!=ERROR_INVALID_PARAMETER);
+
+	running=(WaitForSingleObject(process, 0)==WAIT_TIMEOUT);
+	CloseHandle(process);
+	return running;
+}
+
+/* Returns nonzero if the server a client connected to still serves the section */
+static int f2M_client_server_alive()
+{
+	return (_client.header->magic==F2M_SERVER_MAGIC && _client.header->pid==_client.pid &&
+			WaitForSingleObject(_client.process, 0)==WAIT_TIMEOUT);
+}
+
+/* Executes a single request on the server side */
+static void f2M_server_execute(serverSlot *slot)
+{
+	struct fann *f;
+	double *values;
+	char *path;
+	int ann, phase;
+
+	switch (slot->op) {
+	case F2M_OP_LOAD:
+		path=(char*) slot->data;
+		path[sizeof(slot->data)-1]=0;
+		/* the host may create and destroy networks meanwhile */
+		EnterCriticalSection(&_server_cs);
+		f2M_handles_lock();
+		for (ann=0; ann<=_ann; ann++)
+			if (_server_paths[ann]!=NULL && _fanns[ann]!=NULL && strcmp(_server_paths[ann], path)==0) break;
+		if (ann>_ann) {
+			ann=f2M_create_from_file(path);
+			if (ann>=0) {
+				_server_paths[ann]=(char*) f2M_malloc(strlen(path)+1);
+				if (_server_paths[ann]!=NULL) strcpy(_server_paths[ann], path);
+				_server_refs[ann]=0;
+			}
+		}
+		if (ann>=0) {
+			_server_refs[ann]++;
+			slot->data[0]=_fanns[ann]->num_input;
+			slot->data[1]=_fanns[ann]->num_output;
+		}
+		f2M_handles_unlock();
+		LeaveCriticalSection(&_server_cs);
+		slot->ret=ann;
+		break;
+
+	case F2M_OP_UNLOAD:
+		ann=slot->ann;
+		slot->ret=-1;
+		EnterCriticalSection(&_server_cs);
+		f2M_handles_lock();
+		if (ann>=0 && ann<=_ann && _fanns[ann]!=NULL && _server_refs[ann]>0) {
+			if (--_server_refs[ann]==0) {
+				f2M_free(_server_paths[ann]);
+				_server_paths[ann]=NULL;
+				f2M_destroy(ann);
+			}
+			slot->ret=0;
+		}
+		f2M_handles_unlock();
+		LeaveCriticalSection(&_server_cs);
+		break;
+
+	case F2M_OP_RUN:
+		ann=slot->ann;
+		if (ann<0 || ann>_ann || _fanns[ann]==NULL || _server_refs[ann]<=0) {
+			slot->ret=-2;
+			break;
+		}
+		f=f2M_read_lock(ann, &phase);
+		if (f==NULL) {
+			f2M_read_unlock(ann, phase);
+			slot->ret=-2;
+			break;
+		}
+		if ((int) f->num_input!=slot->count) {
+			f2M_read_unlock(ann, phase);
+			slot->ret=-3;
+			break;
+		}
+		values=(double*) f2M_malloc(f2M_batch_scratch_size(f)*sizeof(double));
+		if (values==NULL) {
+			f2M_read_unlock(ann, phase);
+			slot->ret=-4;
+			break;
+		}
+		/* outputs overwrite the inputs, these are consumed first */
+		f2M_run_batch(f, NULL, 1, slot->data, slot->data, values, NULL);
+		slot->count=f->num_output;
+		f2M_read_unlock(ann, phase);
+		f2M_free(values);
+		slot->ret=0;
+		break;
+
+	default:
+		slot->ret=-1;
+	}
+}
+
+/* Server worker thread */
+DWORD WINAPI f2M_server_loop(LPVOID lpParam)
+{
+	int i, start=(int) (INT_PTR) lpParam;
+
+	while (1) {
+		WaitForSingleObject(_server.requests, INFINITE);
+		if (_server_quit) break;
+
+		/* one wake up for one request */
+		for (i=0; i<F2M_SERVER_SLOTS; i++) {
+			serverSlot *slot=&_server.slots[(start+i)%F2M_SERVER_SLOTS];
+			if (InterlockedCompareExchange(&slot->state, F2M_SLOT_BUSY, F2M_SLOT_REQUEST)==F2M_SLOT_REQUEST) {
+				f2M_server_execute(slot);
+				if (InterlockedCompareExchange(&slot->state, F2M_SLOT_DONE, F2M_SLOT_BUSY)==F2M_SLOT_ABANDONED) {
+					/* nobody waits for the result, a network loaded for nobody is released */
+					if (slot->op==F2M_OP_LOAD && slot->ret>=0) {
+						slot->op=F2M_OP_UNLOAD;
+						slot->ann=slot->ret;
+						f2M_server_execute(slot);
+					}
+					InterlockedExchange(&slot->state, F2M_SLOT_FREE);
+				} else {
+					SetEvent(_server.done[(start+i)%F2M_SERVER_SLOTS]);
+				}
+				break;
+			}
+		}
+	}
+
+	return 0;
+}
+
+/**
+ * Starts the model server in this process
+ *  *name - server name, unique in the user session
+ *  threads - number of inference threads
+ * Returns:
+ *  0 on success, <0 on error
+ */
+FANN2MQL_API int __stdcall f2M_server_start(char *name, int threads)
+{
+	int i;
+
+	/* already running */
+	if (_server_nthreads>0) return f2M_error(-1, -1, __FUNCTION__, "server already running in this process");
+
+	if (name==NULL || threads<1) return f2M_error(-2, -1, __FUNCTION__, "invalid arguments");
+	threads=threads>F2M_MAX_THREADS?F2M_MAX_THREADS:threads;
+
+	if (f2M_server_open(&_server, name, 1)!=0 ||
+		(_server.header->magic==F2M_SERVER_MAGIC && f2M_process_running(_server.header->pid))) {
+		/* another server with this name */
+		f2M_server_close(&_server);
+		return f2M_error(-3, -1, __FUNCTION__, "another server with this name is running or the section can not be created");
+	}
+	/* a section left by a dead server is taken over, its clients see another pid */
+	InterlockedExchange(&_server.header->magic, 0);
+	_server.header->slots=F2M_SERVER_SLOTS;
+	_server.header->io=F2M_SERVER_IO;
+	_server.header->pid=GetCurrentProcessId();
+	for (i=0; i<F2M_SERVER_SLOTS; i++) _server.slots[i].state=F2M_SLOT_FREE;
+	InitializeCriticalSection(&_server_cs);
+
+	_server_quit=0;
+	for (i=0; i<threads; i++) {
+		_server_threads[i]=CreateThread(NULL, 0, f2M_server_loop, (LPVOID) (INT_PTR) i, 0, NULL);
+		if (_server_threads[i]==NULL) break;
+		_server_nthreads++;
+	}
+	if (_server_nthreads==0) {
+		f2M_error_system(-4, __FUNCTION__, "CreateThread");
+		DeleteCriticalSection(&_server_cs);
+		f2M_server_close(&_server);
+		return -4;
+	}
+
+	/* clients may connect now */
+	InterlockedExchange(&_server.header->magic, F2M_SERVER_MAGIC);
+	return 0;
+}
+
+/**
+ * Stops the model server and destroys the networks loaded by clients
+ * Returns:
+ *  0 on success, -1 if not running
+ */
+FANN2MQL_API int __stdcall f2M_server_stop()
+{
+	int i;
+
+	if (_server_nthreads==0) return f2M_error(-1, -1, __FUNCTION__, "server not running");
+
+	InterlockedExchange(&_server.header->magic, 0);
+	_server_quit=1;
+	ReleaseSemaphore(_server.requests, _server_nthreads, NULL);
+	WaitForMultipleObjects(_server_nthreads, _server_threads, TRUE, INFINITE);
+	for (i=0; i<_server_nthreads; i++) CloseHandle(_server_threads[i]);
+	_server_nthreads=0;
+
+	for (i=0; i<ANNMAX; i++) {
+		if (_server_paths[i]==NULL) continue;
+		f2M_free(_server_paths[i]);
+		_server_paths[i]=NULL;
+		_server_refs[i]=0;
+		f2M_destroy(i);
+	}
+
+	DeleteCriticalSection(&_server_cs);
+	f2M_server_close(&_server);
+	return 0;
+}
+
+/**
+ * Connects this process to a model server
+ *  *name - server name given to f2M_server_start()
+ * Returns:
+ *  0 on success, <0 on error
+ * Note:
+ *  Networks loaded by f2M_create_from_file() from now on live in the server.
+ *  Only f2M_run(), f2M_get_output(), f2M_get_num_input(), f2M_get_num_output()
+ *  and f2M_destroy() are available for them.
+ */
+FANN2MQL_API int __stdcall f2M_client_connect(char *name)
+{
+	if (_client_connected) return f2M_error(-1, -1, __FUNCTION__, "already connected");
+	if (name==NULL) return f2M_error(-2, -1, __FUNCTION__, "name is NULL");
+
+	if (f2M_server_open(&_client, name, 0)!=0 || _client.header->magic!=F2M_SERVER_MAGIC) {
+		f2M_server_close(&_client);
+		return f2M_error(-3, -1, __FUNCTION__, "no server with this name");
+	}
+
+	/* the server process is watched, a dead server fails requests at once */
+	_client.pid=_client.header->pid;
+	_client.process=OpenProcess(SYNCHRONIZE, FALSE, _client.pid);
+	if (_client.process==NULL || !f2M_client_server_alive()) {
+		f2M_server_close(&_client);
+		return f2M_error(-3, -1, __FUNCTION__, "server process is not running");
+	}
+
+	_client_connected=1;
+	return 0;
+}
+
+/**
+ * Disconnects from the model server
+ * Returns:
+ *  0 on success, -1 if not connected
+ * Note:
+ *  Proxy handlers must be destroyed before.
+ */
+FANN2MQL_API int __stdcall f2M_client_disconnect()
+{
+	if (!_client_connected) return f2M_error(-1, -1, __FUNCTION__, "not connected");
+
+	_client_connected=0;
+	f2M_server_close(&_client);
+	return 0;
+}
+
+/* Returns nonzero if f2M_create_from_file() should load networks on the server */
+int f2M_client_active()
+{
+	return _client_connected;
+}
+
+/* Gives up a request the server did not answer in time
+ * Returns:
+ *  nonzero if given up, 0 if the result arrived meanwhile
+ */
+static int f2M_client_abandon(serverSlot *slot)
+{
+	/* not taken by the server yet, withdrawn; the server thread woken for it finds nothing */
+	if (InterlockedCompareExchange(&slot->state, F2M_SLOT_FREE, F2M_SLOT_REQUEST)==F2M_SLOT_REQUEST) return 1;
+
+	/* being executed, the server frees the slot when done */
+	if (InterlockedCompareExchange(&slot->state, F2M_SLOT_ABANDONED, F2M_SLOT_BUSY)==F2M_SLOT_BUSY) return 1;
+
+	return 0;
+}
+
+/* Claims a slot, passes it to the server and waits for the result
+ * Returns:
+ *  slot with the result, NULL if the server did not answer
+ */
+static serverSlot* f2M_client_call(serverSlot *request, int bytes)
+{
+	serverSlot *slot;
+	HANDLE wait[2];
+	DWORD w;
+	int i, start, spin;
+
+	if (!_client_connected || !f2M_client_server_alive()) return NULL;
+
+	/* start looking for a free slot at different places in every thread */
+	start=(int) (GetCurrentThreadId()%F2M_SERVER_SLOTS);
+	for (spin=0; ; spin++) {
+		for (i=0; i<F2M_SERVER_SLOTS; i++)
+			if (InterlockedCompareExchange(&_client.slots[(start+i)%F2M_SERVER_SLOTS].state, F2M_SLOT_CLAIMED, F2M_SLOT_FREE)==F2M_SLOT_FREE)
+				break;
+		if (i<F2M_SERVER_SLOTS) break;
+		if (spin>F2M_SERVER_TIMEOUT || !f2M_client_server_alive()) return NULL;
+		Sleep(1);
+	}
+	i=(start+i)%F2M_SERVER_SLOTS;
+	slot=&_client.slots[i];
+	wait[0]=_client.done[i];
+	wait[1]=_client.process;
+
+	slot->op=request->op;
+	slot->ann=request->ann;
+	slot->count=request->count;
+	memcpy(slot->data, request->data, bytes);
+	InterlockedExchange(&slot->state, F2M_SLOT_REQUEST);
+	ReleaseSemaphore(_client.requests, 1, NULL);
+
+	/* most requests are short, poll a bit before going to sleep */
+	for (spin=0; spin<F2M_SERVER_SPIN && slot->state!=F2M_SLOT_DONE; spin++) YieldProcessor();
+	while (slot->state!=F2M_SLOT_DONE) {
+		/* the event may be left signalled by a previous request polled above */
+		w=WaitForMultipleObjects(2, wait, FALSE, F2M_SERVER_TIMEOUT);
+		if (w==WAIT_OBJECT_0 || slot->state==F2M_SLOT_DONE) continue;
+		/* the server is gone, a server taking over may have freed the slot already */
+		if (w==WAIT_OBJECT_0+1) {
+			f2M_client_abandon(slot);
+			return NULL;
+		}
+		if (f2M_client_abandon(slot)) return NULL;
+	}
+
+	return slot;
+}
+
+/* Releases a slot returned by f2M_client_call() */
+static void f2M_client_release_slot(serverSlot *slot)
+{
+	InterlockedExchange(&slot->state, F2M_SLOT_FREE);
+}
+
+/* Loads a network on the server and allocates a proxy handler for it
+ *  *path - path to .net file
+ * Returns:
+ *	handler to ann, -1 on error
+ */
+int f2M_client_create_from_file(char *path)
+{
+	serverSlot request, *slot;
+	remoteData *rd;
+	size_t len=strlen(path);
+	int handle;
+
+	/* too many networks allocated */
+	if (_ann>=ANNMAX-1) return f2M_error(-1, -1, "f2M_create_from_file", "too many networks");
+	if (len>=sizeof(request.data)) return f2M_error(-1, -1, "f2M_create_from_file", "path too long");
+
+	request.op=F2M_OP_LOAD;
+	request.ann=-1;
+	request.count=0;
+	memcpy(request.data, path, len+1);
+
+	slot=f2M_client_call(&request, (int) len+1);
+	if (slot==NULL) return f2M_error(-1, -1, "f2M_create_from_file", "server not responding");
+
+	rd=(remoteData*) f2M_calloc(sizeof(remoteData));
+	if (rd!=NULL) {
+		rd->ann=slot->ret;
+		rd->num_input=(int) slot->data[0];
+		rd->num_output=(int) slot->data[1];
+	}
+	f2M_client_release_slot(slot);
+
+	if (rd==NULL || rd->ann<0) {
+		f2M_free(rd);
+		return f2M_error(-1, -1, "f2M_create_from_file", "server failed to load the network");
+	}
+
+	/* allocate the handler for ann */
+	f2M_handles_lock();
+	if (_ann<ANNMAX-1) _outbufs[_ann+1]=(double*) f2M_calloc(rd->num_output*sizeof(double));
+	if (_ann>=ANNMAX-1 || _outbufs[_ann+1]==NULL) {
+		f2M_handles_unlock();
+		f2M_free(rd);
+		return f2M_error(-1, -1, "f2M_create_from_file", "too many networks or out of memory");
+	}
+	_ann++;
+	_remote[_ann]=rd;
+	_outputs[_ann]=NULL;
+	handle=_ann;
+	f2M_handles_unlock();
+
+	return handle;
+}
+
+/* Runs a proxy network on the server and stores its outputs
+ * Returns:
+ *  0 on success, <0 on error
+ */
+int f2M_client_run(int ann, double *input_vector)
+{
+	serverSlot request, *slot;
+	remoteData *rd=_remote[ann];
+	int ret;
+
+	if (rd->num_input>F2M_SERVER_IO || rd->num_output>F2M_SERVER_IO)
+		return f2M_error(-5, ann, "f2M_run", "network too large for the server");
+
+	request.op=F2M_OP_RUN;
+	request.ann=rd->ann;
+	request.count=rd->num_input;
+	memcpy(request.data, input_vector, rd->num_input*sizeof(double));
+
+	slot=f2M_client_call(&request, rd->num_input*sizeof(double));
+	if (slot==NULL) return f2M_error(-6, ann, "f2M_run", "server not responding");
+
+	ret=slot->ret;
+	if (ret==0) {
+		memcpy(_outbufs[ann], slot->data, rd->num_output*sizeof(double));
+		_outputs[ann]=_outbufs[ann];
+	}
+	f2M_client_release_slot(slot);
+
+	return ret;
+}
+
+/* Releases the server network of a proxy handler */
+void f2M_client_release(int ann)
+{
+	serverSlot request, *slot;
+
+	if (_remote[ann]==NULL) return;
+
+	request.op=F2M_OP_UNLOAD;
+	request.ann=_remote[ann]->ann;
+	request.count=0;
+	slot=f2M_client_call(&request, 0);
+	if (slot!=NULL) f2M_client_release_slot(slot);
+
+	f2M_free(_remote[ann]);
+	_remote[ann]=NULL;
+}
+
+/* Returns the number of inputs or outputs of a proxy network */
+int f2M_client_num_input(int ann)
+{
+	return _remote[ann]->num_input;
+}
+
+int f2M_client_num_output(int ann)
+{
+	return _remote[ann]->num_output;
+}
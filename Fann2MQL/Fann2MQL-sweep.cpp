@@ -0,0 +1,349 @@
+/* Fann2MQL-sweep.cpp
+ *
+ * Copyright (C) 2008-2009 Mariusz Woloszyn
+ *
+ *  This file is part of Fann2MQL package
+ *
+ *  Fann2MQL is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Fann2MQL is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Fann2MQL; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include "stdafx.h"
+#include "Fann2MQL.h"
+#include "doublefann.h"
+#include "fann_internal.h"
+#include "windows.h"
+#include <math.h>
+
+#include "tbb/blocked_range.h"
+#include "tbb/parallel_for.h"
+
+using namespace tbb;
+
+/* Single cross-validation job: one configuration trained on one fold */
+typedef struct sJD {
+	int config;
+	int fold;
+	struct fann *ann;
+	double val_mse;
+	int trained;		/* epochs trained in the current round */
+	int validated;		/* nonzero once val_mse is that of the current round */
+} sweepJobData;
+
+/* Intel TBB paralelized class used by f2M_sweep()
+ * A task preempted by inference ends between epochs, the jobs it did not
+ * finish are spawned again.
+ */
+class Apply_sweep_round {
+	sweepJobData **jobs;
+	struct fann_train_data **train;
+	struct fann_train_data **val;
+	int epochs;
+public:
+	void operator()( const blocked_range<size_t>& r ) const {
+		int prio=f2M_training_begin();
+		for( size_t i=r.begin(); i!=r.end(); ++i ) {
+			sweepJobData *job=jobs[i];
+			if (job->validated) continue;
+			for (; job->trained<epochs; job->trained++) {
+				/* let the inference go first, the worker is given back */
+				if (f2M_training_preempted()) {
+					f2M_training_end(prio);
+					return;
+				}
+				fann_train_epoch(job->ann, train[job->fold]);
+			}
+			job->val_mse=fann_test_data(job->ann, val[job->fold]);
+			job->validated=1;
+		}
+		f2M_training_end(prio);
+	}
+	Apply_sweep_round(sweepJobData **j, struct fann_train_data **t, struct fann_train_data **v, int e) :
+		jobs(j), train(t), val(v), epochs(e)
+	{}
+};
+
+/* Creates a network described by a sweep configuration */
+static struct fann* f2M_sweep_create(int *config, int num_input, int num_output)
+{
+	unsigned int layers[F2M_SWEEP_MAX_LAYERS];
+	unsigned int num_layers=config[0], i;
+	struct fann *ann;
+
+	if (num_layers<2 || num_layers>F2M_SWEEP_MAX_LAYERS) return NULL;
+
+	layers[0]=num_input;
+	for (i=1; i<num_layers-1; i++) {
+		if (config[i]<1) return NULL;
+		layers[i]=config[i];
+	}
+	layers[num_layers-1]=num_output;
+
+	ann=fann_create_standard_array(num_layers, layers);
+	if (ann==NULL) return NULL;
+
+	fann_set_activation_function_hidden(ann, (fann_activationfunc_enum) config[F2M_SWEEP_MAX_LAYERS-1]);
+	fann_set_activation_function_output(ann, (fann_activationfunc_enum) config[F2M_SWEEP_MAX_LAYERS]);
+	fann_set_training_algorithm(ann, (fann_train_enum) config[F2M_SWEEP_MAX_LAYERS+1]);
+
+	return ann;
+}
+
+/* Copies rows [first, last) of a dataset to a fann training data */
+static void f2M_sweep_copy_rows(struct fann_train_data *data, unsigned int at, int first, int last,
+								int num_input, int num_output, double *inputs, double *outputs)
+{
+	int i;
+
+	for (i=first; i<last; i++, at++) {
+		memcpy(data->input[at], inputs+i*num_input, num_input*sizeof(double));
+		memcpy(data->output[at], outputs+i*num_output, num_output*sizeof(double));
+	}
+}
+
+/**
+ * Runs k-fold cross-validation of many network configurations in parallel using Intel TBB
+ *  num_data - number of samples
+ *  num_input, num_output - number of inputs and outputs of every sample
+ *  *inputs - num_data*num_input array of inputs, sample after sample
+ *  *outputs - num_data*num_output array of desired outputs
+ *  k_folds - number of folds (consecutive blocks of samples), at least 2
+ *  num_configs - number of configurations
+ *  *configs - num_configs*F2M_SWEEP_CONFIG integers, for every configuration:
+ *    num_layers (including input and output layer, 2..F2M_SWEEP_MAX_LAYERS),
+ *    F2M_SWEEP_MAX_LAYERS-2 hidden layer sizes (unused ones are ignored),
+ *    hidden layers activation function, output layer activation function,
+ *    training algorithm
+ *  max_epoch - maximum number of epochs trained by every job
+ *  epochs_between_checks - epochs trained between validations
+ *  prune_ratio - after every validation the configurations with mean validation MSE
+ *    greater than prune_ratio times the best one are abandoned, 0 disables pruning;
+ *    otherwise at least 1, a smaller ratio would abandon the best one too
+ *  *results - num_configs*F2M_SWEEP_RESULT doubles, for every configuration:
+ *    mean validation MSE, its standard deviation across folds, epochs trained
+ *    and 1 if the configuration was pruned, 0 otherwise
+ *  *ranking - num_configs configuration indexes, best first; pruned ones are last
+ * Returns:
+ *  0 on success, <0 on error
+ */
+FANN2MQL_API int __stdcall f2M_sweep(int num_data, int num_input, int num_output, double *inputs, double *outputs,
+									 int k_folds, int num_configs, int *configs, int max_epoch, int epochs_between_checks,
+									 double prune_ratio, double *results, int *ranking)
+{
+	struct fann_train_data **train=NULL, **val=NULL;
+	sweepJobData *jobs=NULL, **live=NULL;
+	int num_jobs, num_live, epoch, epochs, i, j, c, f, first, last, ret=0;
+	double best, mse, *r;
+	size_t grain;
+
+	if (!_TBB_Initialized) return f2M_error(-1, -1, __FUNCTION__, "f2M_parallel_init() was not called");
+
+	/* not accepting bogus arguments */
+	if (inputs==NULL || outputs==NULL || configs==NULL || results==NULL || ranking==NULL)
+		return f2M_error(-2, -1, __FUNCTION__, "invalid arguments");
+	if (num_input<1 || num_output<1 || num_configs<1 || k_folds<2 || num_data<k_folds)
+		return f2M_error(-3, -1, __FUNCTION__, "invalid sizes or fewer rows than folds");
+	if (max_epoch<1 || epochs_between_checks<1)
+		return f2M_error(-3, -1, __FUNCTION__, "invalid number of epochs");
+	if (prune_ratio!=0 && !(prune_ratio>=1))
+		return f2M_error(-3, -1, __FUNCTION__, "prune ratio must be 0 or at least 1");
+
+	num_jobs=num_configs*k_folds;
+	train=(struct fann_train_data**) f2M_calloc(k_folds*sizeof(struct fann_train_data*));
+	val=(struct fann_train_data**) f2M_calloc(k_folds*sizeof(struct fann_train_data*));
+	jobs=(sweepJobData*) f2M_calloc(num_jobs*sizeof(sweepJobData));
+	live=(sweepJobData**) f2M_calloc(num_jobs*sizeof(sweepJobData*));
+	if (train==NULL || val==NULL || jobs==NULL || live==NULL) {
+		ret=f2M_error(-4, -1, __FUNCTION__, "out of memory");
+		goto cleanup;
+	}
+
+	/* fold f validates on samples [first, last) and trains on all the others */
+	for (f=0; f<k_folds; f++) {
+		first=(int) ((__int64) num_data*f/k_folds);
+		last=(int) ((__int64) num_data*(f+1)/k_folds);
+		val[f]=fann_create_train(last-first, num_input, num_output);
+		train[f]=fann_create_train(num_data-(last-first), num_input, num_output);
+		if (val[f]==NULL || train[f]==NULL) {
+			ret=f2M_error(-4, -1, __FUNCTION__, "out of memory");
+			goto cleanup;
+		}
+		f2M_sweep_copy_rows(val[f], 0, first, last, num_input, num_output, inputs, outputs);
+		f2M_sweep_copy_rows(train[f], 0, 0, first, num_input, num_output, inputs, outputs);
+		f2M_sweep_copy_rows(train[f], first, last, num_data, num_input, num_output, inputs, outputs);
+	}
+
+	/* networks are created upfront, fann_create_* is not thread safe */
+	for (c=0; c<num_configs; c++) {
+		r=results+c*F2M_SWEEP_RESULT;
+		r[0]=DOUBLE_ERROR;
+		r[1]=0;
+		r[2]=0;
+		r[3]=0;
+		for (f=0; f<k_folds; f++) {
+			jobs[c*k_folds+f].config=c;
+			jobs[c*k_folds+f].fold=f;
+			jobs[c*k_folds+f].ann=f2M_sweep_create(configs+c*F2M_SWEEP_CONFIG, num_input, num_output);
+			if (jobs[c*k_folds+f].ann==NULL) {
+				ret=f2M_error(-5, -1, __FUNCTION__, "network of a configuration could not be created");
+				goto cleanup;
+			}
+			/* FANN seeds its initial weights from the clock */
+			if (f2M_deterministic())
+				f2M_randomize_fann(jobs[c*k_folds+f].ann, f2M_base_seed(), c*k_folds+f, 0, -0.1, 0.1);
+			live[c*k_folds+f]=&jobs[c*k_folds+f];
+		}
+	}
+	num_live=num_jobs;
+
+	for (epoch=0; epoch<max_epoch && num_live>0; epoch+=epochs) {
+		epochs=max_epoch-epoch<epochs_between_checks ? max_epoch-epoch : epochs_between_checks;
+
+		/* parallel the work, on a part of the processors if capped, spawned
+		 * again until every job is validated, waiting for inference in between */
+		for (i=0; i<num_live; i++) {
+			live[i]->trained=0;
+			live[i]->validated=0;
+		}
+		grain=f2M_training_grain(num_live);
+		do {
+			f2M_training_yield();
+			if (grain>0)
+				parallel_for(blocked_range<size_t>(0, num_live, grain),
+				             Apply_sweep_round(live, train, val, epochs), simple_partitioner());
+			else
+				parallel_for(blocked_range<size_t>(0, num_live),
+				             Apply_sweep_round(live, train, val, epochs), auto_partitioner());
+			for (i=0, j=0; i<num_live; i++)
+				if (!live[i]->validated) j=1;
+		} while (j);
+
+		/* reduce the folds of every live configuration */
+		best=-1;
+		for (i=0; i<num_live; i+=k_folds) {
+			r=results+live[i]->config*F2M_SWEEP_RESULT;
+			mse=0;
+			for (j=0; j<k_folds; j++) mse+=live[i+j]->val_mse;
+			r[0]=mse/k_folds;
+			mse=0;
+			for (j=0; j<k_folds; j++) mse+=(live[i+j]->val_mse-r[0])*(live[i+j]->val_mse-r[0]);
+			r[1]=sqrt(mse/k_folds);
+			r[2]=epoch+epochs;
+			if (best<0 || r[0]<best) best=r[0];
+		}
+
+		/* abandon the hopeless configurations, keeping folds of a configuration together */
+		if (prune_ratio>0) {
+			for (i=0, j=0; i<num_live; i+=k_folds) {
+				r=results+live[i]->config*F2M_SWEEP_RESULT;
+				if (r[0]>best*prune_ratio) {
+					r[3]=1;
+					continue;
+				}
+				for (f=0; f<k_folds; f++) live[j++]=live[i+f];
+			}
+			num_live=j;
+		}
+	}
+
+	/* rank: not pruned first, then by mean validation MSE */
+	for (c=0; c<num_configs; c++) ranking[c]=c;
+	for (i=1; i<num_configs; i++) {
+		c=ranking[i];
+		r=results+c*F2M_SWEEP_RESULT;
+		for (j=i-1; j>=0; j--) {
+			double *q=results+ranking[j]*F2M_SWEEP_RESULT;
+			if (q[3]<r[3] || (q[3]==r[3] && q[0]<=r[0])) break;
+			ranking[j+1]=ranking[j];
+		}
+		ranking[j+1]=c;
+	}
+
+cleanup:
+	if (jobs!=NULL)
+		for (i=0; i<num_jobs; i++)
+			if (jobs[i].ann!=NULL) fann_destroy(jobs[i].ann);
+	for (f=0; f<k_folds && train!=NULL && val!=NULL; f++) {
+		if (train[f]!=NULL) fann_destroy_train(train[f]);
+		if (val[f]!=NULL) fann_destroy_train(val[f]);
+	}
+	if (train!=NULL) f2M_free(train);
+	if (val!=NULL) f2M_free(val);
+	if (jobs!=NULL) f2M_free(jobs);
+	if (live!=NULL) f2M_free(live);
+
+	return ret;
+}
+
+/**
+ * Draws random configurations for f2M_sweep()
+ *  num_configs - number of configurations to draw
+ *  *lo, *hi - F2M_SWEEP_CONFIG integers each; every field of a configuration is
+ *    drawn uniformly from [lo, hi], use lo==hi to fix a field
+ *  seed - random seed
+ *  *configs - num_configs*F2M_SWEEP_CONFIG integers receiving the configurations
+ * Returns:
+ *  0 on success, <0 on error
+ */
+FANN2MQL_API int __stdcall f2M_sweep_random_configs(int num_configs, int *lo, int *hi, int seed, int *configs)
+{
+	unsigned int state=(unsigned int) seed;
+	int c, i;
+
+	/* not accepting bogus arguments */
+	if (lo==NULL || hi==NULL || configs==NULL || num_configs<1) return f2M_error(-1, -1, __FUNCTION__, "invalid arguments");
+	for (i=0; i<F2M_SWEEP_CONFIG; i++)
+		if (hi[i]<lo[i]) return f2M_error(-2, -1, __FUNCTION__, "upper bound below the lower bound");
+
+	for (c=0; c<num_configs; c++) {
+		for (i=0; i<F2M_SWEEP_CONFIG; i++) {
+			state=state*1103515245+12345;
+			configs[c*F2M_SWEEP_CONFIG+i]=lo[i]+(int) ((state>>8)%(unsigned int) (hi[i]-lo[i]+1));
+		}
+	}
+
+	return 0;
+}
+
+/**
+ * Selects a network configuration on a dataset handle, see f2M_sweep()
+ *  data - dataset handler returned by f2M_data_*
+ * Returns:
+ *  0 on success, <0 on error
+ */
+FANN2MQL_API int __stdcall f2M_sweep_data(int data, int k_folds, int num_configs, int *configs, int max_epoch,
+										  int epochs_between_checks, double prune_ratio, double *results, int *ranking)
+{
+	DataPin data_pin;
+	struct fann_train_data *d=data_pin.acquire(data);
+	double *inputs, *outputs;
+	int ret;
+
+	if (d==NULL) return f2M_error(-2, -1, __FUNCTION__, "invalid dataset handler");
+
+	/* the folds are copied from contiguous rows */
+	inputs=(double*) f2M_malloc((size_t) d->num_data*d->num_input*sizeof(double));
+	outputs=(double*) f2M_malloc((size_t) d->num_data*d->num_output*sizeof(double));
+	if (inputs==NULL || outputs==NULL || f2M_data_gather(d, inputs, outputs)!=0) {
+		f2M_free(inputs);
+		f2M_free(outputs);
+		return f2M_error(-4, -1, __FUNCTION__, "out of memory");
+	}
+
+	ret=f2M_sweep((int) d->num_data, (int) d->num_input, (int) d->num_output, inputs, outputs, k_folds,
+				  num_configs, configs, max_epoch, epochs_between_checks, prune_ratio, results, ranking);
+	f2M_free(inputs);
+	f2M_free(outputs);
+	return ret;
+}
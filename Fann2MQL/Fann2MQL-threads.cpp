@@ -1,577 +1,680 @@
-/* Fann2MQL-threads.cpp
- *
- * Copyright (C) 2008-2009 Mariusz Woloszyn
- *
- *  This file is part of Fann2MQL package
- *
- *  Fann2MQL is free software; you can redistribute it and/or modify
- *  it under the terms of the GNU General Public License as published by
- *  the Free Software Foundation; either version 2 of the License, or
- *  (at your option) any later version.
- *
- *  Fann2MQL is distributed in the hope that it will be useful,
- *  but WITHOUT ANY WARRANTY; without even the implied warranty of
- *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
- *  GNU General Public License for more details.
- *
- *  You should have received a copy of the GNU General Public License
- *  along with Fann2MQL; if not, write to the Free Software
- *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
- */
-
-#include "stdafx.h"
-#include "Fann2MQL.h"
-#include "doublefann.h"
-#include "fann_internal.h"
-#include "windows.h"
-#include <strsafe.h>
-
-#include "tbb/task_scheduler_init.h"
-#include "tbb/blocked_range.h"
-#include "tbb/parallel_for.h"
-
-/* number of threads */
-DWORD _threads=0;
-
-/* TBB initialization indicator */
-int _TBB_Initialized=0;
-
-/* data used by f2M_run_threaded function */
-runThreadedData* _rtd[F2M_MAX_THREADS];
-
-/* threads handlers */
-HANDLE _threadH[F2M_MAX_THREADS];
-
-void ErrorExit(LPTSTR lpszFunction);
-
-using namespace tbb;
-
-/* Intel TBB Task Scheduler */
-task_scheduler_init TS(task_scheduler_init::deferred);
-
-/* Intel TBB paralelized class used by f2M_run_parallel() */
-class Apply_fann_run {
-	int *anns;
-	double *input_vector;
-public:
-	void operator()( const blocked_range<size_t>& r ) const {
-		int* my_a=anns;
-		double *my_iv=input_vector;
-		for( size_t i=r.begin(); i!=r.end(); ++i )
-			_outputs[my_a[i]]=fann_run(_fanns[my_a[i]], my_iv);
-	}
-	Apply_fann_run(int *a, double *iv) :
-		anns(a), input_vector(iv)
-	{}
-};
-
-/**
- * Run fann networks in parallel using Intel TBB
- *  anns_count - number of networks to run in paralel
- *  anns[] - network handlers returned by f2M_create*
- *  *input_vector - arrary of inputs
- * Returns:
- *  0 on success, <0 on error
- * Note:
- *  To obtain network output use f2M_get_output().
- *  Any existing output is overwritten
- */
-FANN2MQL_API int __stdcall f2M_run_parallel(DWORD anns_count, int* anns, double *input_vector)
-{
-	DWORD i;
-	int ret=0;
-
-	if (!_TBB_Initialized) return -1;
-
-	for (i=0; i<anns_count; i++)
-	{
-		/* this network is not allocated */
-		if (anns[i]<0 || anns[i]>_ann || _fanns[anns[i]]==NULL) return -12;
-
-		/* the input vector is empty */
-		if (input_vector==NULL) return -30;
-	}
-
-	/* parallel the work */
-	parallel_for(blocked_range<size_t>(0,anns_count),
-	             Apply_fann_run(anns, input_vector),auto_partitioner());
-
-	return 0;
-}
-
-/* Intel TBB paralelized class used by f2M_train_parallel() */
-class Apply_fann_train {
-	int *anns;
-	double *input_vector;
-	double *output_vector;
-public:
-	void operator()( const blocked_range<size_t>& r ) const {
-		int* my_a=anns;
-		double *my_iv=input_vector;
-		double *my_ov=output_vector;
-		for( size_t i=r.begin(); i!=r.end(); ++i )
-			fann_train(_fanns[my_a[i]], my_iv, my_ov);
-	}
-	Apply_fann_train(int *a, double *iv, double *ov) :
-		anns(a), input_vector(iv), output_vector(ov)
-	{}
-};
-
-/**
- * Train fann networks in parallel using Intel TBB
- *  anns_count - number of networks to run in paralel
- *  anns[] - network handlers returned by f2M_create*
- *  *input_vector - arrary of inputs
- *	*output_vector - array of outputs
- * Returns:
- *  0 on success, <0 on error
- */
-FANN2MQL_API int __stdcall f2M_train_parallel(DWORD anns_count, int* anns, double *input_vector, double *output_vector)
-{
-	DWORD i;
-	int ret=0;
-
-	if (!_TBB_Initialized) return -1;
-
-	for (i=0; i<anns_count; i++)
-	{
-		/* this network is not allocated */
-		if (anns[i]<0 || anns[i]>_ann || _fanns[anns[i]]==NULL) return -12;
-
-		/* the input vector is empty */
-		if (input_vector==NULL) return -30;
-
-		/* the output vector is empty */
-		if (output_vector==NULL) return -40;
-	}
-
-	/* parallel the work */
-	parallel_for(blocked_range<size_t>(0,anns_count),
-	             Apply_fann_train(anns, input_vector, output_vector),auto_partitioner());
-
-	return 0;
-}
-
-/**
- * Initializes Intel TBB parallel processing interface
- * Returns:
- *  0 on success
- */
-FANN2MQL_API int __stdcall f2M_parallel_init()
-{
-	if (!_TBB_Initialized)
-		TS.initialize();
-	_TBB_Initialized++;
-
-	//SetUnhandledExceptionFilter(NULL);
-	return 0;
-}
-
-/**
- * Deinitiaizes Intel TBB parallel processing interface
- * Returns:
- *  0 on success, -1 on error
- */
-FANN2MQL_API int __stdcall f2M_parallel_deinit()
-{
-	_TBB_Initialized--;
-	if (_TBB_Initialized<=0)
-		TS.terminate();
-
-	return 0;
-}
-
-/* Puts thread into infnite loop, waiting for APC 
- */
-DWORD WINAPI f2M_threads_loop(LPVOID lpParam)
-{	
-	runThreadedData* rtd=(runThreadedData*)lpParam;
-
-
-	rtd->mutexH=CreateMutex(NULL, TRUE, NULL);
-	if (rtd->mutexH==NULL) {
-		ErrorExit(TEXT("f2M_threads_loop(): CreateMutex()"));
-	}
-
-	/* infinite loop, waiting for APC */
-	while (1) {
-		SleepEx(INFINITE, TRUE);
-	}
-
-	return 0;
-}
-
-/**
- * Initializes (starts) threads
- *  num_threads - number of threads to spawn
- * Returns:
- *  0 on success, -1 on error
- * Note:
- * This function starts threads and puts them in infinite loop waiting for
- * asynchronous procedure calls (APC)
- */
-FANN2MQL_API int __stdcall f2M_threads_init(int num_threads)
-{
-	DWORD i;
-
-	/* Seems threads already initialized! */
-	if (_threads!=0) return -1;
-
-	/* At least two threads */
-	if (num_threads<2) return -2;
-	
-	/* limit number of threads */
-	_threads=num_threads>F2M_MAX_THREADS?F2M_MAX_THREADS:num_threads;
-
-	/* Start all threads */
-	for (i=0; i<_threads; i++)
-	{
-		/* allocate data for runThreadedData structure */
-		_rtd[i] = (runThreadedData*) HeapAlloc(GetProcessHeap(), HEAP_ZERO_MEMORY, sizeof(runThreadedData));
-		if (_rtd[i]==NULL) ExitProcess(3);
-
-		/* Initialize runThreadedData */
-		_rtd[i]->ann_count=0;
-		_rtd[i]->ann_start=0;
-		_rtd[i]->anns=NULL;
-		_rtd[i]->input_vector=NULL;
-		_rtd[i]->mutexH=NULL;
-		_rtd[i]->ret=0;
-		_rtd[i]->threadId=NULL;
-
-		_threadH[i] = CreateThread( 
-			NULL,                   // default security attributes
-			0,                      // use default stack size  
-			f2M_threads_loop,		// thread function name
-			(LPVOID)_rtd[i],        // argument to thread function 
-			0,                      // use default creation flags 
-			&_rtd[i]->threadId);			// returns the thread identifier 
-
-		/* Thread initialization failed... exit! */
-		if (_threadH[i] == NULL)
-				ExitProcess(1);
-		SetThreadPriority(_threadH[i],THREAD_PRIORITY_HIGHEST);
-	}
-	SwitchToThread();
-
-	/* let there be rest ;) */
-	Sleep(300);
-
-	return 0;
-}
-
-
-/* Terminates thread */
-VOID CALLBACK f2M_thread_terminate(ULONG_PTR dwParam)
-{
-	runThreadedData* data=_rtd[dwParam];
-	
-	/* clean up the stuff */
-	CloseHandle(_threadH[dwParam]);
-	CloseHandle(data->mutexH);
-    HeapFree(GetProcessHeap(), 0, data);
-
-	ExitThread(-1);
-}
-
-/**
- * Deinitiaizes (stops) threads
- * Returns:
- *  0 on success, -1 on error
- */
-FANN2MQL_API int __stdcall f2M_threads_deinit()
-{
-	DWORD i;
-
-	/* Seems no threads initialized! */
-	if (_threads==0) return -1;
-
-	/* schedule termination */
-	for (i=0; i<_threads; i++)
-	{
-		QueueUserAPC(f2M_thread_terminate, _threadH[i], i);
-
-	}
-	/* wait for threads to terminate */
-	WaitForMultipleObjects(_threads, _threadH, TRUE, INFINITE);
-
-	/* set threads number to 0 indicating unitialized threads state */
-	_threads=0;
-	return 0;
-}
-
-/* obtain mutex */
-VOID CALLBACK f2M_thread_get_mutex(ULONG_PTR dwParam)
-{
-	runThreadedData* data=_rtd[dwParam];
-
-	WaitForSingleObject(data->mutexH,INFINITE);
-}
-
-VOID CALLBACK f2M_thread_run_nowait(ULONG_PTR dwParam)
-{
-	int i;
-	runThreadedData* data=_rtd[dwParam];
-
-
-	data->ret=0;
-	/* run all networks given fo this thread */
-	for (i = data->ann_start;i < data->ann_start + data->ann_count; i++) {
-		/* this network is not allocated */
-		if (data->anns[i]<0 || data->anns[i]>_ann || _fanns[data->anns[i]]==NULL) {
-			data->ret=-11;
-			break;
-		}
-		/* the input vector is empty */
-		if (data->input_vector==NULL) {
-			data->ret=-22;
-			break;
-		}
-
-		_outputs[data->anns[i]]=fann_run(_fanns[data->anns[i]], data->input_vector);
-		if (_outputs[data->anns[i]]==NULL) {
-			data->ret=-10;
-			break;
-		}
-	}
-
-	return;
-}
-
-
-VOID CALLBACK f2M_thread_run(ULONG_PTR dwParam)
-{
-	int i;
-	runThreadedData* data=_rtd[dwParam];
-
-
-	data->ret=0;
-	/* run all networks given fo this thread */
-	for (i = data->ann_start;i < data->ann_start + data->ann_count; i++) {
-		/* this network is not allocated */
-		if (data->anns[i]<0 || data->anns[i]>_ann || _fanns[data->anns[i]]==NULL) {
-			data->ret=-11;
-			break;
-		}
-		/* the input vector is empty */
-		if (data->input_vector==NULL) {
-			data->ret=-22;
-			break;
-		}
-
-		_outputs[data->anns[i]]=fann_run(_fanns[data->anns[i]], data->input_vector);
-		if (_outputs[data->anns[i]]==NULL) {
-			data->ret=-10;
-			break;
-		}
-	}
-
-	/* release the mutex */
-	ReleaseMutex(data->mutexH);
-	return;
-}
-
-/**
- * Run fann networks in threads
- *  anns_count - number of networks to run in paralel
- *  anns[] - network handlers returned by f2M_create*
- *  *input_vector - arrary of inputs
- * Returns:
- *  0 on success, -1 on error
- * Note:
- *  To obtain network output use f2M_get_output().
- *  Any existing output is overwritten
- */
-FANN2MQL_API int __stdcall f2M_run_threaded(DWORD anns_count, int* anns, double *input_vector)
-{
-	DWORD i;
-	int ret=0;
-	/* number of threads we need to run */
-	DWORD threads=anns_count>_threads?_threads:anns_count;
-	int anns_start=0;
-	/* mutexes used for synchronisation */
-	HANDLE _mutex[F2M_MAX_THREADS];
-
-	for (i=0; i<anns_count; i++)
-	{
-		/* this network is not allocated */
-		if (anns[i]<0 || anns[i]>_ann || _fanns[anns[i]]==NULL) return -12;
-
-		/* the input vector is empty */
-		if (input_vector==NULL) return -30;
-	}
-
-	for (i=0; i<threads; i++)
-	{
-		if (_rtd==NULL) {
-			ErrorExit(TEXT("f2M_run_threaded(): _rtd==NULL"));
-		}
-		/* initialize values */
-		_rtd[i]->ann_start=anns_start;
-		_rtd[i]->ann_count=((anns_count%(threads-i))>0?1:0)+(anns_count/(threads-i));
-		_rtd[i]->anns=anns;
-		_rtd[i]->input_vector=input_vector;
-		_rtd[i]->ret=-1;
-		_mutex[i]=_rtd[i]->mutexH;
-
-
-		/* exit on error */
-		if (_mutex[i]==NULL) {
-			ErrorExit(TEXT("f2M_run_threaded(): _mutex[%d]==NULL()"));
-		}
-
-		if (i<threads) {
-			if (QueueUserAPC(f2M_thread_run, _threadH[i], i)==0)
-				ErrorExit(TEXT("f2M_run_threaded(): QueueUserAPC(f2M_thread_run)"));
-		} else {
-			f2M_thread_run_nowait(i);
-		}
-		anns_start+=_rtd[i]->ann_count;
-		anns_count-=_rtd[i]->ann_count;
-	}
-
-	/*
-	Sleep(0);
-	SwitchToThread();
-	*/
-
-	/* wait for all the threads to release release mutex */
-	ret=WaitForMultipleObjects(threads, _mutex, TRUE, INFINITE);
-	if (ret==WAIT_FAILED) {
-		ErrorExit(TEXT("f2M_run_threaded(): WaitForMultipleObjects()"));
-	}
-	for(i=0; i<threads; i++)
-	{
-		ReleaseMutex(_rtd[i]->mutexH);
-		if (QueueUserAPC(f2M_thread_get_mutex, _threadH[i], i)==0)
-			ErrorExit(TEXT("f2M_run_threaded(): QueueUserAPC(f2M_thread_get_mutex)"));
-		ret+=_rtd[i]->ret;
-	}
-
-	return ret;
-}
-
-
-#if 0
-DWORD WINAPI f2M_threaded_run(LPVOID lpParam) 
-{
-	int i;
-	runThreadedData* data=(runThreadedData*)lpParam;
-
-	for (i = data->ann_start;i < data->ann_start + data->ann_count; i++) {
-		_outputs[data->anns[i]]=fann_run(_fanns[data->anns[i]], data->input_vector);
-		if (_outputs[data->anns[i]]==NULL) return -1;
-	}
-
-	return 0;
-}
-
-/* Run fann networks in threads
- *  threads_count - number of threads to spawn
- *  anns_count - number of networks to run in paralel
- *  anns[] - network handlers returned by f2M_Init
- *  *input_vector - arrary of inputs
- * Returns:
- *  0 on success, -1 on error
- * Note:
- *  To obtain network output use f2M_get_output().
- *  Any existing output is overwritten
- */
-FANN2MQL_API int __stdcall f2M_run_threaded(int threads_count, int anns_count, int anns[], double *input_vector)
-{
-	runThreadedData* data[F2M_MAX_THREADS];
-    DWORD threadId[F2M_MAX_THREADS];
-	HANDLE threadHandle[F2M_MAX_THREADS]; 
-	int anns_start=0;
-
-	int threads=threads_count>F2M_MAX_THREADS?F2M_MAX_THREADS:threads_count;
-	int i;
-
-	for (i=0; i<anns_count; i++)
-	{
-		/* this network is not allocated */
-		if (anns[i]<0 || anns[i]>_ann || _fanns[anns[i]]==NULL) return _ann;
-
-		/* the input vector is empty */
-		if (input_vector==NULL) return -2;
-
-	}
-
-	for (i=0; i<threads; i++)
-	{
-		data[i] = (runThreadedData*) HeapAlloc(GetProcessHeap(), HEAP_ZERO_MEMORY, sizeof(runThreadedData));
-		if (data[i]==NULL) ExitProcess(2);
-		data[i]->anns=anns;
-		data[i]->ann_start=anns_start;
-		data[i]->ann_count=((anns_count%(threads-i))>0?1:0)+(anns_count/(threads-i));
-		data[i]->input_vector=input_vector;
-		
-		if (i<threads-1) {
-			threadHandle[i] = CreateThread( 
-	            NULL,                   // default security attributes
-				0,                      // use default stack size  
-				f2M_threaded_run,       // thread function name
-				data[i],	            // argument to thread function 
-				0,                      // use default creation flags 
-				&threadId[i]);   // returns the thread identifier 
-
-			if (threadHandle[i] == NULL) 
-			{
-				ExitProcess(3);
-			}
-		} else {
-			f2M_threaded_run((LPVOID)data[i]);
-		}
-
-		anns_start+=data[i]->ann_count;
-		anns_count-=data[i]->ann_count;
-		
-	}
-
-	WaitForMultipleObjects(threads-1, threadHandle, TRUE, INFINITE);
-
-	for(int i=0; i<threads; i++)
-    {
-        CloseHandle(threadHandle[i]);
-        if(data[i] != NULL)
-        {
-            HeapFree(GetProcessHeap(), 0, data[i]);
-            data[i] = NULL;    // Ensure address is not reused.
-        }
-    }
-
-	return(0);
-}
-#endif
-void ErrorExit(LPTSTR lpszFunction) 
-{ 
-    // Retrieve the system error message for the last-error code
-
-    LPVOID lpMsgBuf;
-    LPVOID lpDisplayBuf;
-    DWORD dw = GetLastError(); 
-
-    FormatMessage(
-        FORMAT_MESSAGE_ALLOCATE_BUFFER | 
-        FORMAT_MESSAGE_FROM_SYSTEM |
-        FORMAT_MESSAGE_IGNORE_INSERTS,
-        NULL,
-        dw,
-        MAKELANGID(LANG_NEUTRAL, SUBLANG_DEFAULT),
-        (LPTSTR) &lpMsgBuf,
-        0, NULL );
-
-    // Display the error message and exit the process
-
-    lpDisplayBuf = (LPVOID)LocalAlloc(LMEM_ZEROINIT, 
-        (lstrlen((LPCTSTR)lpMsgBuf) + lstrlen((LPCTSTR)lpszFunction) + 40) * sizeof(TCHAR)); 
-    StringCchPrintf((LPTSTR)lpDisplayBuf, 
-        LocalSize(lpDisplayBuf) / sizeof(TCHAR),
-        TEXT("%s failed with error %d: %s"), 
-        lpszFunction, dw, lpMsgBuf); 
-    MessageBox(NULL, (LPCTSTR)lpDisplayBuf, TEXT("Error"), MB_OK); 
-
-    LocalFree(lpMsgBuf);
-    LocalFree(lpDisplayBuf);
-    ExitProcess(dw); 
-}
+/* Fann2MQL-threads.cpp
+ *
+ * Copyright (C) 2008-2009 Mariusz Woloszyn
+ *
+ *  This file is part of Fann2MQL package
+ *
+ *  Fann2MQL is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Fann2MQL is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Fann2MQL; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include "stdafx.h"
+#include "Fann2MQL.h"
+#include "doublefann.h"
+#include "fann_internal.h"
+#include "windows.h"
+
+#include "tbb/task_scheduler_init.h"
+#include "tbb/blocked_range.h"
+#include "tbb/parallel_for.h"
+
+/* number of threads */
+DWORD _threads=0;
+
+/* TBB initialization indicator */
+int _TBB_Initialized=0;
+
+/* data used by f2M_run_threaded function */
+runThreadedData* _rtd[F2M_MAX_THREADS];
+
+/* threads handlers */
+HANDLE _threadH[F2M_MAX_THREADS];
+
+using namespace tbb;
+
+/* Intel TBB Task Scheduler */
+task_scheduler_init TS(task_scheduler_init::deferred);
+
+/* Returns the number of bins the TBB functions split networks into */
+static int f2M_parallel_bins(int kind)
+{
+	int bins=(kind==F2M_COST_TRAIN ? f2M_training_workers() : task_scheduler_init::default_num_threads());
+
+	return (bins>F2M_MAX_THREADS ? F2M_MAX_THREADS : bins);
+}
+
+/* Intel TBB paralelized class used by f2M_run_parallel() */
+class Apply_fann_run {
+	int *order;
+	int *first;
+	double *input_vector;
+	volatile LONG *failed;
+public:
+	void operator()( const blocked_range<size_t>& r ) const {
+		int* my_o=order;
+		double *my_iv=input_vector;
+		__int64 t;
+		for( size_t b=r.begin(); b!=r.end(); ++b )
+			for (int i=first[b]; i<first[b+1]; i++) {
+				t=f2M_ticks();
+				/* the first failing network is reported by the caller */
+				if (f2M_run_ann(my_o[i], my_iv)!=0)
+					InterlockedCompareExchange(failed, my_o[i], -1);
+				f2M_cost_update(F2M_COST_RUN, my_o[i], f2M_ticks()-t);
+			}
+	}
+	Apply_fann_run(int *o, int *f, double *iv, volatile LONG *fl) :
+		order(o), first(f), input_vector(iv), failed(fl)
+	{}
+};
+
+/**
+ * Run fann networks in parallel using Intel TBB
+ *  anns_count - number of networks to run in paralel
+ *  anns[] - network handlers returned by f2M_create*
+ *  *input_vector - arrary of inputs
+ * Returns:
+ *  0 on success, <0 on error
+ * Note:
+ *  To obtain network output use f2M_get_output().
+ *  Any existing output is overwritten.
+ *  Networks are split between threads by their measured run times.
+ */
+FANN2MQL_API int __stdcall f2M_run_parallel(DWORD anns_count, int* anns, double *input_vector)
+{
+	int *order;
+	int first[F2M_MAX_THREADS+1];
+	int bins, i, ret=0;
+	volatile LONG failed=-1;
+
+	if (!_TBB_Initialized) return f2M_error(-1, -1, __FUNCTION__, "f2M_parallel_init() was not called");
+
+	/* the input vector is empty */
+	if (input_vector==NULL) return f2M_error(-30, -1, __FUNCTION__, "input vector is NULL");
+
+	/* this network is not allocated, otherwise loaded and kept in memory */
+	if ((i=f2M_acquire_all((int) anns_count, anns))>=0) return f2M_error_handle(-12, anns[i], __FUNCTION__);
+
+	/* split the networks by cost */
+	order=(int*) f2M_malloc((anns_count+1)*sizeof(int));
+	bins=(order!=NULL ? f2M_cost_plan(F2M_COST_RUN, (int) anns_count, anns, f2M_parallel_bins(F2M_COST_RUN), order, first) : -1);
+	if (bins<0) {
+		f2M_free(order);
+		f2M_release_all((int) anns_count, anns);
+		return f2M_error(-4, -1, __FUNCTION__, "out of memory");
+	}
+
+	/* parallel the work, a bin per task */
+	f2M_inference_enter();
+	try {
+		parallel_for(blocked_range<size_t>(0,bins,1),
+		             Apply_fann_run(order, first, input_vector, &failed),simple_partitioner());
+	} catch (...) {
+		ret=f2M_error(-5, -1, __FUNCTION__, "parallel execution failed");
+	}
+	f2M_inference_leave();
+	f2M_free(order);
+	f2M_release_all((int) anns_count, anns);
+
+	if (ret==0 && failed>=0) ret=f2M_error(-10, (int) failed, __FUNCTION__, "network failed to run");
+
+	return ret;
+}
+
+/* Intel TBB paralelized class used by f2M_train_parallel()
+ * Bin b trains the networks next[b]..first[b+1]-1; a task preempted by
+ * inference ends and leaves the rest of its bins to the next spawn.
+ */
+class Apply_fann_train {
+	int *order;
+	int *first;
+	int *next;
+	double *input_vector;
+	double *output_vector;
+public:
+	void operator()( const blocked_range<size_t>& r ) const {
+		int* my_o=order;
+		double *my_iv=input_vector;
+		double *my_ov=output_vector;
+		int prio=f2M_training_begin();
+		__int64 t;
+		for( size_t b=r.begin(); b!=r.end(); ++b )
+			for (int i=next[b]; i<first[b+1]; i++) {
+				/* let the inference go first, the worker is given back */
+				if (f2M_training_preempted()) {
+					f2M_training_end(prio);
+					return;
+				}
+				t=f2M_ticks();
+				f2M_train_step(f2M_train_fann(my_o[i]), my_iv, my_ov);
+				f2M_train_done(my_o[i]);
+				f2M_cost_update(F2M_COST_TRAIN, my_o[i], f2M_ticks()-t);
+				next[b]=i+1;
+			}
+		f2M_training_end(prio);
+	}
+	Apply_fann_train(int *o, int *f, int *n, double *iv, double *ov) :
+		order(o), first(f), next(n), input_vector(iv), output_vector(ov)
+	{}
+};
+
+/**
+ * Train fann networks in parallel using Intel TBB
+ *  anns_count - number of networks to run in paralel
+ *  anns[] - network handlers returned by f2M_create*
+ *  *input_vector - arrary of inputs
+ *	*output_vector - array of outputs
+ * Returns:
+ *  0 on success, <0 on error
+ * Note:
+ *  Networks are split between threads by their measured training times.
+ */
+FANN2MQL_API int __stdcall f2M_train_parallel(DWORD anns_count, int* anns, double *input_vector, double *output_vector)
+{
+	int *order;
+	int first[F2M_MAX_THREADS+1], next[F2M_MAX_THREADS];
+	int bins, i, pending, ret=0;
+	struct fann *f;
+
+	if (!_TBB_Initialized) return f2M_error(-1, -1, __FUNCTION__, "f2M_parallel_init() was not called");
+
+	/* the input vector is empty */
+	if (input_vector==NULL) return f2M_error(-30, -1, __FUNCTION__, "input vector is NULL");
+
+	/* the output vector is empty */
+	if (output_vector==NULL) return f2M_error(-40, -1, __FUNCTION__, "output vector is NULL");
+
+	/* this network is not allocated, otherwise loaded and kept in memory */
+	if ((i=f2M_acquire_all((int) anns_count, anns))>=0) return f2M_error_handle(-12, anns[i], __FUNCTION__);
+
+	/* split the networks by cost, on a part of the processors if capped */
+	order=(int*) f2M_malloc((anns_count+1)*sizeof(int));
+	bins=(order!=NULL ? f2M_cost_plan(F2M_COST_TRAIN, (int) anns_count, anns, f2M_parallel_bins(F2M_COST_TRAIN), order, first) : -1);
+	if (bins<0) {
+		f2M_free(order);
+		f2M_release_all((int) anns_count, anns);
+		return f2M_error(-4, -1, __FUNCTION__, "out of memory");
+	}
+
+	/* spawned again until every bin is trained, waiting for inference in between */
+	for (i=0; i<bins; i++) next[i]=first[i];
+	do {
+		f2M_training_yield();
+		try {
+			parallel_for(blocked_range<size_t>(0,bins,1),
+			             Apply_fann_train(order, first, next, input_vector, output_vector),simple_partitioner());
+		} catch (...) {
+			ret=f2M_error(-5, -1, __FUNCTION__, "parallel execution failed");
+		}
+		for (i=0, pending=0; i<bins; i++)
+			if (next[i]<first[i+1]) pending=1;
+	} while (ret==0 && pending);
+	f2M_free(order);
+
+	/* report the first network FANN failed to train */
+	for (i=0; ret==0 && i<(int) anns_count; i++) {
+		f=f2M_trained_fann(anns[i]);
+		if (f!=NULL && fann_get_errno((struct fann_error*) f)!=FANN_E_NO_ERROR)
+			ret=f2M_error_fann(-10, anns[i], (struct fann_error*) f, __FUNCTION__);
+	}
+	f2M_release_all((int) anns_count, anns);
+
+	return ret;
+}
+
+/**
+ * Initializes Intel TBB parallel processing interface
+ * Returns:
+ *  0 on success
+ */
+FANN2MQL_API int __stdcall f2M_parallel_init()
+{
+	if (!_TBB_Initialized)
+		TS.initialize();
+	_TBB_Initialized++;
+
+	//SetUnhandledExceptionFilter(NULL);
+	return 0;
+}
+
+/**
+ * Deinitiaizes Intel TBB parallel processing interface
+ * Returns:
+ *  0 on success, -1 on error
+ * Note:
+ *  The last call stops the prefetch thread too, see f2M_prefetch_stop().
+ */
+FANN2MQL_API int __stdcall f2M_parallel_deinit()
+{
+	_TBB_Initialized--;
+	if (_TBB_Initialized<=0) {
+		TS.terminate();
+		f2M_prefetch_stop();
+	}
+
+	return 0;
+}
+
+/* Puts thread into infnite loop, waiting for APC 
+ */
+DWORD WINAPI f2M_threads_loop(LPVOID lpParam)
+{	
+	runThreadedData* rtd=(runThreadedData*)lpParam;
+
+
+	rtd->mutexH=CreateMutex(NULL, TRUE, NULL);
+	/* let f2M_threads_init() check the mutex */
+	SetEvent(rtd->readyH);
+	if (rtd->mutexH==NULL) return 1;
+
+	/* infinite loop, waiting for APC */
+	while (1) {
+		SleepEx(INFINITE, TRUE);
+	}
+
+	return 0;
+}
+
+/* Terminates thread */
+VOID CALLBACK f2M_thread_terminate(ULONG_PTR dwParam)
+{
+	ExitThread(0);
+}
+
+/* Stops the first count threads and frees their data */
+static void f2M_threads_stop(DWORD count)
+{
+	DWORD i;
+
+	/* threads that already exited do not take the APC */
+	for (i=0; i<count; i++)
+		QueueUserAPC(f2M_thread_terminate, _threadH[i], i);
+
+	/* wait for threads to terminate */
+	if (count>0) WaitForMultipleObjects(count, _threadH, TRUE, INFINITE);
+
+	/* clean up the stuff */
+	for (i=0; i<count; i++) {
+		CloseHandle(_threadH[i]);
+		if (_rtd[i]->mutexH!=NULL) CloseHandle(_rtd[i]->mutexH);
+		if (_rtd[i]->readyH!=NULL) CloseHandle(_rtd[i]->readyH);
+		f2M_free(_rtd[i]);
+		_rtd[i]=NULL;
+		_threadH[i]=NULL;
+	}
+}
+
+/**
+ * Initializes (starts) threads
+ *  num_threads - number of threads to spawn
+ * Returns:
+ *  0 on success, <0 on error
+ * Note:
+ * This function starts threads and puts them in infinite loop waiting for
+ * asynchronous procedure calls (APC)
+ */
+FANN2MQL_API int __stdcall f2M_threads_init(int num_threads)
+{
+	DWORD i, count, started=0;
+	HANDLE ready[F2M_MAX_THREADS];
+	int ret=0;
+
+	/* Seems threads already initialized! */
+	if (_threads!=0) return f2M_error(-1, -1, __FUNCTION__, "threads already initialized");
+
+	/* At least two threads */
+	if (num_threads<2) return f2M_error(-2, -1, __FUNCTION__, "at least two threads are needed");
+	
+	/* limit number of threads */
+	count=num_threads>F2M_MAX_THREADS?F2M_MAX_THREADS:num_threads;
+
+	/* Start all threads */
+	for (i=0; i<count; i++)
+	{
+		/* allocate data for runThreadedData structure */
+		_rtd[i] = (runThreadedData*) f2M_calloc(sizeof(runThreadedData));
+		if (_rtd[i]==NULL) {
+			ret=f2M_error(-3, -1, __FUNCTION__, "out of memory");
+			break;
+		}
+
+		/* Initialize runThreadedData */
+		_rtd[i]->ann_count=0;
+		_rtd[i]->ann_start=0;
+		_rtd[i]->anns=NULL;
+		_rtd[i]->input_vector=NULL;
+		_rtd[i]->mutexH=NULL;
+		_rtd[i]->ret=0;
+		_rtd[i]->threadId=NULL;
+		_rtd[i]->readyH=CreateEvent(NULL, TRUE, FALSE, NULL);
+		if (_rtd[i]->readyH==NULL) {
+			f2M_free(_rtd[i]);
+			_rtd[i]=NULL;
+			ret=f2M_error_system(-3, __FUNCTION__, "CreateEvent()");
+			break;
+		}
+
+		_threadH[i] = CreateThread( 
+			NULL,                   // default security attributes
+			0,                      // use default stack size  
+			f2M_threads_loop,		// thread function name
+			(LPVOID)_rtd[i],        // argument to thread function 
+			0,                      // use default creation flags 
+			&_rtd[i]->threadId);			// returns the thread identifier 
+
+		/* Thread initialization failed... stop the started ones */
+		if (_threadH[i] == NULL) {
+			ret=f2M_error_system(-3, __FUNCTION__, "CreateThread()");
+			CloseHandle(_rtd[i]->readyH);
+			f2M_free(_rtd[i]);
+			_rtd[i]=NULL;
+			break;
+		}
+		SetThreadPriority(_threadH[i],THREAD_PRIORITY_HIGHEST);
+		ready[i]=_rtd[i]->readyH;
+		started++;
+	}
+
+	/* wait for the threads to own their mutexes */
+	if (ret==0 && WaitForMultipleObjects(count, ready, TRUE, INFINITE)==WAIT_FAILED)
+		ret=f2M_error_system(-3, __FUNCTION__, "WaitForMultipleObjects()");
+	for (i=0; ret==0 && i<count; i++)
+		if (_rtd[i]->mutexH==NULL)
+			ret=f2M_error(-3, -1, __FUNCTION__, "a thread could not create its mutex");
+
+	if (ret!=0) {
+		f2M_threads_stop(started);
+		return ret;
+	}
+
+	_threads=count;
+	return 0;
+}
+
+/**
+ * Deinitiaizes (stops) threads
+ * Returns:
+ *  0 on success, -1 on error
+ */
+FANN2MQL_API int __stdcall f2M_threads_deinit()
+{
+	/* Seems no threads initialized! */
+	if (_threads==0) return f2M_error(-1, -1, __FUNCTION__, "threads not initialized");
+
+	f2M_threads_stop(_threads);
+
+	/* set threads number to 0 indicating unitialized threads state */
+	_threads=0;
+	return 0;
+}
+
+/* obtain mutex */
+VOID CALLBACK f2M_thread_get_mutex(ULONG_PTR dwParam)
+{
+	runThreadedData* data=_rtd[dwParam];
+
+	WaitForSingleObject(data->mutexH,INFINITE);
+}
+
+VOID CALLBACK f2M_thread_run_nowait(ULONG_PTR dwParam)
+{
+	int i;
+	runThreadedData* data=_rtd[dwParam];
+	__int64 t;
+
+
+	data->ret=0;
+	data->failed=-1;
+	/* run all networks given fo this thread */
+	for (i = data->ann_start;i < data->ann_start + data->ann_count; i++) {
+		/* this network is not allocated */
+		if (data->anns[i]<0 || data->anns[i]>_ann || _fanns[data->anns[i]]==NULL) {
+			data->ret=-11;
+			data->failed=data->anns[i];
+			break;
+		}
+		/* the input vector is empty */
+		if (data->input_vector==NULL) {
+			data->ret=-22;
+			break;
+		}
+
+		t=f2M_ticks();
+		if (f2M_run_ann(data->anns[i], data->input_vector)!=0) {
+			data->ret=-10;
+			data->failed=data->anns[i];
+			break;
+		}
+		f2M_cost_update(F2M_COST_RUN, data->anns[i], f2M_ticks()-t);
+	}
+
+	return;
+}
+
+
+VOID CALLBACK f2M_thread_run(ULONG_PTR dwParam)
+{
+	int i;
+	runThreadedData* data=_rtd[dwParam];
+	__int64 t;
+
+
+	data->ret=0;
+	data->failed=-1;
+	/* run all networks given fo this thread */
+	for (i = data->ann_start;i < data->ann_start + data->ann_count; i++) {
+		/* this network is not allocated */
+		if (data->anns[i]<0 || data->anns[i]>_ann || _fanns[data->anns[i]]==NULL) {
+			data->ret=-11;
+			data->failed=data->anns[i];
+			break;
+		}
+		/* the input vector is empty */
+		if (data->input_vector==NULL) {
+			data->ret=-22;
+			break;
+		}
+
+		t=f2M_ticks();
+		if (f2M_run_ann(data->anns[i], data->input_vector)!=0) {
+			data->ret=-10;
+			data->failed=data->anns[i];
+			break;
+		}
+		f2M_cost_update(F2M_COST_RUN, data->anns[i], f2M_ticks()-t);
+	}
+
+	/* release the mutex */
+	ReleaseMutex(data->mutexH);
+	return;
+}
+
+/**
+ * Run fann networks in threads
+ *  anns_count - number of networks to run in paralel
+ *  anns[] - network handlers returned by f2M_create*
+ *  *input_vector - arrary of inputs
+ * Returns:
+ *  0 on success, <0 on error, see f2M_get_last_error()
+ * Note:
+ *  To obtain network output use f2M_get_output().
+ *  Any existing output is overwritten.
+ *  Networks are split between threads by their measured run times.
+ */
+FANN2MQL_API int __stdcall f2M_run_threaded(DWORD anns_count, int* anns, double *input_vector)
+{
+	DWORD i, queued;
+	int ret=0;
+	/* number of threads we need to run */
+	DWORD threads=anns_count>_threads?_threads:anns_count;
+	/* networks split between threads by cost */
+	int *order;
+	int first[F2M_MAX_THREADS+1];
+	/* mutexes used for synchronisation */
+	HANDLE _mutex[F2M_MAX_THREADS];
+
+	/* threads not started */
+	if (_threads==0) return f2M_error(-1, -1, __FUNCTION__, "f2M_threads_init() was not called");
+
+	/* the input vector is empty */
+	if (input_vector==NULL) return f2M_error(-30, -1, __FUNCTION__, "input vector is NULL");
+
+	/* this network is not allocated, otherwise loaded and kept in memory */
+	if ((ret=f2M_acquire_all((int) anns_count, anns))>=0) return f2M_error_handle(-12, anns[ret], __FUNCTION__);
+	ret=0;
+
+	order=(int*) f2M_malloc((anns_count+1)*sizeof(int));
+	if (order==NULL || f2M_cost_plan(F2M_COST_RUN, (int) anns_count, anns, (int) threads, order, first)<0) {
+		f2M_free(order);
+		f2M_release_all((int) anns_count, anns);
+		return f2M_error(-4, -1, __FUNCTION__, "out of memory");
+	}
+
+	for (queued=0; queued<threads; queued++)
+	{
+		i=queued;
+		/* initialize values */
+		_rtd[i]->ann_start=first[i];
+		_rtd[i]->ann_count=first[i+1]-first[i];
+		_rtd[i]->anns=order;
+		_rtd[i]->input_vector=input_vector;
+		_rtd[i]->ret=-1;
+		_rtd[i]->failed=-1;
+		_mutex[i]=_rtd[i]->mutexH;
+
+		/* stop queueing on error, the threads already queued are waited for */
+		if (QueueUserAPC(f2M_thread_run, _threadH[i], i)==0) {
+			ret=f2M_error_system(-5, __FUNCTION__, "QueueUserAPC()");
+			break;
+		}
+	}
+
+	/*
+	Sleep(0);
+	SwitchToThread();
+	*/
+
+	/* wait for all the threads to release release mutex */
+	if (queued>0 && WaitForMultipleObjects(queued, _mutex, TRUE, INFINITE)==WAIT_FAILED) {
+		/* the threads may still use order[], so it is not freed */
+		f2M_release_all((int) anns_count, anns);
+		return f2M_error_system(-5, __FUNCTION__, "WaitForMultipleObjects()");
+	}
+	for(i=0; i<queued; i++)
+	{
+		ReleaseMutex(_rtd[i]->mutexH);
+		if (QueueUserAPC(f2M_thread_get_mutex, _threadH[i], i)==0 && ret==0)
+			ret=f2M_error_system(-5, __FUNCTION__, "QueueUserAPC()");
+		if (_rtd[i]->ret!=0 && ret==0)
+			ret=f2M_error(_rtd[i]->ret, _rtd[i]->failed, __FUNCTION__,
+						  _rtd[i]->ret==-10 ? "network failed to run" : "network is not allocated");
+	}
+	f2M_free(order);
+	f2M_release_all((int) anns_count, anns);
+
+	return ret;
+}
+
+
+#if 0
+DWORD WINAPI f2M_threaded_run(LPVOID lpParam) 
+{
+	int i;
+	runThreadedData* data=(runThreadedData*)lpParam;
+
+	for (i = data->ann_start;i < data->ann_start + data->ann_count; i++) {
+		_outputs[data->anns[i]]=fann_run(_fanns[data->anns[i]], data->input_vector);
+		if (_outputs[data->anns[i]]==NULL) return -1;
+	}
+
+	return 0;
+}
+
+/* Run fann networks in threads
+ *  threads_count - number of threads to spawn
+ *  anns_count - number of networks to run in paralel
+ *  anns[] - network handlers returned by f2M_Init
+ *  *input_vector - arrary of inputs
+ * Returns:
+ *  0 on success, -1 on error
+ * Note:
+ *  To obtain network output use f2M_get_output().
+ *  Any existing output is overwritten
+ */
+FANN2MQL_API int __stdcall f2M_run_threaded(int threads_count, int anns_count, int anns[], double *input_vector)
+{
+	runThreadedData* data[F2M_MAX_THREADS];
+    DWORD threadId[F2M_MAX_THREADS];
+	HANDLE threadHandle[F2M_MAX_THREADS]; 
+	int anns_start=0;
+
+	int threads=threads_count>F2M_MAX_THREADS?F2M_MAX_THREADS:threads_count;
+	int i;
+
+	for (i=0; i<anns_count; i++)
+	{
+		/* this network is not allocated */
+		if (anns[i]<0 || anns[i]>_ann || _fanns[anns[i]]==NULL) return _ann;
+
+		/* the input vector is empty */
+		if (input_vector==NULL) return -2;
+
+	}
+
+	for (i=0; i<threads; i++)
+	{
+		data[i] = (runThreadedData*) HeapAlloc(GetProcessHeap(), HEAP_ZERO_MEMORY, sizeof(runThreadedData));
+		if (data[i]==NULL) ExitProcess(2);
+		data[i]->anns=anns;
+		data[i]->ann_start=anns_start;
+		data[i]->ann_count=((anns_count%(threads-i))>0?1:0)+(anns_count/(threads-i));
+		data[i]->input_vector=input_vector;
+		
+		if (i<threads-1) {
+			threadHandle[i] = CreateThread( 
+	            NULL,                   // default security attributes
+				0,                      // use default stack size  
+				f2M_threaded_run,       // thread function name
+				data[i],	            // argument to thread function 
+				0,                      // use default creation flags 
+				&threadId[i]);   // returns the thread identifier 
+
+			if (threadHandle[i] == NULL) 
+			{
+				ExitProcess(3);
+			}
+		} else {
+			f2M_threaded_run((LPVOID)data[i]);
+		}
+
+		anns_start+=data[i]->ann_count;
+		anns_count-=data[i]->ann_count;
+		
+	}
+
+	WaitForMultipleObjects(threads-1, threadHandle, TRUE, INFINITE);
+
+	for(int i=0; i<threads; i++)
+    {
+        CloseHandle(threadHandle[i]);
+        if(data[i] != NULL)
+        {
+            HeapFree(GetProcessHeap(), 0, data[i]);
+            data[i] = NULL;    // Ensure address is not reused.
+        }
+    }
+
+	return(0);
+}
+#endif
@@ -35,6 +35,316 @@ struct fann *_fanns[ANNMAX];
 double* _outputs[ANNMAX];
 /* index to last allocated network */
 int _ann=-1;
+/* output buffers owned by the library, _outputs[] points here once a network was run */
+double* _outbufs[ANNMAX];
+/* the published network, weights generation and copy of the input the neuron
+ * values were last computed for by f2M_run(), used by f2M_train_fast() */
+struct fann* _forward_fann[ANNMAX];
+LONG _forward_generation[ANNMAX];
+double* _forward_input[ANNMAX];
+unsigned int _forward_size[ANNMAX];	/* number of inputs _forward_input[] has room for */
+
+/* reader counters of both grace period phases of every network */
+volatile LONG _readers[ANNMAX][2];
+/* current grace period phase of every network */
+volatile LONG _phase[ANNMAX];
+/* set while a new struct fann is being published for the network */
+volatile LONG _publishing[ANNMAX];
+/* incremented whenever the weights served for a network may have changed */
+volatile LONG _generation[ANNMAX];
+
+/* Lock of the handler table, networks are created and destroyed by the host
+ * and by the model server threads */
+class HandleLock {
+public:
+	CRITICAL_SECTION cs;
+	HandleLock() {
+		InitializeCriticalSection(&cs);
+	}
+	~HandleLock() {
+		DeleteCriticalSection(&cs);
+	}
+};
+
+HandleLock _handles;
+
+/* training copies of networks, NULL when trained in place */
+struct fann *_trainfanns[ANNMAX];
+/* retired published networks reused by f2M_publish() */
+struct fann *_sparefanns[ANNMAX];
+
+/* Allocates a handler for an already created fann network
+ *  ann - fann network structure
+ * Returns:
+ *	handler to ann, -1 on error
+ */
+int f2M_new_handle(struct fann *ann)
+{
+	double *outbuf;
+	int handle;
+
+	/* fann_create_* returned an error */
+	if (ann==NULL) return f2M_error_fann(-1, -1, NULL, __FUNCTION__);
+
+	outbuf=(double*) f2M_calloc(fann_get_num_output(ann)*sizeof(double));
+	if (outbuf==NULL) {
+		fann_destroy(ann);
+		return f2M_error(-1, -1, __FUNCTION__, "out of memory");
+	}
+
+	f2M_handles_lock();
+
+	/* too many networks allocated */
+	if (_ann>=ANNMAX-1) {
+		f2M_handles_unlock();
+		f2M_free(outbuf);
+		fann_destroy(ann);
+		return f2M_error(-1, -1, __FUNCTION__, "too many networks allocated");
+	}
+
+	/* allocate the handler for ann */
+	_ann++;		// XXX: rather simple allocation at the moment ;)
+
+	_fanns[_ann]=ann;
+	_outbufs[_ann]=outbuf;
+	/* initialize _outputs[] just in case... */
+	_outputs[_ann]=NULL;
+	handle=_ann;
+
+	f2M_handles_unlock();
+	return handle;
+}
+
+/* Locks the handler table against networks being created or destroyed meanwhile */
+void f2M_handles_lock()
+{
+	EnterCriticalSection(&_handles.cs);
+}
+
+void f2M_handles_unlock()
+{
+	LeaveCriticalSection(&_handles.cs);
+}
+
+/* Enters the read side of a network.
+ *  ann - network handler returned by f2M_create*
+ *  *phase - receives the phase to be passed to f2M_read_unlock()
+ * Returns:
+ *  currently published fann structure; it is neither freed nor reused by
+ *  f2M_publish_fann() until f2M_read_unlock() is called
+ */
+struct fann* f2M_read_lock(int ann, int *phase)
+{
+	*phase=_phase[ann]&1;
+	InterlockedIncrement(&_readers[ann][*phase]);
+	return _fanns[ann];
+}
+
+/* Leaves the read side of a network entered by f2M_read_lock() */
+void f2M_read_unlock(int ann, int phase)
+{
+	InterlockedDecrement(&_readers[ann][phase]);
+}
+
+/* Waits until every reader which could still see the previously published
+ * fann structure of a network has left the read side.
+ * Two phase flips are needed: a reader could have sampled the phase just
+ * before the first flip and registered itself in the other counter.
+ */
+void f2M_synchronize(int ann)
+{
+	int round;
+	LONG phase;
+
+	for (round=0; round<2; round++) {
+		phase=_phase[ann]&1;
+		InterlockedExchange(&_phase[ann], phase^1);
+		while (_readers[ann][phase]!=0) SwitchToThread();
+	}
+}
+
+/* Publishes a new fann structure for a network without blocking readers
+ *  ann - network handler returned by f2M_create*
+ *  next - fann structure to be served from now on
+ * Returns:
+ *  previously published fann structure; no reader uses it anymore so it can
+ *  be modified, reused or destroyed by the caller
+ */
+struct fann* f2M_publish_fann(int ann, struct fann *next)
+{
+	struct fann *prev;
+
+	/* one publisher at a time */
+	while (InterlockedCompareExchange(&_publishing[ann], 1, 0)!=0) SwitchToThread();
+
+	prev=(struct fann*) InterlockedExchangePointer((PVOID*) &_fanns[ann], next);
+	f2M_weights_changed(ann);
+	f2M_synchronize(ann);
+
+	InterlockedExchange(&_publishing[ann], 0);
+	return prev;
+}
+
+/* Returns the fann structure modified by training functions: the training
+ * copy if enabled, the published network otherwise. A change of the
+ * published network is ended by f2M_train_done().
+ */
+struct fann* f2M_train_fann(int ann)
+{
+	/* networks touched by training functions are never evicted */
+	f2M_registry_modified(ann);
+	if (_trainfanns[ann]!=NULL) return _trainfanns[ann];
+
+	/* trained in place, the served weights change */
+	f2M_weights_changed(ann);
+	return _fanns[ann];
+}
+
+/* Returns the fann structure f2M_train_fann() would return, without marking
+ * the network modified; for callers which only read it.
+ */
+struct fann* f2M_trained_fann(int ann)
+{
+	if (_trainfanns[ann]!=NULL) return _trainfanns[ann];
+	return _fanns[ann];
+}
+
+/* Ends a change of the fann structure returned by f2M_train_fann(). Trained
+ * in place, the generation changes once more, so outputs computed while the
+ * weights were changing are not taken for those of the new weights.
+ */
+void f2M_train_done(int ann)
+{
+	if (_trainfanns[ann]==NULL) f2M_weights_changed(ann);
+}
+
+/* Marks the weights served for a network as changed, see f2M_generation() */
+void f2M_weights_changed(int ann)
+{
+	InterlockedIncrement(&_generation[ann]);
+}
+
+/* Returns the generation of the weights served for a network: it changes
+ * whenever they are trained in place, published, or the handler is reused.
+ */
+LONG f2M_generation(int ann)
+{
+	return _generation[ann];
+}
+
+/* Copies weights and activation functions between two networks of the same topology */
+void f2M_copy_fann_state(struct fann *dst, struct fann *src)
+{
+	struct fann_neuron *d, *s;
+
+	memcpy(dst->weights, src->weights, src->total_connections*sizeof(fann_type));
+	for (d=dst->first_layer->first_neuron, s=src->first_layer->first_neuron;
+	     s!=(src->last_layer-1)->last_neuron; d++, s++) {
+		d->activation_function=s->activation_function;
+		d->activation_steepness=s->activation_steepness;
+	}
+}
+
+/* Runs the published fann structure of a network and stores its outputs,
+ * answered from the result cache when possible.
+ *  ann - network handler, must be valid
+ *  *input_vector - arrary of inputs
+ * Returns:
+ *  0 on success, -4 when fann_run failed
+ */
+int f2M_run_ann(int ann, double *input_vector)
+{
+	struct fann *f;
+	fann_type *out;
+	int phase;
+	/* read first, outputs of weights changing meanwhile are stored as stale */
+	LONG generation=f2M_generation(ann);
+
+	if (f2M_cache_lookup(ann, generation, input_vector, _outbufs[ann])) {
+		_outputs[ann]=_outbufs[ann];
+		return 0;
+	}
+
+	f=f2M_read_lock(ann, &phase);
+	/* evicted in the meantime */
+	if (f==NULL) {
+		f2M_read_unlock(ann, phase);
+		return -4;
+	}
+	out=f2M_forward(f, input_vector);
+	if (out!=NULL) {
+		memcpy(_outbufs[ann], out, f->num_output*sizeof(double));
+		_outputs[ann]=_outbufs[ann];
+		f2M_cache_store(ann, generation, input_vector, out);
+
+		/* a cache hit leaves the neuron values of an earlier input */
+		_forward_fann[ann]=NULL;
+		if (_forward_size[ann]<f->num_input) {
+			f2M_free(_forward_input[ann]);
+			_forward_input[ann]=(double*) f2M_malloc(f->num_input*sizeof(double));
+			_forward_size[ann]=(_forward_input[ann]!=NULL ? f->num_input : 0);
+		}
+		if (_forward_input[ann]!=NULL) {
+			memcpy(_forward_input[ann], input_vector, f->num_input*sizeof(double));
+			_forward_fann[ann]=f;
+			_forward_generation[ann]=generation;
+		}
+	} else {
+		_forward_fann[ann]=NULL;
+	}
+	f2M_read_unlock(ann, phase);
+
+	return (out==NULL ? -4 : 0);
+}
+
+/* Releases the training copy of a network */
+static void f2M_free_copies(int ann)
+{
+	if (_trainfanns[ann]!=NULL) fann_destroy(_trainfanns[ann]);
+	if (_sparefanns[ann]!=NULL) fann_destroy(_sparefanns[ann]);
+	_trainfanns[ann]=NULL;
+	_sparefanns[ann]=NULL;
+}
+
+/* Returns nonzero if a network handler is allocated, even if its network is not in memory */
+static int f2M_allocated(int ann)
+{
+	return (_fanns[ann]!=NULL || _remote[ann]!=NULL || f2M_registered(ann));
+}
+
+/* Releases everything allocated for a network handler but the handler itself */
+static void f2M_free_handle(int ann)
+{
+	if (_remote[ann]!=NULL) {
+		/* proxy of a network living in the model server */
+		f2M_client_release(ann);
+	} else {
+		/* stop background training and online learning first, they still reference the network */
+		f2M_jobs_release(ann);
+		f2M_online_deinit(ann);
+		f2M_free_copies(ann);
+		f2M_registry_release(ann);
+		f2M_fast_math_release(ann);
+		f2M_seed_release(ann);
+		f2M_cost_release(ann);
+		f2M_cache_release(ann);
+		f2M_checkpoint_release(ann);
+
+		/* NULL if registered and not loaded */
+		fann_destroy(_fanns[ann]);
+	}
+	f2M_free(_outbufs[ann]);
+
+	/* clear the pointers */
+	f2M_weights_changed(ann);
+	_fanns[ann]=NULL;
+	_outbufs[ann]=NULL;
+	_outputs[ann]=NULL;
+	_forward_fann[ann]=NULL;
+	f2M_free(_forward_input[ann]);
+	_forward_input[ann]=NULL;
+	_forward_size[ann]=0;
+}
 
 /* Creates a standard fully connected backpropagation neural network.
  *  num_layers - The total number of layers including the input and the output layer.
@@ -46,24 +356,58 @@ int _ann=-1;
 FANN2MQL_API int __stdcall f2M_create_standard(unsigned int num_layers, int l1num, int l2num, int l3num, int l4num)
 {
 	/* to many networks allocated */
-	if (_ann>=ANNMAX) return (-1);
+	if (_ann>=ANNMAX-1) return f2M_error(-1, -1, __FUNCTION__, "too many networks");
 
 	/* not accepting bogus arguments */
-	if (l1num < 1 || l2num < 1 || l3num < 1 || l4num < 1 || num_layers < 2) return (-1);
+	if (l1num < 1 || l2num < 1 || l3num < 1 || l4num < 1 || num_layers < 2)
+		return f2M_error(-1, -1, __FUNCTION__, "invalid number of layers or neurons");
 
-	/* allocate the handler for ann */
-	_ann++;		// XXX: rather simple allocation at the moment ;)
+	return f2M_seed_new(f2M_new_handle(fann_create_standard(num_layers, l1num, l2num, l3num, l4num)));
+}
 
-	_fanns[_ann]=fann_create_standard(num_layers, l1num, l2num, l3num, l4num);
-	if (_fanns[_ann]==NULL) {
-		/* fann_create_standard returned an error */
-		_ann--;
-		return (-1);
-	} else {
-		/* initialize _outputs[] just in case... */
-		_outputs[_ann]=NULL;
-		return (_ann);
-	}
+/* Creates a standard fully connected backpropagation neural network of any depth.
+ *  num_layers - The total number of layers including the input and the output layer.
+ *  *layers - num_layers numbers of neurons in the layers, inputs first.
+ * Returns:
+ *	handler to ann, -1 on error
+ */
+FANN2MQL_API int __stdcall f2M_create_standard_array(unsigned int num_layers, int *layers)
+{
+	unsigned int i;
+
+	/* to many networks allocated */
+	if (_ann>=ANNMAX-1) return f2M_error(-1, -1, __FUNCTION__, "too many networks");
+
+	/* not accepting bogus arguments */
+	if (layers==NULL || num_layers < 2) return f2M_error(-1, -1, __FUNCTION__, "invalid number of layers");
+	for (i=0; i<num_layers; i++)
+		if (layers[i] < 1) return f2M_error(-1, -1, __FUNCTION__, "invalid number of neurons");
+
+	return f2M_seed_new(f2M_new_handle(fann_create_standard_array(num_layers, (unsigned int*) layers)));
+}
+
+/* Creates a standard backpropagation neural network with shortcut connections:
+ * every layer is connected to all the layers after it.
+ *  num_layers - The total number of layers including the input and the output layer.
+ *  *layers - num_layers numbers of neurons in the layers, inputs first.
+ * Returns:
+ *	handler to ann, -1 on error
+ * Note:
+ *  A network with two layers is the starting point of f2M_cascade_train_on_file().
+ */
+FANN2MQL_API int __stdcall f2M_create_shortcut_array(unsigned int num_layers, int *layers)
+{
+	unsigned int i;
+
+	/* to many networks allocated */
+	if (_ann>=ANNMAX-1) return f2M_error(-1, -1, __FUNCTION__, "too many networks");
+
+	/* not accepting bogus arguments */
+	if (layers==NULL || num_layers < 2) return f2M_error(-1, -1, __FUNCTION__, "invalid number of layers");
+	for (i=0; i<num_layers; i++)
+		if (layers[i] < 1) return f2M_error(-1, -1, __FUNCTION__, "invalid number of neurons");
+
+	return f2M_seed_new(f2M_new_handle(fann_create_shortcut_array(num_layers, (unsigned int*) layers)));
 }
 
 /* Destroy fann network
@@ -77,15 +421,16 @@ FANN2MQL_API int __stdcall f2M_destroy(int ann)
 {
 	int i, last_null=_ann-1;
 
+	f2M_handles_lock();
+
 	/* this network is not allocated */
-	if (ann<0 || ann>_ann || _fanns[ann]==NULL) return (-1);
+	if (ann<0 || ann>_ann || !f2M_allocated(ann)) {
+		f2M_handles_unlock();
+		return f2M_error_handle(-1, ann, __FUNCTION__);
+	}
 
 	/* destroy */
-	fann_destroy(_fanns[ann]);
-
-	/* clear the pointers */
-	_fanns[ann]=NULL;
-	_outputs[ann]=NULL;
+	f2M_free_handle(ann);
 
 	/* let reuse the handlers if last */
 	if (ann==_ann) {
@@ -93,7 +438,7 @@ FANN2MQL_API int __stdcall f2M_destroy(int ann)
 
 		/* look if we can recover any more handlers */
 		for (i=_ann; i>-1; i--) {
-			if (_fanns[i]==NULL) {
+			if (!f2M_allocated(i)) {
 				_ann--;
 			} else {
 				break;
@@ -101,6 +446,7 @@ FANN2MQL_API int __stdcall f2M_destroy(int ann)
 		}
 	}
 
+	f2M_handles_unlock();
 	return 0;
 }
 
@@ -112,15 +458,14 @@ FANN2MQL_API int __stdcall f2M_destroy_all_anns()
 {
 	int i;
 
-	for (i=0; i<_ann; i++) {
+	f2M_handles_lock();
+	for (i=0; i<=_ann; i++) {
 		/* destroy */
-		if (_fanns[i]!=NULL) fann_destroy(_fanns[i]);
-		/* clear the pointers */
-		_fanns[i]=NULL;
-		_outputs[i]=NULL;
+		if (f2M_allocated(i)) f2M_free_handle(i);
 	}
 	/* initialize anns counter */
 	_ann=-1;
+	f2M_handles_unlock();
 
 	return 0;
 }
@@ -136,16 +481,28 @@ FANN2MQL_API int __stdcall f2M_destroy_all_anns()
  */
 FANN2MQL_API int __stdcall f2M_run(int ann, double *input_vector)
 {
+	int ret;
+	AnnPin pin;
+
 	/* this network is not allocated */
-	if (ann<0 || ann>_ann || _fanns[ann]==NULL) return -2;
+	if (ann<0 || ann>_ann || !f2M_allocated(ann)) return f2M_error_handle(-2, ann, __FUNCTION__);
 
 	/* the input vector is empty */
-	if (input_vector==NULL) return -3;
+	if (input_vector==NULL) return f2M_error(-3, ann, __FUNCTION__, "input vector is NULL");
 
-	/* run and return */
-	_outputs[ann]=fann_run(_fanns[ann], input_vector);
-	if (_outputs[ann]==NULL) return -4;
-	return 0;
+	/* run in the model server */
+	if (_remote[ann]!=NULL) return f2M_client_run(ann, input_vector);
+
+	/* load it if registered */
+	if (!pin.acquire(ann)) return f2M_error_handle(-4, ann, __FUNCTION__);
+
+	/* run and return, training yields meanwhile */
+	f2M_inference_enter();
+	ret=f2M_run_ann(ann, input_vector);
+	f2M_inference_leave();
+
+	if (ret!=0) return f2M_error(ret, ann, __FUNCTION__, "network failed to run");
+	return ret;
 }
 
 /* Return an output vector from a given network
@@ -157,7 +514,10 @@ FANN2MQL_API int __stdcall f2M_run(int ann, double *input_vector)
 FANN2MQL_API double __stdcall f2M_get_output(int ann, int output)
 {
 	/* this network is not allocated */
-	if (ann<0 || ann>_ann || _fanns[ann]==NULL) return DOUBLE_ERROR;
+	if (ann<0 || ann>_ann || !f2M_allocated(ann)) {
+		f2M_error_handle(-1, ann, __FUNCTION__);
+		return DOUBLE_ERROR;
+	}
 	
 	/* this network has no output */
 	if (_outputs[ann]==NULL) return DOUBLE_ERROR;
@@ -178,10 +538,13 @@ FANN2MQL_API double __stdcall f2M_get_output(int ann, int output)
  */
 FANN2MQL_API int __stdcall f2M_randomize_weights(int ann, double min_weight, double max_weight)
 {
+	AnnPin pin;
+
 	/* this network is not allocated */
-	if (ann<0 || ann>_ann || _fanns[ann]==NULL) return (-1);
+	if (!pin.acquire(ann)) return f2M_error_handle(-1, ann, __FUNCTION__);
 
-	fann_randomize_weights(_fanns[ann], min_weight, max_weight);
+	f2M_randomize(ann, f2M_train_fann(ann), min_weight, max_weight);
+	f2M_train_done(ann);
 
 	return 0;
 }
@@ -191,9 +554,13 @@ FANN2MQL_API int __stdcall f2M_randomize_weights(int ann, double min_weight, dou
  */
 FANN2MQL_API int __stdcall f2M_get_num_input(int ann)
 {
+	AnnPin pin;
+
 	/* this network is not allocated */
-	if (ann<0 || ann>_ann || _fanns[ann]==NULL) return (-1);
-	
+	if (ann<0 || ann>_ann || !f2M_allocated(ann)) return f2M_error_handle(-1, ann, __FUNCTION__);
+
+	if (_remote[ann]!=NULL) return f2M_client_num_input(ann);
+	if (!pin.acquire(ann)) return f2M_error_handle(-1, ann, __FUNCTION__);
 	return fann_get_num_input(_fanns[ann]);
 }
 
@@ -202,9 +569,13 @@ FANN2MQL_API int __stdcall f2M_get_num_input(int ann)
  */
 FANN2MQL_API int __stdcall f2M_get_num_output(int ann)
 {
+	AnnPin pin;
+
 	/* this network is not allocated */
-	if (ann<0 || ann>_ann || _fanns[ann]==NULL) return (-1);
-	
+	if (ann<0 || ann>_ann || !f2M_allocated(ann)) return f2M_error_handle(-1, ann, __FUNCTION__);
+
+	if (_remote[ann]!=NULL) return f2M_client_num_output(ann);
+	if (!pin.acquire(ann)) return f2M_error_handle(-1, ann, __FUNCTION__);
 	return fann_get_num_output(_fanns[ann]);
 }
 
@@ -218,36 +589,56 @@ FANN2MQL_API int __stdcall f2M_get_num_output(int ann)
  */
 FANN2MQL_API int __stdcall f2M_train(int ann, double *input_vector, double *output_vector)
 {
+	AnnPin pin;
+
 	/* this network is not allocated */
-	if (ann<0 || ann>_ann || _fanns[ann]==NULL) return (-1);
+	if (!pin.acquire(ann)) return f2M_error_handle(-1, ann, __FUNCTION__);
 
 	/* the input or output vector is empty */
-	if (input_vector==NULL || output_vector==NULL) return -1;
+	if (input_vector==NULL || output_vector==NULL) return f2M_error(-1, ann, __FUNCTION__, "input or output vector is NULL");
 
-	fann_train(_fanns[ann], input_vector, output_vector);
+	f2M_train_step(f2M_train_fann(ann), input_vector, output_vector);
+	f2M_train_done(ann);
 	return (0);
 }
 
 /* Train one iteration with a set of inputs, and a set of desired outputs.
  * The trick is to call internal fann functions and avoid the call to fann_run() inside fann_train().
+ * Fully connected layered networks are backpropagated and updated in a single fused sweep.
  *  ann - network handler returned by f2M_create*
- *  *input_vector - arrary of inputs // Not used; You need to make sure that fann_run() was called on this input before.
+ *  *input_vector - arrary of inputs, the network is run on it unless f2M_run() computed its neuron values
  *  *output_vector - arrary of outputs
  * Returns:
  *  0 on success and -1 on error
  */
 FANN2MQL_API int __stdcall f2M_train_fast(int ann, double *input_vector, double *output_vector)
 {
+	struct fann *f;
+	LONG generation;
+	AnnPin pin;
+
 	/* this network is not allocated */
-	if (ann<0 || ann>_ann || _fanns[ann]==NULL) return (-1);
+	if (!pin.acquire(ann)) return f2M_error_handle(-1, ann, __FUNCTION__);
 
 	/* the input or output vector is empty */
-	if (input_vector==NULL || output_vector==NULL) return -1;
+	if (input_vector==NULL || output_vector==NULL) return f2M_error(-1, ann, __FUNCTION__, "input or output vector is NULL");
+
+	/* the neuron values are those of this input unless f2M_run() was answered
+	 * from the cache, another input was run since or the weights changed */
+	generation=f2M_generation(ann);
+	f=f2M_train_fann(ann);
+	if (f!=_forward_fann[ann] || generation!=_forward_generation[ann] ||
+		memcmp(_forward_input[ann], input_vector, f->num_input*sizeof(double))!=0)
+		f2M_forward(f, input_vector);
+	_forward_fann[ann]=NULL;
 
 	//fann_train(_fanns[ann], input_vector, output_vector);
-	fann_compute_MSE(_fanns[ann], output_vector);
-	fann_backpropagate_MSE(_fanns[ann]);
-	fann_update_weights(_fanns[ann]);
+	if (f2M_fused_supported(f)) {
+		f2M_backward_fused(f, output_vector);
+	} else {
+		f2M_backward(f, output_vector);
+	}
+	f2M_train_done(ann);
 
 	return (0);
 }
@@ -264,15 +655,34 @@ FANN2MQL_API int __stdcall f2M_train_fast(int ann, double *input_vector, double
  */
 FANN2MQL_API int __stdcall f2M_test(int ann, double *input_vector, double *output_vector)
 {
+	struct fann *f;
+	fann_type *out;
+	double *desired;
+	AnnPin pin;
+
 	/* this network is not allocated */
-	if (ann<0 || ann>_ann || _fanns[ann]==NULL) return -1;
+	if (!pin.acquire(ann)) return f2M_error_handle(-1, ann, __FUNCTION__);
 
 	/* the input or output vector is empty */
-	if (input_vector==NULL || output_vector==NULL) return -1;
+	if (input_vector==NULL || output_vector==NULL) return f2M_error(-1, ann, __FUNCTION__, "input or output vector is NULL");
 
 	/* run and return */
-	_outputs[ann]=fann_test(_fanns[ann], input_vector,output_vector);
-	if (_outputs[ann]==NULL) return -1;
+	f=f2M_train_fann(ann);
+	_forward_fann[ann]=NULL;
+	if (f2M_scaled(f)) {
+		/* fann_test() knows nothing of scaling, the error is computed on scaled values */
+		desired=(double*) f2M_malloc(f->num_output*sizeof(double));
+		if (desired==NULL) return f2M_error(-1, ann, __FUNCTION__, "out of memory");
+		f2M_scale_outputs(f, output_vector, desired);
+		out=f2M_forward(f, input_vector);
+		fann_compute_MSE(f, desired);
+		f2M_free(desired);
+	} else {
+		out=fann_test(f, input_vector,output_vector);
+	}
+	if (out==NULL) return f2M_error_fann(-1, ann, (struct fann_error*) f, __FUNCTION__);
+	memcpy(_outbufs[ann], out, f->num_output*sizeof(double));
+	_outputs[ann]=_outbufs[ann];
 	return 0;
 }
 
@@ -284,11 +694,12 @@ FANN2MQL_API int __stdcall f2M_test(int ann, double *input_vector, double *outpu
 FANN2MQL_API double __stdcall f2M_get_MSE(int ann)
 {
 	double mse;
+	AnnPin pin;
 
 	/* this network is not allocated */
-	if (ann<0 || ann>_ann || _fanns[ann]==NULL) return (-1);
+	if (!pin.acquire(ann)) return f2M_error_handle(-1, ann, __FUNCTION__);
 
-	mse=(double) fann_get_MSE(_fanns[ann]);
+	mse=(double) fann_get_MSE(f2M_trained_fann(ann));
 
 	return mse;
 }
@@ -302,10 +713,12 @@ FANN2MQL_API double __stdcall f2M_get_MSE(int ann)
  */
 FANN2MQL_API int __stdcall f2M_get_bit_fail(int ann)
 {
+	AnnPin pin;
+
 	/* this network is not allocated */
-	if (ann<0 || ann>_ann || _fanns[ann]==NULL) return (-1);
+	if (!pin.acquire(ann)) return f2M_error_handle(-1, ann, __FUNCTION__);
 
-	return (fann_get_bit_fail(_fanns[ann]));
+	return (fann_get_bit_fail(f2M_trained_fann(ann)));
 }
 
 /* Reset mean square error of the network
@@ -315,10 +728,12 @@ FANN2MQL_API int __stdcall f2M_get_bit_fail(int ann)
  */
 FANN2MQL_API int __stdcall f2M_reset_MSE(int ann)
 {
+	AnnPin pin;
+
 	/* this network is not allocated */
-	if (ann<0 || ann>_ann || _fanns[ann]==NULL) return (-1);
+	if (!pin.acquire(ann)) return f2M_error_handle(-1, ann, __FUNCTION__);
 
-	fann_reset_MSE(_fanns[ann]);
+	fann_reset_MSE(f2M_train_fann(ann));
 
 	return 0;
 }
@@ -330,10 +745,12 @@ FANN2MQL_API int __stdcall f2M_reset_MSE(int ann)
  */
 FANN2MQL_API int __stdcall f2M_get_training_algorithm(int ann)
 {
+	AnnPin pin;
+
 	/* this network is not allocated */
-	if (ann<0 || ann>_ann || _fanns[ann]==NULL) return (-1);
+	if (!pin.acquire(ann)) return f2M_error_handle(-1, ann, __FUNCTION__);
 	
-	return (fann_get_training_algorithm(_fanns[ann]));
+	return (fann_get_training_algorithm(f2M_trained_fann(ann)));
 }
 
 /* Set the training algorithm.
@@ -342,10 +759,12 @@ FANN2MQL_API int __stdcall f2M_get_training_algorithm(int ann)
  */
 FANN2MQL_API int __stdcall f2M_set_training_algorithm(int ann, int training_alorithm)
 {
+	AnnPin pin;
+
 	/* this network is not allocated */
-	if (ann<0 || ann>_ann || _fanns[ann]==NULL) return (-1);
+	if (!pin.acquire(ann)) return f2M_error_handle(-1, ann, __FUNCTION__);
 	
-	fann_set_training_algorithm(_fanns[ann], (fann_train_enum) training_alorithm);
+	fann_set_training_algorithm(f2M_train_fann(ann), (fann_train_enum) training_alorithm);
 
 	return (0);
 }
@@ -361,10 +780,13 @@ FANN2MQL_API int __stdcall f2M_set_training_algorithm(int ann, int training_alor
  */
 FANN2MQL_API int __stdcall f2M_set_act_function_layer(int ann, int activation_function, int layer)
 {
+	AnnPin pin;
+
 	/* this network is not allocated */
-	if (ann<0 || ann>_ann || _fanns[ann]==NULL) return -1;
+	if (!pin.acquire(ann)) return f2M_error_handle(-1, ann, __FUNCTION__);
 
-	fann_set_activation_function_layer(_fanns[ann],(fann_activationfunc_enum)activation_function, layer);
+	fann_set_activation_function_layer(f2M_train_fann(ann),(fann_activationfunc_enum)activation_function, layer);
+	f2M_train_done(ann);
 
 	return 0;
 }
@@ -377,10 +799,13 @@ FANN2MQL_API int __stdcall f2M_set_act_function_layer(int ann, int activation_fu
  */
 FANN2MQL_API int __stdcall f2M_set_act_function_hidden(int ann, int activation_function)
 {
+	AnnPin pin;
+
 	/* this network is not allocated */
-	if (ann<0 || ann>_ann || _fanns[ann]==NULL) return -1;
+	if (!pin.acquire(ann)) return f2M_error_handle(-1, ann, __FUNCTION__);
 
-	fann_set_activation_function_hidden(_fanns[ann],(fann_activationfunc_enum)activation_function);
+	fann_set_activation_function_hidden(f2M_train_fann(ann),(fann_activationfunc_enum)activation_function);
+	f2M_train_done(ann);
 
 	return 0;
 }
@@ -393,14 +818,53 @@ FANN2MQL_API int __stdcall f2M_set_act_function_hidden(int ann, int activation_f
  */
 FANN2MQL_API int __stdcall f2M_set_act_function_output(int ann, int activation_function)
 {
+	AnnPin pin;
+
 	/* this network is not allocated */
-	if (ann<0 || ann>_ann || _fanns[ann]==NULL) return -1;
+	if (!pin.acquire(ann)) return f2M_error_handle(-1, ann, __FUNCTION__);
 
-	fann_set_activation_function_output(_fanns[ann],(fann_activationfunc_enum)activation_function);
+	fann_set_activation_function_output(f2M_train_fann(ann),(fann_activationfunc_enum)activation_function);
+	f2M_train_done(ann);
 
 	return 0;
 }
 
+/* Trains a network on data for a period of time, like fann_train_on_data()
+ * yielding to inference between epochs
+ *  ann - network handler, acquired
+ *  data - rows to train on
+ *  owned - nonzero if the rows may be changed
+ *  function - name of the exported function, for errors
+ * Returns:
+ *  0 on success and <0 on error
+ */
+static int f2M_train_on(int ann, struct fann_train_data *data, int owned, unsigned int max_epoch, float desired_error,
+						const char *function)
+{
+	struct fann_train_data *scaled=NULL;
+	struct fann *f=f2M_train_fann(ann);
+
+	if (data->num_input!=f->num_input || data->num_output!=f->num_output)
+		return f2M_error(-4, ann, function, "data does not fit the network");
+
+	/* FANN's epochs run the network unscaled */
+	if (f2M_scaled(f)) {
+		if (!owned) {
+			scaled=f2M_data_copy(data);
+			if (scaled==NULL) return f2M_error(-5, ann, function, "out of memory");
+			data=scaled;
+		}
+		fann_scale_train(f, data);
+	}
+	f2M_train_epochs(ann, f, data, max_epoch, desired_error);
+	f2M_train_done(ann);
+	if (scaled!=NULL) fann_destroy_train(scaled);
+
+	if (fann_get_errno((struct fann_error*) f)!=FANN_E_NO_ERROR)
+		return f2M_error_fann(-3, ann, (struct fann_error*) f, function);
+	return (0);
+}
+
 /* Trains on a data from file, for a period of time.
  * This training uses the training algorithm chosen by 
  * f2M_set_training_algorithm, and the parameters set for these training algorithms.
@@ -415,11 +879,159 @@ FANN2MQL_API int __stdcall f2M_set_act_function_output(int ann, int activation_f
 
 FANN2MQL_API int __stdcall f2M_train_on_file(int ann, char *filename, unsigned int max_epoch, float desired_error)
 {
+	struct fann_train_data *data;
+	int ret;
+	AnnPin pin;
+
 	/* this network is not allocated */
-	if (ann<0 || ann>_ann || _fanns[ann]==NULL) return (-1);
+	if (!pin.acquire(ann)) return f2M_error_handle(-1, ann, __FUNCTION__);
 
-	fann_train_on_file(_fanns[ann], filename, max_epoch, 0, desired_error);
-	return (0);
+	data=fann_read_train_from_file(filename);
+	if (data==NULL) return f2M_error_fann(-2, ann, NULL, __FUNCTION__);
+
+	ret=f2M_train_on(ann, data, 1, max_epoch, desired_error, __FUNCTION__);
+	fann_destroy_train(data);
+	return ret;
+}
+
+/**
+ * Trains on a dataset handle for a period of time.
+ * See f2M_train_on_file(), the rows are trained on in their order.
+ *  ann - network handler returned by f2M_create*
+ *  data - dataset handler returned by f2M_data_*
+ * Returns:
+ *  0 on success and <0 on error
+ */
+FANN2MQL_API int __stdcall f2M_train_on_data(int ann, int data, unsigned int max_epoch, float desired_error)
+{
+	struct fann_train_data *d;
+	AnnPin pin;
+	DataPin data_pin;
+
+	/* this network is not allocated */
+	if (!pin.acquire(ann)) return f2M_error_handle(-1, ann, __FUNCTION__);
+
+	d=data_pin.acquire(data);
+	if (d==NULL) return f2M_error(-2, ann, __FUNCTION__, "invalid dataset handler");
+
+	return f2M_train_on(ann, d, 0, max_epoch, desired_error, __FUNCTION__);
+}
+
+/* Grows a network on data using the Cascade2 algorithm, see f2M_cascade_train_on_file()
+ *  ann - network handler, acquired
+ *  data - rows to train on
+ *  owned - nonzero if the rows may be changed
+ *  function - name of the exported function, for errors
+ * Returns:
+ *  number of neurons of the network on success and <0 on error
+ */
+static int f2M_cascade_on(int ann, struct fann_train_data *data, int owned, unsigned int max_neurons, float desired_error,
+						  const char *function)
+{
+	struct fann_train_data *scaled=NULL;
+	struct fann *f;
+	int ret;
+
+	if (data->num_input!=_fanns[ann]->num_input || data->num_output!=_fanns[ann]->num_output)
+		return f2M_error(-7, ann, function, "data does not fit the network");
+
+	f=fann_copy(_fanns[ann]);
+	if (f==NULL) return f2M_error(-5, ann, function, "out of memory");
+
+	/* like fann_cascadetrain_on_data(), on data in the units the network sees */
+	if (f2M_scaled(f)) {
+		if (!owned) {
+			scaled=f2M_data_copy(data);
+			if (scaled==NULL) {
+				fann_destroy(f);
+				return f2M_error(-5, ann, function, "out of memory");
+			}
+			data=scaled;
+		}
+		fann_scale_train(f, data);
+	}
+	fann_cascadetrain_on_data(f, data, max_neurons, 0, desired_error);
+	if (scaled!=NULL) fann_destroy_train(scaled);
+	if (fann_get_errno((struct fann_error*) f)!=FANN_E_NO_ERROR) {
+		ret=f2M_error_fann(-6, ann, (struct fann_error*) f, function);
+		fann_destroy(f);
+		return ret;
+	}
+
+	f2M_registry_modified(ann);
+	fann_destroy(f2M_publish_fann(ann, f));
+	f2M_registry_resized(ann);
+
+	return (int) fann_get_total_neurons(_fanns[ann]);
+}
+
+/* Trains on a data from file using the Cascade2 algorithm, which adds hidden
+ * neurons to the network one by one.
+ *  ann - network handler returned by f2M_create_shortcut_array()
+ *  filename - filename of data file
+ *  max_neurons - The maximum number of neurons to be added
+ *  desired_error - The desired f2M_get_MSE or f2M_get_bit_fail, depending on which stop function
+ *  is chosen by fann_set_train_stop_function.
+ * Returns:
+ *  number of neurons of the network on success and <0 on error
+ * Note:
+ *  The network grows on a copy which is published when the training is done.
+ *  Not available while the network is trained on a copy or learns online.
+ */
+FANN2MQL_API int __stdcall f2M_cascade_train_on_file(int ann, char *filename, unsigned int max_neurons, float desired_error)
+{
+	struct fann_train_data *data;
+	int ret;
+	AnnPin pin;
+
+	/* this network is not allocated */
+	if (!pin.acquire(ann)) return f2M_error_handle(-1, ann, __FUNCTION__);
+
+	/* cascade training works on shortcut networks only */
+	if (_fanns[ann]->network_type!=FANN_NETTYPE_SHORTCUT)
+		return f2M_error(-2, ann, __FUNCTION__, "network is not a shortcut network");
+
+	/* the copies must keep the topology of the published network */
+	if (_trainfanns[ann]!=NULL || f2M_online_enabled(ann) || f2M_job_running(ann))
+		return f2M_error(-3, ann, __FUNCTION__, "network is trained on a copy, learns online or by a job");
+
+	if (filename==NULL || max_neurons < 1) return f2M_error(-4, ann, __FUNCTION__, "invalid file name or number of neurons");
+
+	data=fann_read_train_from_file(filename);
+	if (data==NULL) return f2M_error_fann(-4, ann, NULL, __FUNCTION__);
+
+	ret=f2M_cascade_on(ann, data, 1, max_neurons, desired_error, __FUNCTION__);
+	fann_destroy_train(data);
+	return ret;
+}
+
+/* Trains on a dataset handle using the Cascade2 algorithm, see f2M_cascade_train_on_file()
+ *  ann - network handler returned by f2M_create_shortcut_array()
+ *  data - dataset handler returned by f2M_data_*
+ * Returns:
+ *  number of neurons of the network on success and <0 on error
+ */
+FANN2MQL_API int __stdcall f2M_cascade_train_on_data(int ann, int data, unsigned int max_neurons, float desired_error)
+{
+	struct fann_train_data *d;
+	AnnPin pin;
+	DataPin data_pin;
+
+	/* this network is not allocated */
+	if (!pin.acquire(ann)) return f2M_error_handle(-1, ann, __FUNCTION__);
+
+	/* cascade training works on shortcut networks only */
+	if (_fanns[ann]->network_type!=FANN_NETTYPE_SHORTCUT)
+		return f2M_error(-2, ann, __FUNCTION__, "network is not a shortcut network");
+
+	/* the copies must keep the topology of the published network */
+	if (_trainfanns[ann]!=NULL || f2M_online_enabled(ann) || f2M_job_running(ann))
+		return f2M_error(-3, ann, __FUNCTION__, "network is trained on a copy, learns online or by a job");
+
+	d=data_pin.acquire(data);
+	if (d==NULL || max_neurons < 1) return f2M_error(-4, ann, __FUNCTION__, "invalid dataset handler or number of neurons");
+
+	return f2M_cascade_on(ann, d, 0, max_neurons, desired_error, __FUNCTION__);
 }
 
 /* Load fann ann from file
@@ -430,34 +1042,113 @@ FANN2MQL_API int __stdcall f2M_train_on_file(int ann, char *filename, unsigned i
 FANN2MQL_API int __stdcall f2M_create_from_file(char *path)
 {	
 	/* too many networks allocated */
-	if (_ann>=ANNMAX) return (-1);
-	
-	/* allocate the handler for ann */
-	_ann++;		// XXX: rather simple allocation at the moment ;)
+	if (_ann>=ANNMAX-1) return f2M_error(-1, -1, __FUNCTION__, "too many networks");
 
-	_fanns[_ann]=fann_create_from_file(path);
-	if (_fanns[_ann]==NULL) {
-		/* fann_create_from_file returned an error */
-		_ann--;
-		return (-1);
-	} else {
-		/* initialize _outputs[] just in case... */
-		_outputs[_ann]=NULL;
-		return (_ann);
-	}
+	/* load it in the model server if connected */
+	if (f2M_client_active()) return f2M_client_create_from_file(path);
+
+	return f2M_new_handle(fann_create_from_file(path));
 }
 
 /* Save the entire network to a configuration file.
  *  ann - network handler returned by f2M_create*
  * Returns:
  *  0 on success and -1 on failure
+ * Note:
+ *  When training on a copy is enabled the published network is saved.
  */
 FANN2MQL_API int __stdcall f2M_save(int ann, char *path)
 {
+	struct fann *f;
+	int phase, ret;
+	AnnPin pin;
+
+	/* this network is not allocated */
+	if (!pin.acquire(ann)) return f2M_error_handle(-1, ann, __FUNCTION__);
+
+	f=f2M_read_lock(ann, &phase);
+	ret=fann_save(f, path);
+	if (ret!=0) ret=f2M_error_fann(ret, ann, (struct fann_error*) f, __FUNCTION__);
+	f2M_read_unlock(ann, phase);
+
+	return ret;
+}
+
+/* Enables training on a copy of the network.
+ * From now on all training functions and parameter setters modify a private
+ * copy, f2M_run() keeps using the published network until f2M_publish().
+ *  ann - network handler returned by f2M_create*
+ * Returns:
+ *  0 on success, <0 on error
+ */
+FANN2MQL_API int __stdcall f2M_train_copy_enable(int ann)
+{
+	AnnPin pin;
+
 	/* this network is not allocated */
-	if (ann<0 || ann>_ann || _fanns[ann]==NULL) return (-1);
+	if (!pin.acquire(ann)) return f2M_error_handle(-1, ann, __FUNCTION__);
+
+	/* already enabled */
+	if (_trainfanns[ann]!=NULL) return f2M_error(-2, ann, __FUNCTION__, "training on a copy is already enabled");
+
+	/* online learning publishes its own weights */
+	if (f2M_online_get_updates(ann)>=0) return f2M_error(-3, ann, __FUNCTION__, "network learns online");
+
+	_trainfanns[ann]=fann_copy(_fanns[ann]);
+	_sparefanns[ann]=fann_copy(_fanns[ann]);
+	if (_trainfanns[ann]==NULL || _sparefanns[ann]==NULL) {
+		f2M_free_copies(ann);
+		return f2M_error(-4, ann, __FUNCTION__, "out of memory");
+	}
+
+	return 0;
+}
+
+/* Publishes the training copy and disables training on a copy.
+ *  ann - network handler returned by f2M_create*
+ * Returns:
+ *  0 on success, <0 on error
+ */
+FANN2MQL_API int __stdcall f2M_train_copy_disable(int ann)
+{
+	AnnPin pin;
 
-	return fann_save(_fanns[ann], path);
+	/* this network is not allocated */
+	if (!pin.acquire(ann)) return f2M_error_handle(-1, ann, __FUNCTION__);
+
+	/* not enabled */
+	if (_trainfanns[ann]==NULL) return f2M_error(-2, ann, __FUNCTION__, "training on a copy is not enabled");
+
+	/* the training copy itself becomes the published network */
+	_sparefanns[ann]=f2M_publish_fann(ann, _trainfanns[ann]);
+	_trainfanns[ann]=NULL;
+	fann_destroy(_sparefanns[ann]);
+	_sparefanns[ann]=NULL;
+
+	return 0;
+}
+
+/* Publishes the weights and activation functions of the training copy.
+ * Readers are never blocked: the retired network is reused by the next call
+ * only after every f2M_run() started before the switch has finished.
+ *  ann - network handler returned by f2M_create*
+ * Returns:
+ *  0 on success, <0 on error
+ */
+FANN2MQL_API int __stdcall f2M_publish(int ann)
+{
+	AnnPin pin;
+
+	/* this network is not allocated */
+	if (!pin.acquire(ann)) return f2M_error_handle(-1, ann, __FUNCTION__);
+
+	/* training on a copy not enabled */
+	if (_trainfanns[ann]==NULL) return f2M_error(-2, ann, __FUNCTION__, "training on a copy is not enabled");
+
+	f2M_copy_fann_state(_sparefanns[ann], _trainfanns[ann]);
+	_sparefanns[ann]=f2M_publish_fann(ann, _sparefanns[ann]);
+
+	return 0;
 }
 
 #if 0
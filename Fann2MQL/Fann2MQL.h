@@ -1,120 +1,463 @@
-/* Fann2MQL.h
- *
- * Copyright (C) 2008-2009 Mariusz Woloszyn
- *
- *  This file is part of Fann2MQL package
- *
- *  Fann2MQL is free software; you can redistribute it and/or modify
- *  it under the terms of the GNU General Public License as published by
- *  the Free Software Foundation; either version 2 of the License, or
- *  (at your option) any later version.
- *
- *  Fann2MQL is distributed in the hope that it will be useful,
- *  but WITHOUT ANY WARRANTY; without even the implied warranty of
- *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
- *  GNU General Public License for more details.
- *
- *  You should have received a copy of the GNU General Public License
- *  along with Fann2MQL; if not, write to the Free Software
- *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
- */
-
-// The following ifdef block is the standard way of creating macros which make exporting 
-// from a DLL simpler. All files within this DLL are compiled with the FANN2MQL_EXPORTS
-// symbol defined on the command line. this symbol should not be defined on any project
-// that uses this DLL. This way any other project whose source files include this file see 
-// FANN2MQL_API functions as being imported from a DLL, whereas this DLL sees symbols
-// defined with this macro as being exported.
-#ifdef FANN2MQL_EXPORTS
-#define FANN2MQL_API __declspec(dllexport)
-#else
-#define FANN2MQL_API __declspec(dllimport)
-#endif
-
-/* maximum number of concurrently handled networks */
-#define ANNMAX	1024
-
-/* indicates an error if returned by a function returning double */
-#define DOUBLE_ERROR	-100000000
-
-/* maximum number of concurrent threads */
-#define F2M_MAX_THREADS	64
-
-typedef struct rTD {
-	int ann_start;
-	int ann_count;
-	int* anns;
-	double * input_vector;
-	int ret;
-	HANDLE mutexH;
-	DWORD threadId;
-} runThreadedData;
-
-
-/* array of FANN network structures */
-extern struct fann *_fanns[ANNMAX];
-/* array of output values of networks */
-extern double* _outputs[ANNMAX];
-/* index to last allocated network */
-extern int _ann;
-
-/* Creation/Execution */
-FANN2MQL_API int __stdcall f2M_create_standard(unsigned int num_layers, int l1num, int l2num, int l3num, int l4num);
-FANN2MQL_API int __stdcall f2M_destroy(int ann);
-FANN2MQL_API int __stdcall f2M_destroy_all_anns();
-FANN2MQL_API int __stdcall f2M_run(int ann, double *input_vector);
-FANN2MQL_API double __stdcall f2M_get_output(int ann, int output);
-FANN2MQL_API int __stdcall f2M_randomize_weights(int ann, double min_weight, double max_weight);
-/* Parameters */
-FANN2MQL_API int __stdcall f2M_get_num_input(int ann);
-FANN2MQL_API int __stdcall f2M_get_num_output(int ann);
-
-
-/* Training */
-FANN2MQL_API int __stdcall f2M_train(int ann, double *input_vector, double *output_vector);
-FANN2MQL_API int __stdcall f2M_train_fast(int ann, double *input_vector, double *output_vector);
-FANN2MQL_API int __stdcall f2M_test(int ann, double *input_vector, double *output_vector);
-FANN2MQL_API double __stdcall f2M_get_MSE(int ann);
-FANN2MQL_API int __stdcall f2M_get_bit_fail(int ann);
-FANN2MQL_API int __stdcall f2M_reset_MSE(int ann);
-/* Parameters */
-FANN2MQL_API int __stdcall f2m_get_training_algorithm(int ann);
-FANN2MQL_API int __stdcall f2m_set_training_algorithm(int ann, int training_algorithm);
-
-FANN2MQL_API int __stdcall f2M_set_act_function_layer(int ann, int activation_function, int layer);
-FANN2MQL_API int __stdcall f2M_set_act_function_hidden(int ann, int activation_function);
-FANN2MQL_API int __stdcall f2M_set_act_function_output(int ann, int activation_function);
-
-
-/* Data training */
-FANN2MQL_API int __stdcall f2M_train_on_file(int ann, char *filename, unsigned int max_epoch, float desired_error);
-/* Data manipulation */
-/* ... */
-
-/* File Input/Output */
-FANN2MQL_API int __stdcall f2M_create_from_file(char *path);
-FANN2MQL_API int __stdcall f2M_save(int ann, char *path);
-
-
-
-
-
-#if 0
-/* Threaded functions */
-FANN2MQL_API int __stdcall f2M_threads_init(int num_threads);
-FANN2MQL_API int __stdcall f2M_threads_deinit();
-FANN2MQL_API int __stdcall f2m_run_threaded(int anns_count, int anns[], double *input_vector);
-#endif 
-
-#if 0
-// This class is exported from the Fann2MQL.dll
-class FANN2MQL_API CFann2MQL {
-public:
-	CFann2MQL(void);
-	// TODO: add your methods here.
-};
-
-extern FANN2MQL_API int nFann2MQL;
-
-FANN2MQL_API int fnFann2MQL(void);
+/* Fann2MQL.h
+ *
+ * Copyright (C) 2008-2009 Mariusz Woloszyn
+ *
+ *  This file is part of Fann2MQL package
+ *
+ *  Fann2MQL is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Fann2MQL is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Fann2MQL; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+// The following ifdef block is the standard way of creating macros which make exporting 
+// from a DLL simpler. All files within this DLL are compiled with the FANN2MQL_EXPORTS
+// symbol defined on the command line. this symbol should not be defined on any project
+// that uses this DLL. This way any other project whose source files include this file see 
+// FANN2MQL_API functions as being imported from a DLL, whereas this DLL sees symbols
+// defined with this macro as being exported.
+#ifdef FANN2MQL_EXPORTS
+#define FANN2MQL_API __declspec(dllexport)
+#else
+#define FANN2MQL_API __declspec(dllimport)
+#endif
+
+/* maximum number of concurrently handled networks */
+#define ANNMAX	16384
+
+/* indicates an error if returned by a function returning double */
+#define DOUBLE_ERROR	-100000000
+
+/* maximum number of concurrent threads */
+#define F2M_MAX_THREADS	64
+
+/* number of samples processed together by the batched kernels */
+#define F2M_BATCH	64
+
+/* number of doubles returned by f2M_memory_stats() */
+#define F2M_MEMORY_STATS	7
+
+/* maximum number of layers of networks created by f2M_sweep() */
+#define F2M_SWEEP_MAX_LAYERS	5
+/* number of integers describing a single f2M_sweep() configuration */
+#define F2M_SWEEP_CONFIG	(F2M_SWEEP_MAX_LAYERS+2)
+/* number of doubles returned by f2M_sweep() for a single configuration */
+#define F2M_SWEEP_RESULT	4
+
+/* kinds of work with separate cost estimates (Fann2MQL-cost.cpp) */
+#define F2M_COST_RUN	0
+#define F2M_COST_TRAIN	1
+#define F2M_COST_KINDS	2
+
+/* number of doubles returned by f2M_get_cache_stats() */
+#define F2M_CACHE_STATS	3
+
+/* number of doubles returned by f2M_job_progress() */
+#define F2M_JOB_PROGRESS	5
+/* states of training jobs (Fann2MQL-jobs.cpp) */
+#define F2M_JOB_RUNNING		0
+#define F2M_JOB_DONE		1
+#define F2M_JOB_STOPPED		2
+#define F2M_JOB_CANCELLED	3
+#define F2M_JOB_FAILED		4
+
+/* number of doubles returned by f2M_checkpoint_info() */
+#define F2M_CHECKPOINT_INFO	3
+
+/* how f2M_run_series() builds the inputs of a bar (Fann2MQL-series.cpp) */
+#define F2M_FEATURE_PRICES		0
+#define F2M_FEATURE_DIFFS		1
+#define F2M_FEATURE_LOG_RETURNS	2
+#define F2M_FEATURE_RELATIVE	3
+
+/* how f2M_input_sensitivity() measures the importance of inputs (Fann2MQL-sensitivity.cpp) */
+#define F2M_SENSITIVITY_GRADIENT	0
+#define F2M_SENSITIVITY_PERMUTATION	1
+
+/* number of request slots of the model server */
+#define F2M_SERVER_SLOTS	64
+/* maximum number of inputs or outputs of a network run by the model server */
+#define F2M_SERVER_IO	1024
+
+typedef struct rTD {
+	int ann_start;
+	int ann_count;
+	int* anns;
+	double * input_vector;
+	int ret;
+	int failed;		/* handler of the network that failed, -1 if none */
+	HANDLE mutexH;
+	HANDLE readyH;	/* set when the thread owns mutexH */
+	DWORD threadId;
+} runThreadedData;
+
+/* fast math lookup tables (Fann2MQL-fastmath.cpp) */
+typedef struct fT fastTables;
+
+/* network of a proxy handler, living in the model server */
+typedef struct rND {
+	int ann;		/* server side handler */
+	int num_input;
+	int num_output;
+} remoteData;
+
+
+/* array of FANN network structures */
+extern struct fann *_fanns[ANNMAX];
+/* array of output values of networks */
+extern double* _outputs[ANNMAX];
+/* index to last allocated network */
+extern int _ann;
+/* TBB initialization indicator */
+extern int _TBB_Initialized;
+/* output buffers owned by the library */
+extern double* _outbufs[ANNMAX];
+/* training copies of networks, NULL when trained in place */
+extern struct fann *_trainfanns[ANNMAX];
+/* retired published networks reused by f2M_publish() */
+extern struct fann *_sparefanns[ANNMAX];
+/* proxy handlers of the model server client, NULL for local networks */
+extern remoteData* _remote[ANNMAX];
+
+/* Internal helpers (Fann2MQL.cpp) */
+int f2M_new_handle(struct fann *ann);
+void f2M_handles_lock();
+void f2M_handles_unlock();
+struct fann* f2M_read_lock(int ann, int *phase);
+void f2M_read_unlock(int ann, int phase);
+void f2M_synchronize(int ann);
+struct fann* f2M_publish_fann(int ann, struct fann *next);
+int f2M_run_ann(int ann, double *input_vector);
+struct fann* f2M_train_fann(int ann);
+struct fann* f2M_trained_fann(int ann);
+void f2M_train_done(int ann);
+void f2M_weights_changed(int ann);
+LONG f2M_generation(int ann);
+void f2M_copy_fann_state(struct fann *dst, struct fann *src);
+
+/* Last error of each thread (Fann2MQL-error.cpp) */
+int f2M_error(int code, int ann, const char *function, const char *message);
+int f2M_error_handle(int code, int ann, const char *function);
+int f2M_error_fann(int code, int ann, struct fann_error *errdat, const char *function);
+int f2M_error_system(int code, const char *function, const char *what);
+void f2M_error_thread_detach();
+
+/* Memory pool (Fann2MQL-memory.cpp) */
+void* f2M_malloc(size_t size);
+void* f2M_calloc(size_t size);
+void f2M_free(void *p);
+void f2M_pool_thread_detach();
+double f2M_fann_memory(struct fann *ann);
+
+/* Online learning internals (Fann2MQL-online.cpp) */
+int f2M_online_enabled(int ann);
+double f2M_online_memory(int ann);
+
+/* Registry of networks loaded on demand (Fann2MQL-registry.cpp) */
+int f2M_acquire(int ann);
+int f2M_acquire_loaded(int ann);
+void f2M_release(int ann);
+int f2M_acquire_all(int count, int *anns);
+void f2M_release_all(int count, int *anns);
+void f2M_registry_modified(int ann);
+void f2M_registry_resized(int ann);
+int f2M_registered(int ann);
+void f2M_registry_release(int ann);
+
+/* Network acquired by a call, released when the call returns */
+class AnnPin {
+	int ann;
+public:
+	AnnPin() : ann(-1) {}
+	~AnnPin() { if (ann>=0) f2M_release(ann); }
+	int acquire(int a) {
+		if (!f2M_acquire(a)) return 0;
+		ann=a;
+		return 1;
+	}
+	/* pins the network only if it is in memory */
+	int acquire_loaded(int a) {
+		if (!f2M_acquire_loaded(a)) return 0;
+		ann=a;
+		return 1;
+	}
+};
+
+/* Reproducible random numbers (Fann2MQL-random.cpp) */
+double f2M_random(unsigned __int64 seed, unsigned __int64 stream, unsigned __int64 n);
+void f2M_randomize_fann(struct fann *ann, unsigned __int64 seed, unsigned __int64 stream, unsigned int call,
+						double min_weight, double max_weight);
+int f2M_deterministic();
+unsigned __int64 f2M_base_seed();
+int f2M_seed_new(int ann);
+void f2M_randomize(int ann, struct fann *f, double min_weight, double max_weight);
+void f2M_seed_release(int ann);
+
+/* Priorities of inference and training (Fann2MQL-sched.cpp) */
+void f2M_inference_enter();
+void f2M_inference_leave();
+void f2M_training_yield();
+int f2M_training_preempted();
+int f2M_training_begin();
+void f2M_training_end(int prio);
+int f2M_training_workers();
+size_t f2M_training_grain(size_t n);
+unsigned int f2M_train_epochs(int ann, struct fann *f, struct fann_train_data *data, unsigned int max_epochs, float desired_error);
+
+/* Work partitioning by cost (Fann2MQL-cost.cpp) */
+__int64 f2M_ticks();
+void f2M_cost_update(int kind, int ann, __int64 ticks);
+void f2M_cost_release(int ann);
+int f2M_cost_plan(int kind, int count, int *anns, int bins, int *order, int *first);
+
+/* Fast math mode (Fann2MQL-fastmath.cpp) */
+double f2M_fast_activation(const fastTables *ft, unsigned int activation_function, double x);
+double f2M_fast_derived(const fastTables *ft, unsigned int activation_function,
+						double steepness, double value, double sum);
+double* f2M_forward(struct fann *ann, double *input);
+void f2M_fast_math_attach(int ann, struct fann *f);
+void f2M_fast_math_release(int ann);
+
+/* Fused training kernel (Fann2MQL-fused.cpp) */
+int f2M_fused_supported(struct fann *ann);
+void f2M_backward_fused(struct fann *ann, double *desired_output);
+void f2M_train_step(struct fann *ann, double *input_vector, double *output_vector);
+void f2M_backward(struct fann *ann, double *output_vector);
+
+/* Batched kernels (Fann2MQL-batch.cpp) */
+int f2M_batch_scratch_size(struct fann *ann);
+void f2M_run_batch(struct fann *ann, double *weights, int n, double *inputs, double *outputs, double *values, double *sums);
+double f2M_mse_factor(struct fann_neuron *neuron);
+
+/* Input and output scaling (Fann2MQL-scale.cpp) */
+int f2M_scaled(struct fann *ann);
+double f2M_scale_input(struct fann *ann, unsigned int i, double x);
+double f2M_scale_output(struct fann *ann, unsigned int o, double y);
+double f2M_descale_output(struct fann *ann, unsigned int o, double y);
+void f2M_scale_outputs(struct fann *ann, double *output_vector, double *scaled);
+
+/* Datasets (Fann2MQL-data.cpp) */
+struct fann_train_data* f2M_data_acquire(int data);
+void f2M_data_release(int data);
+int f2M_data_gather(struct fann_train_data *data, double *inputs, double *outputs);
+struct fann_train_data* f2M_data_copy(struct fann_train_data *data);
+
+/* Dataset used by a call, released when the call returns */
+class DataPin {
+	int data;
+public:
+	DataPin() : data(-1) {}
+	~DataPin() { if (data>=0) f2M_data_release(data); }
+	struct fann_train_data* acquire(int d) {
+		struct fann_train_data *f=f2M_data_acquire(d);
+		if (f!=NULL) data=d;
+		return f;
+	}
+};
+
+/* Background training jobs (Fann2MQL-jobs.cpp) */
+void f2M_jobs_release(int ann);
+int f2M_job_running(int ann);
+
+/* Training checkpoints (Fann2MQL-checkpoint.cpp) */
+void f2M_checkpoint_epoch(int ann, struct fann *f);
+void f2M_checkpoint_release(int ann);
+
+/* Result cache (Fann2MQL-cache.cpp) */
+unsigned __int64 f2M_input_hash(double *input, int n);
+int f2M_cache_lookup(int ann, LONG generation, double *input_vector, double *outputs);
+void f2M_cache_store(int ann, LONG generation, double *input_vector, double *outputs);
+void f2M_cache_release(int ann);
+double f2M_cache_memory(int ann);
+
+/* Price history features (Fann2MQL-series.cpp) */
+int f2M_series_history(int feature_spec, int window);
+void f2M_series_features(int feature_spec, double *prices, int t, int window, double *x);
+
+/* Model server client (Fann2MQL-server.cpp) */
+int f2M_client_active();
+int f2M_client_create_from_file(char *path);
+int f2M_client_run(int ann, double *input_vector);
+void f2M_client_release(int ann);
+int f2M_client_num_input(int ann);
+int f2M_client_num_output(int ann);
+
+/* Creation/Execution */
+FANN2MQL_API int __stdcall f2M_create_standard(unsigned int num_layers, int l1num, int l2num, int l3num, int l4num);
+FANN2MQL_API int __stdcall f2M_create_standard_array(unsigned int num_layers, int *layers);
+FANN2MQL_API int __stdcall f2M_create_shortcut_array(unsigned int num_layers, int *layers);
+FANN2MQL_API int __stdcall f2M_destroy(int ann);
+FANN2MQL_API int __stdcall f2M_destroy_all_anns();
+FANN2MQL_API int __stdcall f2M_run(int ann, double *input_vector);
+FANN2MQL_API double __stdcall f2M_get_output(int ann, int output);
+FANN2MQL_API int __stdcall f2M_randomize_weights(int ann, double min_weight, double max_weight);
+FANN2MQL_API int __stdcall f2M_seed(int ann, int seed);
+FANN2MQL_API int __stdcall f2M_set_deterministic(int enable, int seed);
+/* Parameters */
+FANN2MQL_API int __stdcall f2M_get_num_input(int ann);
+FANN2MQL_API int __stdcall f2M_get_num_output(int ann);
+FANN2MQL_API int __stdcall f2M_get_total_connections(int ann);
+/* Memory */
+FANN2MQL_API double __stdcall f2M_get_ann_memory(int ann);
+FANN2MQL_API int __stdcall f2M_memory_stats(double *stats);
+
+
+/* Training */
+FANN2MQL_API int __stdcall f2M_train(int ann, double *input_vector, double *output_vector);
+FANN2MQL_API int __stdcall f2M_train_fast(int ann, double *input_vector, double *output_vector);
+FANN2MQL_API int __stdcall f2M_test(int ann, double *input_vector, double *output_vector);
+FANN2MQL_API double __stdcall f2M_get_MSE(int ann);
+FANN2MQL_API int __stdcall f2M_get_bit_fail(int ann);
+FANN2MQL_API int __stdcall f2M_reset_MSE(int ann);
+FANN2MQL_API int __stdcall f2M_test_dataset(int ann, int num_data, double *inputs, double *targets, double *mse, int *bit_fail, double *residuals);
+FANN2MQL_API int __stdcall f2M_test_data(int ann, int data, double *mse, int *bit_fail);
+/* Parameters */
+FANN2MQL_API int __stdcall f2m_get_training_algorithm(int ann);
+FANN2MQL_API int __stdcall f2m_set_training_algorithm(int ann, int training_algorithm);
+
+FANN2MQL_API int __stdcall f2M_set_act_function_layer(int ann, int activation_function, int layer);
+FANN2MQL_API int __stdcall f2M_set_act_function_hidden(int ann, int activation_function);
+FANN2MQL_API int __stdcall f2M_set_act_function_output(int ann, int activation_function);
+FANN2MQL_API int __stdcall f2M_set_fast_math(int ann, double max_error);
+/* Scaling */
+FANN2MQL_API int __stdcall f2M_set_scaling(int ann, int num_data, double *inputs, double *outputs, int mode,
+										   double new_input_min, double new_input_max,
+										   double new_output_min, double new_output_max);
+FANN2MQL_API int __stdcall f2M_clear_scaling(int ann);
+FANN2MQL_API int __stdcall f2M_data_set_scaling(int ann, int data, int scale_outputs, int mode,
+												double new_input_min, double new_input_max,
+												double new_output_min, double new_output_max);
+
+
+/* Data training */
+FANN2MQL_API int __stdcall f2M_train_on_file(int ann, char *filename, unsigned int max_epoch, float desired_error);
+FANN2MQL_API int __stdcall f2M_cascade_train_on_file(int ann, char *filename, unsigned int max_neurons, float desired_error);
+FANN2MQL_API int __stdcall f2M_train_on_data(int ann, int data, unsigned int max_epoch, float desired_error);
+FANN2MQL_API int __stdcall f2M_cascade_train_on_data(int ann, int data, unsigned int max_neurons, float desired_error);
+FANN2MQL_API int __stdcall f2M_set_training_share(double share);
+/* Model selection */
+FANN2MQL_API int __stdcall f2M_sweep(int num_data, int num_input, int num_output, double *inputs, double *outputs,
+									 int k_folds, int num_configs, int *configs, int max_epoch, int epochs_between_checks,
+									 double prune_ratio, double *results, int *ranking);
+FANN2MQL_API int __stdcall f2M_sweep_data(int data, int k_folds, int num_configs, int *configs, int max_epoch,
+										  int epochs_between_checks, double prune_ratio, double *results, int *ranking);
+FANN2MQL_API int __stdcall f2M_sweep_random_configs(int num_configs, int *lo, int *hi, int seed, int *configs);
+/* Pruning */
+FANN2MQL_API int __stdcall f2M_prune(int ann, double threshold);
+FANN2MQL_API int __stdcall f2M_prune_fraction(int ann, double fraction);
+/* Data manipulation */
+FANN2MQL_API int __stdcall f2M_data_create(int num_data, int num_input, int num_output, double *inputs, double *outputs);
+FANN2MQL_API int __stdcall f2M_data_append(int data, int num_data, double *inputs, double *outputs);
+FANN2MQL_API int __stdcall f2M_data_length(int data);
+FANN2MQL_API int __stdcall f2M_data_shuffle(int data, int seed);
+FANN2MQL_API int __stdcall f2M_data_slice(int data, int first, int count);
+FANN2MQL_API int __stdcall f2M_data_split(int data, double train_fraction, int *train, int *validation);
+FANN2MQL_API int __stdcall f2M_data_walk_forward(int data, int fold, int train_rows, int test_rows, int step,
+												 int *train, int *test);
+FANN2MQL_API int __stdcall f2M_data_merge(int a, int b);
+FANN2MQL_API int __stdcall f2M_data_destroy(int data);
+
+/* File Input/Output */
+FANN2MQL_API int __stdcall f2M_create_from_file(char *path);
+FANN2MQL_API int __stdcall f2M_save(int ann, char *path);
+
+/* Networks loaded on demand */
+FANN2MQL_API int __stdcall f2M_register_file(char *path);
+FANN2MQL_API int __stdcall f2M_set_memory_budget(double bytes);
+FANN2MQL_API int __stdcall f2M_prefetch(int count, int *anns);
+FANN2MQL_API int __stdcall f2M_prefetch_stop();
+FANN2MQL_API int __stdcall f2M_is_loaded(int ann);
+
+/* Training on a copy */
+FANN2MQL_API int __stdcall f2M_train_copy_enable(int ann);
+FANN2MQL_API int __stdcall f2M_train_copy_disable(int ann);
+FANN2MQL_API int __stdcall f2M_publish(int ann);
+
+/* Background training */
+FANN2MQL_API int __stdcall f2M_train_async(int ann, int data, int validation, unsigned int max_epoch, float desired_error, int patience);
+FANN2MQL_API int __stdcall f2M_job_progress(int job, double *progress);
+FANN2MQL_API int __stdcall f2M_job_cancel(int job);
+FANN2MQL_API int __stdcall f2M_job_release(int job);
+FANN2MQL_API int __stdcall f2M_checkpoint_enable(int ann, char *path, int every_epochs);
+FANN2MQL_API int __stdcall f2M_checkpoint_disable(int ann);
+FANN2MQL_API int __stdcall f2M_checkpoint_resume(char *path, int every_epochs);
+FANN2MQL_API int __stdcall f2M_checkpoint_info(int ann, double *info);
+
+/* Online learning */
+FANN2MQL_API int __stdcall f2M_online_init(int ann, int capacity, int batch_size, int update_every, int epochs);
+FANN2MQL_API int __stdcall f2M_online_deinit(int ann);
+FANN2MQL_API int __stdcall f2M_online_add(int ann, double *input_vector, double *output_vector);
+FANN2MQL_API int __stdcall f2M_online_get_updates(int ann);
+
+/* Model server */
+FANN2MQL_API int __stdcall f2M_server_start(char *name, int threads);
+FANN2MQL_API int __stdcall f2M_server_stop();
+FANN2MQL_API int __stdcall f2M_client_connect(char *name);
+FANN2MQL_API int __stdcall f2M_client_disconnect();
+
+/* Result cache */
+FANN2MQL_API int __stdcall f2M_set_cache(int ann, int entries);
+FANN2MQL_API int __stdcall f2M_get_cache_stats(int ann, double *stats);
+
+/* Price histories */
+FANN2MQL_API int __stdcall f2M_run_series(int ann, double *prices, int n_bars, int window, int feature_spec, double *signals);
+
+/* Recursive forecasts */
+FANN2MQL_API int __stdcall f2M_forecast(int ann, double *seed_window, int horizon, int *output_to_input, double *path);
+FANN2MQL_API int __stdcall f2M_forecast_parallel(int anns_count, int *anns, int num_seeds, double *seed_windows,
+												 int horizon, int *output_to_input, double *paths);
+
+/* Input sensitivity */
+FANN2MQL_API int __stdcall f2M_input_sensitivity(int ann, int data, int mode, double *importance);
+FANN2MQL_API int __stdcall f2M_input_sensitivity_parallel(int anns_count, int *anns, int data, int mode, double *importance);
+
+/* Monte Carlo uncertainty */
+FANN2MQL_API int __stdcall f2M_run_mc(int ann, double *input, int n_draws, double *noise_spec, double *mean, double *stddev);
+FANN2MQL_API int __stdcall f2M_run_mc_parallel(int anns_count, int *anns, double *input, int n_draws, double *noise_spec,
+											   double *mean, double *stddev);
+
+/* Stacked ensembles */
+FANN2MQL_API int __stdcall f2M_group_create(int count, int *anns);
+FANN2MQL_API int __stdcall f2M_group_run(int group, double *input_vector);
+FANN2MQL_API int __stdcall f2M_group_destroy(int group);
+
+/* Errors */
+FANN2MQL_API int __stdcall f2M_get_last_error();
+FANN2MQL_API int __stdcall f2M_get_last_error_ann();
+FANN2MQL_API int __stdcall f2M_get_last_error_fann();
+FANN2MQL_API int __stdcall f2M_get_last_error_message(char *buf, int size);
+FANN2MQL_API int __stdcall f2M_get_last_error_function(char *buf, int size);
+FANN2MQL_API int __stdcall f2M_clear_last_error();
+
+
+
+
+
+#if 0
+/* Threaded functions */
+FANN2MQL_API int __stdcall f2M_threads_init(int num_threads);
+FANN2MQL_API int __stdcall f2M_threads_deinit();
+FANN2MQL_API int __stdcall f2m_run_threaded(int anns_count, int anns[], double *input_vector);
+#endif 
+
+#if 0
+// This class is exported from the Fann2MQL.dll
+class FANN2MQL_API CFann2MQL {
+public:
+	CFann2MQL(void);
+	// TODO: add your methods here.
+};
+
+extern FANN2MQL_API int nFann2MQL;
+
+FANN2MQL_API int fnFann2MQL(void);
 #endif
\ No newline at end of file